@@ -0,0 +1,266 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <mpmcQueue.hpp>
+
+/*
+线程池性能测试
+ThreadPool 和 ThreadPool2 都定义了 Thread、PoolMode，不能放在同一个编译单元里，
+所以每个线程池一个 .cpp，各自实现一个适配器，测试流程写成模板放在这里共用
+
+每个测试结果输出一行 JSON（JSON Lines），方便脚本比较两个版本的结果：
+{"bench":"submit_throughput","pool":"ThreadPool2","queue":"lockfree","producers":2,"workers":4,"tasks":200000,"seconds":0.1,"ops_per_sec":2000000}
+延迟类的测试还有 p50_ns/p90_ns/p99_ns/p999_ns/max_ns
+*/
+struct BenchConfig
+{
+    BenchConfig() : tasks_(200000), latencySamples_(20000), fanout_(64), rounds_(2000), maxThreads_(std::thread::hardware_concurrency()), out_(stdout)
+    {
+        if (maxThreads_ == 0)
+            maxThreads_ = 1;
+    }
+
+    int tasks_;          // 吞吐量测试每次提交的任务总数
+    int latencySamples_; // 往返延迟测试的次数
+    int fanout_;         // fan-out/fan-in 每轮的任务数量
+    int rounds_;         // fan-out/fan-in 的轮数
+    int maxThreads_;     // 提交线程和工作线程数量的上限，从1开始每次翻倍
+    std::string filter_; // 只运行名字里包含它的测试
+    FILE *out_;
+};
+
+// 一个测试结果
+struct BenchResult
+{
+    BenchResult() : producers_(0), workers_(0), tasks_(0), seconds_(0), hasLatency_(false), p50_(0), p90_(0), p99_(0), p999_(0), max_(0)
+    {
+    }
+
+    std::string bench_;
+    std::string pool_;
+    std::string queue_;
+    int producers_;
+    int workers_;
+    long long tasks_;
+    double seconds_;
+    bool hasLatency_;
+    long long p50_, p90_, p99_, p999_, max_; // 单位纳秒
+};
+
+// 1, 2, 4 ... maxThreads（最后一个不是2的幂时也包含进来）
+inline std::vector<int> threadCounts(int maxThreads)
+{
+    std::vector<int> counts;
+    for (int n = 1; n < maxThreads; n *= 2)
+        counts.push_back(n);
+    counts.push_back(maxThreads);
+    return counts;
+}
+
+inline const char *queueName(QueueMode mode)
+{
+    return mode == QueueMode::MODE_LOCKFREE ? "lockfree" : "locked";
+}
+
+inline int64_t benchNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 延迟样本排序后取分位数
+inline void fillLatency(BenchResult &result, std::vector<int64_t> &samples)
+{
+    if (samples.empty())
+        return;
+    std::sort(samples.begin(), samples.end());
+    std::size_t n = samples.size();
+    result.hasLatency_ = true;
+    result.p50_ = samples[n * 50 / 100];
+    result.p90_ = samples[n * 90 / 100];
+    result.p99_ = samples[std::min(n - 1, n * 99 / 100)];
+    result.p999_ = samples[std::min(n - 1, n * 999 / 1000)];
+    result.max_ = samples[n - 1];
+}
+
+inline void report(const BenchConfig &config, const BenchResult &result)
+{
+    double opsPerSec = result.seconds_ > 0 ? (double)result.tasks_ / result.seconds_ : 0;
+    std::fprintf(config.out_, "{\"bench\":\"%s\",\"pool\":\"%s\",\"queue\":\"%s\",\"producers\":%d,\"workers\":%d,\"tasks\":%lld,\"seconds\":%.6f,\"ops_per_sec\":%.0f",
+                 result.bench_.c_str(), result.pool_.c_str(), result.queue_.c_str(), result.producers_, result.workers_, result.tasks_, result.seconds_, opsPerSec);
+    if (result.hasLatency_)
+        std::fprintf(config.out_, ",\"p50_ns\":%lld,\"p90_ns\":%lld,\"p99_ns\":%lld,\"p999_ns\":%lld,\"max_ns\":%lld",
+                     result.p50_, result.p90_, result.p99_, result.p999_, result.max_);
+    std::fprintf(config.out_, "}\n");
+    std::fflush(config.out_);
+}
+
+inline bool selected(const BenchConfig &config, const char *bench)
+{
+    return config.filter_.empty() || std::string(bench).find(config.filter_) != std::string::npos;
+}
+
+/*
+适配器需要提供：
+    typedef ... Handle;                          // 提交一个任务得到的结果句柄
+    Adapter(int workers, QueueMode mode);        // 创建并启动线程池
+    Handle submit();                             // 提交一个空任务
+    template <typename F> Handle submit(F f);    // 提交一个任务
+    static void wait(Handle &handle);            // 等待任务执行完
+    static const char *name();
+*/
+
+// 提交吞吐量：producers 个线程一共提交 tasks 个空任务，计时到所有任务执行完
+template <typename Adapter>
+void benchSubmitThroughput(const BenchConfig &config, QueueMode mode, int producers, int workers)
+{
+    Adapter pool(workers, mode);
+    int perProducer = config.tasks_ / producers;
+    std::atomic_int ready(0);
+    std::atomic_bool go(false);
+    std::vector<std::thread> threads;
+    std::vector<int64_t> finish(producers);
+    for (int p = 0; p < producers; p++)
+    {
+        threads.emplace_back([&, p]()
+                             {
+            std::vector<typename Adapter::Handle> handles;
+            handles.reserve(perProducer);
+            ready++;
+            while (!go)
+                std::this_thread::yield();
+            for (int i = 0; i < perProducer; i++)
+                handles.push_back(pool.submit());
+            for (typename Adapter::Handle &handle : handles)
+                Adapter::wait(handle);
+            finish[p] = benchNowNs(); });
+    }
+    while (ready < producers)
+        std::this_thread::yield();
+    int64_t start = benchNowNs();
+    go = true;
+    for (std::thread &t : threads)
+        t.join();
+
+    BenchResult result;
+    result.bench_ = "submit_throughput";
+    result.pool_ = Adapter::name();
+    result.queue_ = queueName(mode);
+    result.producers_ = producers;
+    result.workers_ = workers;
+    result.tasks_ = (long long)perProducer * producers;
+    result.seconds_ = (double)(*std::max_element(finish.begin(), finish.end()) - start) / 1e9;
+    report(config, result);
+}
+
+// 空任务的往返延迟：提交一个任务并等待它执行完，重复 latencySamples 次
+template <typename Adapter>
+void benchRoundTrip(const BenchConfig &config, QueueMode mode, int workers)
+{
+    Adapter pool(workers, mode);
+    std::vector<int64_t> samples;
+    samples.reserve(config.latencySamples_);
+    // 预热，让线程都创建好
+    for (int i = 0; i < 1000; i++)
+    {
+        typename Adapter::Handle handle = pool.submit();
+        Adapter::wait(handle);
+    }
+    int64_t begin = benchNowNs();
+    for (int i = 0; i < config.latencySamples_; i++)
+    {
+        int64_t start = benchNowNs();
+        typename Adapter::Handle handle = pool.submit();
+        Adapter::wait(handle);
+        samples.push_back(benchNowNs() - start);
+    }
+
+    BenchResult result;
+    result.bench_ = "roundtrip_latency";
+    result.pool_ = Adapter::name();
+    result.queue_ = queueName(mode);
+    result.producers_ = 1;
+    result.workers_ = workers;
+    result.tasks_ = config.latencySamples_;
+    result.seconds_ = (double)(benchNowNs() - begin) / 1e9;
+    fillLatency(result, samples);
+    report(config, result);
+}
+
+// fan-out/fan-in：每轮提交 fanout 个小任务再等待全部完成，统计每轮的耗时
+template <typename Adapter>
+void benchFanOut(const BenchConfig &config, QueueMode mode, int workers)
+{
+    Adapter pool(workers, mode);
+    std::vector<int64_t> samples;
+    samples.reserve(config.rounds_);
+    std::vector<typename Adapter::Handle> handles;
+    handles.reserve(config.fanout_);
+    std::atomic<uint64_t> sink(0);
+    int64_t begin = benchNowNs();
+    for (int r = 0; r < config.rounds_; r++)
+    {
+        int64_t start = benchNowNs();
+        for (int i = 0; i < config.fanout_; i++)
+        {
+            handles.push_back(pool.submit([&sink, i]()
+                                          {
+                // 一点点计算，模拟很小的任务
+                uint64_t x = (uint64_t)i;
+                for (int k = 0; k < 64; k++)
+                    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+                sink.fetch_add(x & 1, std::memory_order_relaxed); }));
+        }
+        for (typename Adapter::Handle &handle : handles)
+            Adapter::wait(handle);
+        handles.clear();
+        samples.push_back(benchNowNs() - start);
+    }
+
+    BenchResult result;
+    result.bench_ = "fanout_fanin";
+    result.pool_ = Adapter::name();
+    result.queue_ = queueName(mode);
+    result.producers_ = 1;
+    result.workers_ = workers;
+    result.tasks_ = (long long)config.rounds_ * config.fanout_;
+    result.seconds_ = (double)(benchNowNs() - begin) / 1e9;
+    fillLatency(result, samples);
+    report(config, result);
+}
+
+// 一个线程池的全部测试：每种队列模式下，吞吐量测试按 提交线程数 x 工作线程数 的组合运行
+template <typename Adapter>
+void runBenches(const BenchConfig &config)
+{
+    const QueueMode modes[] = {QueueMode::MODE_LOCKED, QueueMode::MODE_LOCKFREE};
+    std::vector<int> counts = threadCounts(config.maxThreads_);
+    for (QueueMode mode : modes)
+    {
+        if (selected(config, "submit_throughput"))
+        {
+            for (int workers : counts)
+            {
+                for (int producers : counts)
+                    benchSubmitThroughput<Adapter>(config, mode, producers, workers);
+            }
+        }
+        if (selected(config, "roundtrip_latency"))
+            benchRoundTrip<Adapter>(config, mode, config.maxThreads_);
+        if (selected(config, "fanout_fanin"))
+            benchFanOut<Adapter>(config, mode, config.maxThreads_);
+    }
+}
+
+// 每个线程池一个编译单元
+void runThreadPoolBenches(const BenchConfig &config);
+void runThreadPool2Benches(const BenchConfig &config);
+
+#endif
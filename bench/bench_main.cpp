@@ -0,0 +1,74 @@
+#include "bench.hpp"
+#include <cstdlib>
+#include <cstring>
+
+/*
+用法：threadpool_bench [选项]
+    --pool=ThreadPool|ThreadPool2  只测试一个线程池，默认两个都测
+    --bench=名字                   只运行名字里包含它的测试（submit_throughput/roundtrip_latency/fanout_fanin）
+    --tasks=N                      吞吐量测试的任务总数
+    --samples=N                    往返延迟测试的次数
+    --fanout=N --rounds=N          fan-out/fan-in 每轮的任务数量和轮数
+    --threads=N                    提交线程和工作线程数量的上限，默认CPU核心数量
+    --out=文件                     结果写到文件，默认标准输出
+    --quick                        缩小任务数量，用于冒烟测试
+*/
+static bool parseInt(const char *arg, const char *name, int &value)
+{
+    std::size_t len = std::strlen(name);
+    if (std::strncmp(arg, name, len) != 0)
+        return false;
+    value = std::atoi(arg + len);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    BenchConfig config;
+    std::string pool;
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (parseInt(arg, "--tasks=", config.tasks_) || parseInt(arg, "--samples=", config.latencySamples_) ||
+            parseInt(arg, "--fanout=", config.fanout_) || parseInt(arg, "--rounds=", config.rounds_) ||
+            parseInt(arg, "--threads=", config.maxThreads_))
+            continue;
+        if (std::strncmp(arg, "--pool=", 7) == 0)
+            pool = arg + 7;
+        else if (std::strncmp(arg, "--bench=", 8) == 0)
+            config.filter_ = arg + 8;
+        else if (std::strncmp(arg, "--out=", 6) == 0)
+        {
+            config.out_ = std::fopen(arg + 6, "w");
+            if (config.out_ == nullptr)
+            {
+                std::fprintf(stderr, "can not open %s\n", arg + 6);
+                return 1;
+            }
+        }
+        else if (std::strcmp(arg, "--quick") == 0)
+        {
+            config.tasks_ = 20000;
+            config.latencySamples_ = 2000;
+            config.rounds_ = 200;
+        }
+        else
+        {
+            std::fprintf(stderr, "unknown option: %s\n", arg);
+            return 1;
+        }
+    }
+    if (config.maxThreads_ <= 0 || config.tasks_ <= 0 || config.latencySamples_ <= 0 || config.fanout_ <= 0 || config.rounds_ <= 0)
+    {
+        std::fprintf(stderr, "invalid option value\n");
+        return 1;
+    }
+
+    if (pool.empty() || pool == "ThreadPool")
+        runThreadPoolBenches(config);
+    if (pool.empty() || pool == "ThreadPool2")
+        runThreadPool2Benches(config);
+    if (config.out_ != stdout)
+        std::fclose(config.out_);
+    return 0;
+}
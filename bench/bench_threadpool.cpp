@@ -0,0 +1,77 @@
+#include "bench.hpp"
+#include <threadpool.h>
+
+namespace
+{
+    // 队列容量足够大，测试的是调度开销而不是队列满时的等待
+    const int BENCH_QUEUE_CAPACITY = 1 << 16;
+
+    // 把可调用对象包装成 Task，返回值为空
+    template <typename F>
+    class FuncTask : public Task
+    {
+    public:
+        explicit FuncTask(F f) : func_(std::move(f))
+        {
+        }
+
+        Any run() override
+        {
+            func_();
+            return nullptr;
+        }
+
+    private:
+        F func_;
+    };
+
+    struct Empty
+    {
+        void operator()() const
+        {
+        }
+    };
+
+    class PoolAdapter
+    {
+    public:
+        // Task 只保存 Result 的裸指针，任务执行完之前必须持有 Result
+        typedef std::shared_ptr<Result> Handle;
+
+        PoolAdapter(int workers, QueueMode mode)
+        {
+            pool_.setQueueMode(mode);
+            pool_.setTaskQueueMaxThreshHold(BENCH_QUEUE_CAPACITY);
+            pool_.start(workers);
+        }
+
+        Handle submit()
+        {
+            return submit(Empty());
+        }
+
+        template <typename F>
+        Handle submit(F f)
+        {
+            return pool_.submitTask(std::make_shared<FuncTask<F>>(std::move(f)));
+        }
+
+        static void wait(Handle &handle)
+        {
+            handle->get();
+        }
+
+        static const char *name()
+        {
+            return "ThreadPool";
+        }
+
+    private:
+        ThreadPool pool_;
+    };
+}
+
+void runThreadPoolBenches(const BenchConfig &config)
+{
+    runBenches<PoolAdapter>(config);
+}
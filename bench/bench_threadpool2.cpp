@@ -0,0 +1,50 @@
+#include "bench.hpp"
+#include <threadPool.hpp>
+
+namespace
+{
+    // 队列容量足够大，测试的是调度开销而不是队列满时的等待
+    const int BENCH_QUEUE_CAPACITY = 1 << 16;
+
+    class Pool2Adapter
+    {
+    public:
+        typedef Future<void> Handle;
+
+        Pool2Adapter(int workers, QueueMode mode)
+        {
+            pool_.setQueueMode(mode);
+            pool_.setTaskQueueMaxThreshHold(BENCH_QUEUE_CAPACITY);
+            pool_.start(workers);
+        }
+
+        Handle submit()
+        {
+            return pool_.submitTask([]() {});
+        }
+
+        template <typename F>
+        Handle submit(F f)
+        {
+            return pool_.submitTask(std::move(f));
+        }
+
+        static void wait(Handle &handle)
+        {
+            handle.get();
+        }
+
+        static const char *name()
+        {
+            return "ThreadPool2";
+        }
+
+    private:
+        ThreadPool2 pool_;
+    };
+}
+
+void runThreadPool2Benches(const BenchConfig &config)
+{
+    runBenches<Pool2Adapter>(config);
+}
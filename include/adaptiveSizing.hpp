@@ -0,0 +1,156 @@
+#ifndef ADAPTIVE_SIZING_HPP
+#define ADAPTIVE_SIZING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+/*
+cached模式的线程数量调节
+原来的做法是提交任务时只要 任务数量 > 空闲线程数量 就创建线程，线程空闲10s以后退出，
+突发负载下要么创建得太晚，要么来回创建、回收
+
+现在每隔 sampleInterval_ 采样一次：
+1. 吞吐量：这段时间里执行完的任务数量
+2. 排队时间：按 (排队任务数量 - 空闲线程数量) x 平均每个任务的完成间隔 估算，再做一次指数平滑
+估算的排队时间超过 growWait_，就增加最多 growStep_ 个线程；
+连续 shrinkWindows_ 次采样排队时间都低于 shrinkWait_，就让最多 growStep_ 个空闲线程退出
+两个阈值分开、缩减要连续多次满足条件，线程数量不会在阈值附近来回抖动
+空闲线程只做一次 keepAlive_ 的定时等待，没有负载时到期退出，不再每秒醒来检查
+*/
+struct SizingPolicy
+{
+    SizingPolicy()
+        : minThreads_(0), growStep_(2), growWait_(std::chrono::microseconds(1000)), shrinkWait_(std::chrono::microseconds(100)),
+          sampleInterval_(std::chrono::milliseconds(5)), shrinkWindows_(20), keepAlive_(std::chrono::milliseconds(1000))
+    {
+    }
+
+    int minThreads_;                           // 最少保留的线程数量，0表示使用 start 时的初始线程数量
+    int growStep_;                             // 每次最多增加（减少）的线程数量
+    std::chrono::microseconds growWait_;       // 排队时间超过它就增加线程
+    std::chrono::microseconds shrinkWait_;     // 排队时间持续低于它就减少线程
+    std::chrono::milliseconds sampleInterval_; // 采样间隔
+    int shrinkWindows_;                        // 连续多少次采样满足条件才减少线程
+    std::chrono::milliseconds keepAlive_;      // 多余的线程空闲多久以后退出
+};
+
+class SizingController
+{
+public:
+    SizingController()
+        : completed_(0), lastSample_(0), retireCredits_(0), lastCompleted_(0), waitEstimate_(0), calmWindows_(0)
+    {
+    }
+
+    SizingController(const SizingController &) = delete;
+    SizingController &operator=(const SizingController &) = delete;
+
+    // 线程池启动前设置
+    void setPolicy(const SizingPolicy &policy)
+    {
+        policy_ = policy;
+    }
+
+    const SizingPolicy &policy() const
+    {
+        return policy_;
+    }
+
+    // 工作线程每执行完一个任务调用一次
+    void taskDone()
+    {
+        completed_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 距离上次采样是否已经超过采样间隔，提交任务的热路径先用它判断，不需要加锁
+    bool due() const
+    {
+        return nowNs() - lastSample_.load(std::memory_order_relaxed) >= intervalNs();
+    }
+
+    /*
+    采样一次，返回需要增加的线程数量；retire 返回允许退出的空闲线程数量，调用者负责唤醒这么多空闲线程
+    没到采样间隔或者别的线程正在采样时什么也不做
+    */
+    int sample(unsigned queued, int idle, int current, int minThreads, int maxThreads, int *retire)
+    {
+        *retire = 0;
+        if (!due())
+            return 0;
+        std::unique_lock<std::mutex> lock(sampleMtx_, std::try_to_lock);
+        if (!lock.owns_lock())
+            return 0;
+        int64_t now = nowNs();
+        int64_t elapsed = now - lastSample_.load(std::memory_order_relaxed);
+        if (elapsed < intervalNs())
+            return 0;
+        lastSample_.store(now, std::memory_order_relaxed);
+
+        uint64_t completed = completed_.load(std::memory_order_relaxed);
+        uint64_t done = completed - lastCompleted_;
+        lastCompleted_ = completed;
+        // 空闲线程马上就能取走的任务不用排队，只有多出来的任务要等前面的任务执行完
+        // 这段时间一个任务都没有完成，按整段时间作为完成间隔
+        unsigned backlog = (int)queued > idle ? queued - idle : 0;
+        double waitUs = (double)backlog * ((double)elapsed / 1000.0) / (double)(done == 0 ? 1 : done);
+        waitEstimate_ = (waitEstimate_ + waitUs) / 2;
+
+        if (waitEstimate_ > (double)policy_.growWait_.count() && backlog > 0 && current < maxThreads)
+        {
+            calmWindows_ = 0;
+            retireCredits_.store(0, std::memory_order_relaxed);
+            return std::min(std::min(policy_.growStep_, maxThreads - current), (int)backlog);
+        }
+        if (waitEstimate_ < (double)policy_.shrinkWait_.count() && idle > 0 && current > minThreads)
+        {
+            if (++calmWindows_ >= policy_.shrinkWindows_)
+            {
+                calmWindows_ = 0;
+                *retire = std::min(std::min(policy_.growStep_, current - minThreads), idle);
+                retireCredits_.fetch_add(*retire, std::memory_order_relaxed);
+            }
+            return 0;
+        }
+        calmWindows_ = 0;
+        return 0;
+    }
+
+    // 被唤醒的空闲线程领取一个退出名额，领到了就退出
+    bool takeRetireCredit()
+    {
+        int credits = retireCredits_.load(std::memory_order_relaxed);
+        while (credits > 0)
+        {
+            if (retireCredits_.compare_exchange_weak(credits, credits - 1, std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+private:
+    static int64_t nowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    int64_t intervalNs() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(policy_.sampleInterval_).count();
+    }
+
+    SizingPolicy policy_;
+    std::atomic<uint64_t> completed_; // 执行完的任务总数
+    std::atomic<int64_t> lastSample_; // 上次采样的时间
+    std::atomic_int retireCredits_;   // 允许退出的空闲线程数量
+
+    // 下面的成员只在持有 sampleMtx_ 时访问
+    std::mutex sampleMtx_;
+    uint64_t lastCompleted_;
+    double waitEstimate_; // 平滑后的排队时间估计，单位微秒
+    int calmWindows_;     // 连续满足缩减条件的采样次数
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef BACKPRESSURE_HPP
+#define BACKPRESSURE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+
+/*
+队列满时的处理策略（背压）
+默认 REJECT_TIMEOUT，最多等待1s，和原来的行为一样
+网络线程这类不能被卡住的调用者，用 REJECT_ABORT / REJECT_DISCARD_OLDEST，或者直接用 trySubmit
+*/
+enum class RejectPolicy
+{
+    REJECT_BLOCK,          // 一直等待，直到队列有空余
+    REJECT_TIMEOUT,        // 最多等待设置的时长，超时拒绝
+    REJECT_CALLER_RUNS,    // 不等待，由提交任务的线程自己执行这个任务
+    REJECT_DISCARD_OLDEST, // 不等待，丢弃队列里最早的一个（不比新任务重要的）任务，放入新任务
+    REJECT_ABORT           // 不等待，立即拒绝
+};
+
+// 提交一个任务的结果
+enum class SubmitStatus
+{
+    SUBMIT_OK,         // 放入了任务队列
+    SUBMIT_CALLER_RAN, // 队列满，已经在提交任务的线程里执行完了
+    SUBMIT_REJECTED    // 队列满，任务被拒绝，没有执行
+};
+
+// 任务被拒绝时，ThreadPool2 返回的Future得到这个异常，不会和真正的返回值混淆
+class TaskRejected : public std::runtime_error
+{
+public:
+    TaskRejected() : std::runtime_error("task queue is full, task rejected")
+    {
+    }
+};
+
+// 默认的最长等待时间
+const std::chrono::milliseconds SUBMIT_TIMEOUT_DEFAULT(1000);
+
+/*
+一次提交在队列满时怎样等待，由拒绝策略决定，整次提交（包括一整批任务）共用一个截止时间
+tryOnly 表示 trySubmit，不管什么策略都不等待
+*/
+class SubmitWait
+{
+public:
+    SubmitWait(RejectPolicy policy, std::chrono::milliseconds timeout, bool tryOnly)
+        : forever_(!tryOnly && policy == RejectPolicy::REJECT_BLOCK),
+          timed_(!tryOnly && policy == RejectPolicy::REJECT_TIMEOUT)
+    {
+        if (timed_)
+            deadline_ = std::chrono::steady_clock::now() + timeout;
+    }
+
+    // 是否允许等待
+    bool mayWait() const
+    {
+        return forever_ || timed_;
+    }
+
+    // 在 cond 上等待 pred 成立，返回false表示条件不满足并且不能再等了
+    template <typename Pred>
+    bool wait(std::condition_variable &cond, std::unique_lock<std::mutex> &lock, Pred pred) const
+    {
+        if (forever_)
+        {
+            cond.wait(lock, pred);
+            return true;
+        }
+        if (timed_)
+            return cond.wait_until(lock, deadline_, pred);
+        return pred();
+    }
+
+private:
+    bool forever_;
+    bool timed_;
+    std::chrono::steady_clock::time_point deadline_;
+};
+
+#endif
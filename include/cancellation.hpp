@@ -0,0 +1,145 @@
+#ifndef CANCELLATION_HPP
+#define CANCELLATION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+
+/*
+任务的取消
+1. 还没开始执行的任务：通过返回的 Future / Result 调用 cancel()，O(1) 完成，
+   任务留在队列里作为一个空位，工作线程取到时直接跳过，不会执行
+2. 正在执行的任务：cancel() 只是请求停止，任务自己通过 CancellationToken 检查后提前返回（协作式取消）
+
+ThreadPool2 的任务函数第一个参数声明为 CancellationToken 时，线程池执行时把它传进去：
+Future<int> f = pool.submitTask([](CancellationToken token, int n) {
+    for (int i = 0; i < n; i++) { token.throwIfCancelled(); ... }
+    return n;
+}, 100);
+f.cancel();
+ThreadPool 的任务在 run() 里面调用 token() 或者 cancelRequested()
+*/
+
+// 任务被取消时，Future::get 抛出这个异常
+class TaskCancelled : public std::runtime_error
+{
+public:
+    TaskCancelled() : std::runtime_error("task cancelled")
+    {
+    }
+};
+
+// 关闭线程池的方式
+enum class ShutdownMode
+{
+    SHUTDOWN_DRAIN,          // 不再接受新任务，执行完队列里所有的任务再退出（析构时的默认方式）
+    SHUTDOWN_CANCEL_PENDING, // 不再接受新任务，队列里还没开始的任务全部取消，等正在执行的任务结束
+    SHUTDOWN_ABORT           // 在 SHUTDOWN_CANCEL_PENDING 的基础上，请求正在执行的任务停止
+};
+
+// shutdown 一直等待，直到所有线程退出
+const std::chrono::milliseconds SHUTDOWN_WAIT_FOREVER = std::chrono::milliseconds::max();
+
+namespace detail
+{
+    /*
+    一次提交的取消状态，放在 Future 的共享状态（ThreadPool2）和任务对象（ThreadPool）里
+    开始执行和取消只有一个能成功：执行的一方 claim，取消的一方 tryCancel，都是一次CAS
+    */
+    class CancelState
+    {
+    public:
+        CancelState() : runState_(RUN_PENDING), stopRequested_(false), poolStop_(nullptr)
+        {
+        }
+
+        // 任务对象可能被用户拷贝，拷贝出来的是一个新的、没有提交过的任务
+        CancelState(const CancelState &) : runState_(RUN_PENDING), stopRequested_(false), poolStop_(nullptr)
+        {
+        }
+
+        CancelState &operator=(const CancelState &)
+        {
+            return *this;
+        }
+
+        // 开始执行（或者写入结果），已经被取消返回false
+        bool claim()
+        {
+            uint32_t state = RUN_PENDING;
+            return runState_.compare_exchange_strong(state, RUN_STARTED, std::memory_order_acq_rel) || state == RUN_STARTED;
+        }
+
+        // 还没开始时取消成功返回true；已经开始时请求停止，返回false
+        bool tryCancel()
+        {
+            uint32_t state = RUN_PENDING;
+            if (runState_.compare_exchange_strong(state, RUN_CANCELLED, std::memory_order_acq_rel))
+                return true;
+            if (state == RUN_STARTED)
+                stopRequested_.store(true, std::memory_order_relaxed);
+            return false;
+        }
+
+        bool cancelled() const
+        {
+            return runState_.load(std::memory_order_acquire) == RUN_CANCELLED;
+        }
+
+        // 任务被请求停止，或者线程池正在以 SHUTDOWN_ABORT 方式关闭
+        bool cancelRequested() const
+        {
+            return stopRequested_.load(std::memory_order_relaxed) ||
+                   (poolStop_ != nullptr && poolStop_->load(std::memory_order_relaxed));
+        }
+
+        // 提交时重置，poolStop 是线程池 SHUTDOWN_ABORT 时设置的标志
+        void resetCancel(const std::atomic_bool *poolStop)
+        {
+            runState_.store(RUN_PENDING, std::memory_order_relaxed);
+            stopRequested_.store(false, std::memory_order_relaxed);
+            poolStop_ = poolStop;
+        }
+
+    private:
+        static const uint32_t RUN_PENDING = 0;
+        static const uint32_t RUN_STARTED = 1;
+        static const uint32_t RUN_CANCELLED = 2;
+
+        std::atomic<uint32_t> runState_;
+        std::atomic_bool stopRequested_;
+        const std::atomic_bool *poolStop_;
+    };
+}
+
+// 任务执行期间检查自己是否被要求停止；不持有状态，只能在任务执行期间使用
+class CancellationToken
+{
+public:
+    // 默认构造的 token 永远不会被取消
+    CancellationToken() : state_(nullptr)
+    {
+    }
+
+    explicit CancellationToken(const detail::CancelState *state) : state_(state)
+    {
+    }
+
+    bool isCancelled() const
+    {
+        return state_ != nullptr && state_->cancelRequested();
+    }
+
+    // 被取消时抛出 TaskCancelled，Future::get 得到这个异常
+    void throwIfCancelled() const
+    {
+        if (isCancelled())
+            throw TaskCancelled();
+    }
+
+private:
+    const detail::CancelState *state_;
+};
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef COMPLETION_HPP
+#define COMPLETION_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace detail
+{
+    // 自旋等待时让出流水线资源，降低自旋对超线程另一个逻辑核的影响
+    inline void cpuRelax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    /*
+    Linux下直接使用futex：只有 *addr == expected 时才会挂起，
+    唤醒时只有真的有线程挂起在这个地址上内核才有工作要做
+    其他平台退化为 让出CPU + 短暂睡眠 的轮询
+    返回false表示超时
+    */
+    inline bool futexWait(std::atomic<uint32_t> *addr, uint32_t expected, const std::chrono::nanoseconds *timeout = nullptr)
+    {
+#ifdef __linux__
+        struct timespec ts;
+        struct timespec *pts = nullptr;
+        if (timeout != nullptr)
+        {
+            long long ns = timeout->count() < 0 ? 0 : timeout->count();
+            ts.tv_sec = ns / 1000000000LL;
+            ts.tv_nsec = ns % 1000000000LL;
+            pts = &ts;
+        }
+        long ret = syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT_PRIVATE, expected, pts, nullptr, 0);
+        return !(ret == -1 && errno == ETIMEDOUT);
+#else
+        if (addr->load(std::memory_order_acquire) == expected)
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        return true;
+#endif
+    }
+
+    inline void futexWake(std::atomic<uint32_t> *addr, int count)
+    {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+#else
+        (void)addr;
+        (void)count;
+#endif
+    }
+}
+
+/*
+一次性的完成通知：任务执行完 post()，等待结果的一方 wait()
+只有一个4字节的原子状态，没有互斥锁和条件变量：
+  EMPTY    还没有完成，也没有线程挂起
+  WAITING  还没有完成，有线程挂起在futex上
+  WOKEN    还没有完成，挂起的线程被 wake() 叫醒（比如线程池有了新任务），需要重新检查
+  DONE     已经完成
+等待方先自旋一小段时间，还没有完成才挂起；post时只有状态是WAITING/WOKEN才会进入内核唤醒，
+结果在等待之前就已经就绪的情况下，两边都不会有系统调用
+*/
+class Completion
+{
+public:
+    Completion() : state_(EMPTY)
+    {
+    }
+
+    Completion(const Completion &) = delete;
+    Completion &operator=(const Completion &) = delete;
+
+    // 标记为完成，唤醒所有等待的线程
+    void post()
+    {
+        uint32_t state = state_.exchange(DONE, std::memory_order_acq_rel);
+        if (state == WAITING || state == WOKEN)
+            detail::futexWake(&state_, INT_MAX);
+    }
+
+    bool isDone() const
+    {
+        return state_.load(std::memory_order_acquire) == DONE;
+    }
+
+    // 阻塞直到完成
+    void wait()
+    {
+        if (spin())
+            return;
+        for (;;)
+        {
+            uint32_t state = state_.load(std::memory_order_acquire);
+            if (state == DONE)
+                return;
+            if (state == EMPTY)
+            {
+                if (!state_.compare_exchange_weak(state, WAITING, std::memory_order_acq_rel))
+                    continue;
+                state = WAITING;
+            }
+            detail::futexWait(&state_, state);
+        }
+    }
+
+    // 等待一段时间，返回是否已经完成
+    template <typename Rep, typename Period>
+    bool waitFor(const std::chrono::duration<Rep, Period> &timeout)
+    {
+        if (spin())
+            return true;
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        for (;;)
+        {
+            uint32_t state = state_.load(std::memory_order_acquire);
+            if (state == DONE)
+                return true;
+            std::chrono::nanoseconds left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0)
+                return false;
+            if (state == EMPTY)
+            {
+                if (!state_.compare_exchange_weak(state, WAITING, std::memory_order_acq_rel))
+                    continue;
+                state = WAITING;
+            }
+            detail::futexWait(&state_, state, &left);
+        }
+    }
+
+    /*
+    挂起直到完成或者被 wake() 叫醒，不会丢失唤醒的用法：
+    1. arm() 置为 WAITING
+    2. 登记到唤醒方能找到的地方（比如线程池的空闲栈）
+    3. 检查要等的其他条件（比如任务数量），不满足才调用 waitWake()
+    arm() 之后的 wake() 会把状态改成 WOKEN，waitWake() 看到状态变化不会挂起
+    */
+    void arm()
+    {
+        uint32_t state = state_.load(std::memory_order_acquire);
+        while (state != DONE && state != WAITING && !state_.compare_exchange_weak(state, WAITING, std::memory_order_acq_rel))
+        {
+        }
+    }
+
+    // 返回是否已经完成，返回false表示被 wake() 叫醒
+    bool waitWake()
+    {
+        if (state_.load(std::memory_order_acquire) == WAITING)
+            detail::futexWait(&state_, WAITING);
+        return isDone();
+    }
+
+    // 叫醒 waitWake() 挂起的线程，不改变完成状态
+    void wake()
+    {
+        uint32_t state = WAITING;
+        if (state_.compare_exchange_strong(state, WOKEN, std::memory_order_acq_rel))
+            detail::futexWake(&state_, INT_MAX);
+    }
+
+    // 重新置为未完成，只能在没有线程等待的时候调用
+    void reset()
+    {
+        state_.store(EMPTY, std::memory_order_relaxed);
+    }
+
+private:
+    static const uint32_t EMPTY = 0;
+    static const uint32_t WAITING = 1;
+    static const uint32_t DONE = 2;
+    static const uint32_t WOKEN = 3;
+    static const int SPIN_COUNT = 128;
+
+    bool spin()
+    {
+        for (int i = 0; i < SPIN_COUNT; i++)
+        {
+            if (isDone())
+                return true;
+            detail::cpuRelax();
+        }
+        return isDone();
+    }
+
+    std::atomic<uint32_t> state_;
+};
+
+#endif
@@ -0,0 +1,363 @@
+#ifndef COROUTINE_TASK_HPP
+#define COROUTINE_TASK_HPP
+
+/*
+C++20 协程支持，只有用 -std=c++20 编译（CMake 选项 THREADPOOL_COROUTINES）时才有，
+可以用 THREADPOOL_HAS_COROUTINES 判断；C++11 编译时这个头文件是空的
+
+CoTask<int> handler(ThreadPool2 &pool)
+{
+    co_await pool.schedule();                          // 切换到线程池的工作线程上继续执行
+    int v = co_await pool.submitTask([]() { return 1; }); // 等待任务完成，不阻塞线程
+    int w = co_await other(pool);                      // 等待另一个协程
+    co_return v + w;
+}
+Future<int> f = spawn(pool, handler(pool));  // 在线程池上启动协程，返回的Future也可以 co_await
+int v = syncWait(handler(pool));             // 普通代码里阻塞等待协程的结果
+
+挂起的协程只占用自己的协程帧，不占用线程，少量工作线程就可以同时推进大量协程
+注意：恢复协程的任务被拒绝（TaskRejected）或者被丢弃时，协程不会再恢复
+*/
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && defined(__has_include)
+#if __has_include(<coroutine>)
+#define THREADPOOL_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifdef THREADPOOL_HAS_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <taskFunction.hpp>
+#include <taskFuture.hpp>
+#include <backpressure.hpp>
+
+template <typename T = void>
+class CoTask;
+
+namespace detail
+{
+    // co_await executor.schedule()：把协程剩下的部分作为一个任务提交给 executor
+    // executor 需要提供 bool execute(TaskFunction)（比如 ThreadPool2）
+    template <typename Executor>
+    class ScheduleAwaitable
+    {
+    public:
+        explicit ScheduleAwaitable(Executor &executor) : executor_(executor), rejected_(false)
+        {
+        }
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            // 提交以后协程可能已经在工作线程上恢复、甚至执行完了，之后不能再访问成员
+            if (executor_.execute(TaskFunction([handle]()
+                                               { handle.resume(); })))
+                return true;
+            // 被拒绝，不挂起，在 await_resume 里抛出异常
+            rejected_ = true;
+            return false;
+        }
+
+        void await_resume() const
+        {
+            if (rejected_)
+                throw TaskRejected();
+        }
+
+    private:
+        Executor &executor_;
+        bool rejected_;
+    };
+
+    // co_await Future：任务完成时在完成它的线程上恢复协程
+    template <typename T>
+    class FutureAwaiter
+    {
+    public:
+        explicit FutureAwaiter(Future<T> &&future) : future_(std::move(future))
+        {
+        }
+
+        bool await_ready() const
+        {
+            return future_.isReady();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            future_.whenReady([handle]()
+                              { handle.resume(); });
+        }
+
+        T await_resume()
+        {
+            return future_.get();
+        }
+
+    private:
+        Future<T> future_;
+    };
+
+    // CoTask 执行完以后直接转到等待它的协程（对称转移），没有等待者就停在最后的挂起点
+    struct CoTaskFinal
+    {
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            std::coroutine_handle<> continuation = handle.promise().continuation_;
+            if (continuation)
+                return continuation;
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+    };
+
+    class CoTaskPromiseBase
+    {
+    public:
+        // 惰性启动：被 co_await 的时候才开始执行
+        std::suspend_always initial_suspend() const noexcept
+        {
+            return {};
+        }
+
+        CoTaskFinal final_suspend() const noexcept
+        {
+            return {};
+        }
+
+        void unhandled_exception()
+        {
+            exception_ = std::current_exception();
+        }
+
+        std::coroutine_handle<> continuation_; // 等待这个协程的协程
+        std::exception_ptr exception_;
+    };
+
+    template <typename T>
+    class CoTaskPromise : public CoTaskPromiseBase
+    {
+    public:
+        CoTask<T> get_return_object();
+
+        template <typename U>
+        void return_value(U &&value)
+        {
+            value_.set(std::forward<U>(value));
+        }
+
+        T result()
+        {
+            if (exception_)
+                std::rethrow_exception(exception_);
+            return value_.take();
+        }
+
+    private:
+        ValueStorage<T> value_;
+    };
+
+    template <>
+    class CoTaskPromise<void> : public CoTaskPromiseBase
+    {
+    public:
+        CoTask<void> get_return_object();
+
+        void return_void()
+        {
+        }
+
+        void result()
+        {
+            if (exception_)
+                std::rethrow_exception(exception_);
+        }
+    };
+}
+
+/*
+协程的返回类型：惰性启动，被 co_await 时才开始执行，执行完直接恢复等待它的协程，
+中间不经过任何线程的阻塞等待；只能移动，只能 co_await 一次
+*/
+template <typename T>
+class CoTask
+{
+public:
+    using promise_type = detail::CoTaskPromise<T>;
+
+    CoTask(CoTask &&other) noexcept : handle_(other.handle_)
+    {
+        other.handle_ = nullptr;
+    }
+
+    CoTask &operator=(CoTask &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle_)
+                handle_.destroy();
+            handle_ = other.handle_;
+            other.handle_ = nullptr;
+        }
+        return *this;
+    }
+
+    CoTask(const CoTask &) = delete;
+    CoTask &operator=(const CoTask &) = delete;
+
+    ~CoTask()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    // co_await：启动协程，执行完以后恢复当前协程，返回协程的结果（异常在这里重新抛出）
+    auto operator co_await() && noexcept
+    {
+        struct Awaiter
+        {
+            bool await_ready() const noexcept
+            {
+                return !handle_ || handle_.done();
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept
+            {
+                handle_.promise().continuation_ = continuation;
+                return handle_;
+            }
+
+            T await_resume()
+            {
+                return handle_.promise().result();
+            }
+
+            std::coroutine_handle<promise_type> handle_;
+        };
+        return Awaiter{handle_};
+    }
+
+private:
+    explicit CoTask(std::coroutine_handle<promise_type> handle) : handle_(handle)
+    {
+    }
+
+    friend class detail::CoTaskPromise<T>;
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail
+{
+    template <typename T>
+    CoTask<T> CoTaskPromise<T>::get_return_object()
+    {
+        return CoTask<T>(std::coroutine_handle<CoTaskPromise<T>>::from_promise(*this));
+    }
+
+    inline CoTask<void> CoTaskPromise<void>::get_return_object()
+    {
+        return CoTask<void>(std::coroutine_handle<CoTaskPromise<void>>::from_promise(*this));
+    }
+
+    // 立即开始执行、执行完自己销毁的协程，普通代码通过它启动 CoTask
+    struct DetachedCoroutine
+    {
+        struct promise_type
+        {
+            DetachedCoroutine get_return_object() const noexcept
+            {
+                return {};
+            }
+
+            std::suspend_never initial_suspend() const noexcept
+            {
+                return {};
+            }
+
+            std::suspend_never final_suspend() const noexcept
+            {
+                return {};
+            }
+
+            void return_void() const noexcept
+            {
+            }
+
+            void unhandled_exception() const noexcept
+            {
+                std::terminate();
+            }
+        };
+    };
+
+    // 先 co_await start（切换线程或者什么也不做），再执行 task，结果和异常交给 promise
+    template <typename Start, typename T>
+    DetachedCoroutine driveCoTask(Start start, CoTask<T> task, Promise<T> promise)
+    {
+        try
+        {
+            co_await start;
+            if constexpr (std::is_void<T>::value)
+            {
+                co_await std::move(task);
+                promise.setValue(nullptr);
+            }
+            else
+            {
+                promise.setValue(co_await std::move(task));
+            }
+        }
+        catch (...)
+        {
+            promise.setException(std::current_exception());
+        }
+    }
+}
+
+// co_await 一个线程池返回的Future：任务完成时在工作线程上恢复协程，不阻塞线程
+template <typename T>
+detail::FutureAwaiter<T> operator co_await(Future<T> &&future)
+{
+    return detail::FutureAwaiter<T>(std::move(future));
+}
+
+// 在 executor 的工作线程上启动协程，返回协程结果的Future
+template <typename Executor, typename T>
+Future<T> spawn(Executor &executor, CoTask<T> task)
+{
+    Promise<T> promise = detail::makeExecutorPromise<T>(executor, 0);
+    Future<T> future = promise.getFuture();
+    detail::driveCoTask(detail::ScheduleAwaitable<Executor>(executor), std::move(task), std::move(promise));
+    return future;
+}
+
+// 在当前线程上启动协程，阻塞等待它的结果；resource 是结果的共享状态的内存来源
+template <typename T>
+T syncWait(CoTask<T> task, MemoryResource *resource = slabResource())
+{
+    Promise<T> promise(resource);
+    Future<T> future = promise.getFuture();
+    detail::driveCoTask(std::suspend_never(), std::move(task), std::move(promise));
+    return future.get();
+}
+
+#endif
+
+#endif
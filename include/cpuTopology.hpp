@@ -0,0 +1,321 @@
+#ifndef CPU_TOPOLOGY_HPP
+#define CPU_TOPOLOGY_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+/*
+CPU拓扑和工作线程的绑核策略
+拓扑从 /sys/devices/system 读取：每个CPU所在的物理封装（socket）、核心、NUMA节点，
+只统计当前进程允许运行的CPU（sched_getaffinity，容器里可能只分到一部分）；
+读不到时退化为 hardware_concurrency 个CPU都在节点0上
+
+example:
+pool.start(16, PlacementPolicy::scatter());        // 线程轮流分到各个socket，先占满物理核再用超线程
+pool.start(8, PlacementPolicy::numaNode());       // 线程轮流分到各个NUMA节点，在节点内的CPU上自由调度
+pool.start(4, PlacementPolicy::explicitCpus({0, 2, 4, 6}));
+*/
+struct CpuInfo
+{
+    int cpu_;     // 逻辑CPU编号
+    int package_; // 物理封装（socket）
+    int core_;    // 封装内的物理核心
+    int node_;    // NUMA节点
+};
+
+namespace detail
+{
+    // 解析 "0-3,8,10-11" 格式的CPU列表
+    inline std::vector<int> parseCpuList(const std::string &list)
+    {
+        std::vector<int> cpus;
+        std::size_t pos = 0;
+        while (pos < list.size())
+        {
+            std::size_t end = list.find(',', pos);
+            if (end == std::string::npos)
+                end = list.size();
+            int first = 0, last = 0;
+            int n = std::sscanf(list.substr(pos, end - pos).c_str(), "%d-%d", &first, &last);
+            if (n == 1)
+                last = first;
+            if (n >= 1)
+            {
+                for (int cpu = first; cpu <= last; cpu++)
+                    cpus.push_back(cpu);
+            }
+            pos = end + 1;
+        }
+        return cpus;
+    }
+
+    // 读取文件的第一行，失败返回空字符串
+    inline std::string readLine(const std::string &path)
+    {
+        std::string line;
+        FILE *fp = std::fopen(path.c_str(), "r");
+        if (fp == nullptr)
+            return line;
+        char buf[4096];
+        if (std::fgets(buf, sizeof(buf), fp) != nullptr)
+        {
+            line = buf;
+            while (!line.empty() && (line.back() == '\n' || line.back() == ' '))
+                line.pop_back();
+        }
+        std::fclose(fp);
+        return line;
+    }
+
+    inline int readInt(const std::string &path, int def)
+    {
+        std::string line = readLine(path);
+        int value = def;
+        if (line.empty() || std::sscanf(line.c_str(), "%d", &value) != 1)
+            return def;
+        return value;
+    }
+
+    // 把当前线程绑定到 cpus 上，cpus 为空时不做任何事
+    inline bool pinCurrentThread(const std::vector<int> &cpus)
+    {
+        if (cpus.empty())
+            return true;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus)
+        {
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+}
+
+// 进程启动后拓扑不会变化，只读取一次
+class CpuTopology
+{
+public:
+    static const CpuTopology &instance()
+    {
+        static const CpuTopology topology;
+        return topology;
+    }
+
+    // 进程可以使用的CPU，按 (节点, socket, 核心, 编号) 排序
+    const std::vector<CpuInfo> &cpus() const
+    {
+        return cpus_;
+    }
+
+    int nodeCount() const
+    {
+        return nodeCount_;
+    }
+
+    // CPU 所在的NUMA节点，未知的CPU返回0
+    int nodeOf(int cpu) const
+    {
+        for (const CpuInfo &info : cpus_)
+        {
+            if (info.cpu_ == cpu)
+                return info.node_;
+        }
+        return 0;
+    }
+
+    // 某个NUMA节点上进程可以使用的CPU
+    std::vector<int> nodeCpus(int node) const
+    {
+        std::vector<int> result;
+        for (const CpuInfo &info : cpus_)
+        {
+            if (info.node_ == node)
+                result.push_back(info.cpu_);
+        }
+        return result;
+    }
+
+private:
+    CpuTopology() : nodeCount_(1)
+    {
+        const std::string sys = "/sys/devices/system/";
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        bool haveMask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+        std::vector<int> online = detail::parseCpuList(detail::readLine(sys + "cpu/online"));
+        if (online.empty())
+        {
+            unsigned n = std::thread::hardware_concurrency();
+            for (unsigned i = 0; i < (n == 0 ? 1 : n); i++)
+                online.push_back((int)i);
+        }
+
+        // cpu => node，没有 node 目录（内核没开NUMA）时都在节点0
+        std::map<int, int> cpuNode;
+        std::vector<int> nodes = detail::parseCpuList(detail::readLine(sys + "node/online"));
+        for (int node : nodes)
+        {
+            for (int cpu : detail::parseCpuList(detail::readLine(sys + "node/node" + std::to_string(node) + "/cpulist")))
+                cpuNode[cpu] = node;
+        }
+
+        for (int cpu : online)
+        {
+            if (haveMask && cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &allowed))
+                continue;
+            std::string dir = sys + "cpu/cpu" + std::to_string(cpu) + "/topology/";
+            CpuInfo info;
+            info.cpu_ = cpu;
+            info.package_ = detail::readInt(dir + "physical_package_id", 0);
+            info.core_ = detail::readInt(dir + "core_id", cpu);
+            std::map<int, int>::const_iterator it = cpuNode.find(cpu);
+            info.node_ = it == cpuNode.end() ? 0 : it->second;
+            cpus_.push_back(info);
+        }
+        std::sort(cpus_.begin(), cpus_.end(), [](const CpuInfo &a, const CpuInfo &b) -> bool
+                  {
+            if (a.node_ != b.node_)
+                return a.node_ < b.node_;
+            if (a.package_ != b.package_)
+                return a.package_ < b.package_;
+            if (a.core_ != b.core_)
+                return a.core_ < b.core_;
+            return a.cpu_ < b.cpu_; });
+
+        // 节点编号可能不连续，按实际用到的最大编号计算
+        for (const CpuInfo &info : cpus_)
+        {
+            if (info.node_ + 1 > nodeCount_)
+                nodeCount_ = info.node_ + 1;
+        }
+    }
+
+    std::vector<CpuInfo> cpus_;
+    int nodeCount_;
+};
+
+// 工作线程的绑核方式
+enum class AffinityMode
+{
+    AFFINITY_NONE,     // 不绑核，由操作系统调度（默认）
+    AFFINITY_COMPACT,  // 线程依次占满一个核心的超线程、一个socket，再用下一个，线程间共享缓存
+    AFFINITY_SCATTER,  // 线程轮流分到各个节点，节点内先占满物理核再用超线程，内存带宽最大
+    AFFINITY_EXPLICIT, // 线程依次绑定到用户给出的CPU列表
+    AFFINITY_NUMA_NODE // 线程轮流分到各个NUMA节点，绑定到节点的所有CPU上
+};
+
+// 线程池启动时使用的绑核策略
+class PlacementPolicy
+{
+public:
+    PlacementPolicy() : mode_(AffinityMode::AFFINITY_NONE)
+    {
+    }
+
+    static PlacementPolicy compact() { return PlacementPolicy(AffinityMode::AFFINITY_COMPACT); }
+    static PlacementPolicy scatter() { return PlacementPolicy(AffinityMode::AFFINITY_SCATTER); }
+    static PlacementPolicy numaNode() { return PlacementPolicy(AffinityMode::AFFINITY_NUMA_NODE); }
+    static PlacementPolicy explicitCpus(std::vector<int> cpus)
+    {
+        PlacementPolicy policy(AffinityMode::AFFINITY_EXPLICIT);
+        policy.cpus_ = std::move(cpus);
+        return policy;
+    }
+
+    AffinityMode mode() const
+    {
+        return mode_;
+    }
+
+    // 第 slot 个线程允许运行的CPU，空表示不绑核
+    std::vector<int> cpusFor(std::size_t slot) const
+    {
+        std::vector<int> result;
+        const CpuTopology &topology = CpuTopology::instance();
+        switch (mode_)
+        {
+        case AffinityMode::AFFINITY_COMPACT:
+        case AffinityMode::AFFINITY_SCATTER:
+        {
+            std::vector<int> order = cpuOrder(topology);
+            if (!order.empty())
+                result.push_back(order[slot % order.size()]);
+            break;
+        }
+        case AffinityMode::AFFINITY_EXPLICIT:
+            if (!cpus_.empty())
+                result.push_back(cpus_[slot % cpus_.size()]);
+            break;
+        case AffinityMode::AFFINITY_NUMA_NODE:
+            result = topology.nodeCpus((int)(slot % topology.nodeCount()));
+            break;
+        default:
+            break;
+        }
+        return result;
+    }
+
+    // 第 slot 个线程所在的NUMA节点，不绑核时为 -1，工作窃取优先偷同一节点的线程
+    int nodeFor(std::size_t slot) const
+    {
+        std::vector<int> cpus = cpusFor(slot);
+        if (cpus.empty())
+            return -1;
+        return CpuTopology::instance().nodeOf(cpus.front());
+    }
+
+private:
+    explicit PlacementPolicy(AffinityMode mode) : mode_(mode)
+    {
+    }
+
+    // compact 直接用拓扑的排序；scatter 先按节点轮流，节点内先取每个核心的第一个超线程
+    std::vector<int> cpuOrder(const CpuTopology &topology) const
+    {
+        const std::vector<CpuInfo> &cpus = topology.cpus();
+        std::vector<int> order;
+        if (mode_ == AffinityMode::AFFINITY_COMPACT)
+        {
+            for (const CpuInfo &info : cpus)
+                order.push_back(info.cpu_);
+            return order;
+        }
+        // 每个节点内的CPU按 (在核心内的序号, socket, 核心) 排序
+        std::vector<std::vector<int>> perNode(topology.nodeCount());
+        std::vector<std::pair<int, const CpuInfo *>> ranked;
+        for (std::size_t i = 0; i < cpus.size(); i++)
+        {
+            int sibling = 0;
+            for (std::size_t j = i; j > 0 && cpus[j - 1].core_ == cpus[i].core_ && cpus[j - 1].package_ == cpus[i].package_ && cpus[j - 1].node_ == cpus[i].node_; j--)
+                sibling++;
+            ranked.push_back(std::make_pair(sibling, &cpus[i]));
+        }
+        std::stable_sort(ranked.begin(), ranked.end(), [](const std::pair<int, const CpuInfo *> &a, const std::pair<int, const CpuInfo *> &b) -> bool
+                         { return a.first < b.first; });
+        for (const std::pair<int, const CpuInfo *> &item : ranked)
+            perNode[item.second->node_].push_back(item.second->cpu_);
+        for (std::size_t i = 0; order.size() < cpus.size(); i++)
+        {
+            for (const std::vector<int> &node : perNode)
+            {
+                if (i < node.size())
+                    order.push_back(node[i]);
+            }
+        }
+        return order;
+    }
+
+    AffinityMode mode_;
+    std::vector<int> cpus_; // AFFINITY_EXPLICIT 使用的CPU列表
+};
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef FAIR_SHARE_HPP
+#define FAIR_SHARE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <poolStats.hpp>
+
+/*
+多租户的公平调度：每个租户一个有权重、有上限的任务队列，工作线程按 deficit round robin 在租户之间轮转
+一个租户提交再多的任务，也只会占满它自己的队列，其他租户的排队时间不受影响
+
+按执行时间计费：轮到一个租户时，它的额度增加 quantum * weight，每取出一个任务先按这个租户任务的平均执行时间扣除，
+任务执行完以后工作线程再按实际执行时间多退少补。额度用完就轮到下一个租户，
+所以长时间忙碌时，每个租户得到的线程时间和权重成正比，而不是和提交的任务数量成正比
+
+除了 finish，所有方法都要在线程池的锁里调用；finish 由工作线程在锁外调用，只修改原子变量
+*/
+using TenantId = std::size_t;
+
+// 每一轮权重为1的租户得到的额度（纳秒）
+const int64_t FAIR_QUANTUM_NS = 200 * 1000;
+
+namespace detail
+{
+    struct FairTenant
+    {
+        FairTenant(std::string name, unsigned weight, std::size_t limit)
+            : name_(std::move(name)), weight_(weight), limit_(limit), deficit_(0), active_(false),
+              pending_(0), avgCost_(FAIR_QUANTUM_NS / 10), executed_(0), busyNs_(0)
+        {
+        }
+
+        std::string name_;
+        unsigned weight_;   // 权重
+        std::size_t limit_; // 队列上限
+        int64_t deficit_;   // 剩余的额度，可以是负的（欠账）
+        bool active_;       // 是否在轮转的列表里（队列不空）
+
+        // 工作线程在锁外修改
+        std::atomic<int64_t> pending_;  // 实际执行时间和预扣的差额，下次轮到这个租户时结算
+        std::atomic<int64_t> avgCost_;  // 任务平均执行时间的估计
+        std::atomic<uint64_t> executed_; // 执行完的任务数量
+        std::atomic<uint64_t> busyNs_;  // 执行任务的总时间
+    };
+}
+
+// 取出一个租户任务的凭证，任务执行完以后交给 finish
+struct FairTicket
+{
+    FairTicket() : tenant_(nullptr), estimate_(0)
+    {
+    }
+
+    detail::FairTenant *tenant_; // 不是租户任务时为nullptr
+    int64_t estimate_;           // 取出时预扣的额度
+};
+
+template <typename T>
+class FairShareQueue
+{
+public:
+    explicit FairShareQueue(int64_t quantumNs = FAIR_QUANTUM_NS) : quantum_(quantumNs), size_(0)
+    {
+    }
+
+    // 增加一个租户，weight 为0时按1处理
+    TenantId addTenant(const std::string &name, unsigned weight, std::size_t limit)
+    {
+        tenants_.emplace_back(new Tenant(name, weight > 0 ? weight : 1, limit));
+        return tenants_.size() - 1;
+    }
+
+    bool valid(TenantId id) const
+    {
+        return id < tenants_.size();
+    }
+
+    const std::string &name(TenantId id) const
+    {
+        return tenants_[id]->name_;
+    }
+
+    bool full(TenantId id) const
+    {
+        return tenants_[id]->queue_.size() >= tenants_[id]->limit_;
+    }
+
+    // 所有租户排队的任务数量
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    // 放入租户的队列，调用前已经检查过 full
+    void push(TenantId id, T task)
+    {
+        Tenant *tenant = tenants_[id].get();
+        tenant->queue_.push_back(std::move(task));
+        size_++;
+        if (!tenant->active_)
+        {
+            tenant->active_ = true;
+            active_.push_back(tenant);
+            if (active_.size() == 1)
+                newRound(tenant);
+        }
+    }
+
+    // 丢弃租户最早的一个任务（REJECT_DISCARD_OLDEST）
+    bool popOldest(TenantId id, T &task)
+    {
+        Tenant *tenant = tenants_[id].get();
+        if (tenant->queue_.empty())
+            return false;
+        task = std::move(tenant->queue_.front());
+        tenant->queue_.pop_front();
+        size_--;
+        if (tenant->queue_.empty())
+            deactivate(tenant);
+        return true;
+    }
+
+    // 按 deficit round robin 取出一个任务
+    bool pop(T &task, FairTicket &ticket)
+    {
+        if (active_.empty())
+            return false;
+        std::size_t exhausted = 0;
+        for (;;)
+        {
+            Tenant *tenant = active_.front();
+            tenant->deficit_ -= tenant->pending_.exchange(0, std::memory_order_relaxed);
+            if (tenant->deficit_ > 0)
+            {
+                ticket.tenant_ = tenant;
+                ticket.estimate_ = tenant->avgCost_.load(std::memory_order_relaxed);
+                tenant->deficit_ -= ticket.estimate_;
+                task = std::move(tenant->queue_.front());
+                tenant->queue_.pop_front();
+                size_--;
+                if (tenant->queue_.empty())
+                    deactivate(tenant);
+                return true;
+            }
+            // 额度用完，轮到下一个租户
+            active_.pop_front();
+            active_.push_back(tenant);
+            newRound(active_.front());
+            // 所有租户都欠了好几轮的账（执行了很长的任务），直接跳过这些轮次
+            if (++exhausted == active_.size())
+            {
+                skipRounds();
+                exhausted = 0;
+            }
+        }
+    }
+
+    // 任务执行完，按实际执行时间结算
+    static void finish(const FairTicket &ticket, int64_t ns)
+    {
+        detail::FairTenant *tenant = ticket.tenant_;
+        tenant->pending_.fetch_add(ns - ticket.estimate_, std::memory_order_relaxed);
+        int64_t avg = tenant->avgCost_.load(std::memory_order_relaxed);
+        tenant->avgCost_.store(avg + (ns - avg) / 8, std::memory_order_relaxed);
+        tenant->executed_.fetch_add(1, std::memory_order_relaxed);
+        tenant->busyNs_.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    std::vector<TenantStats> stats() const
+    {
+        std::vector<TenantStats> result;
+        result.reserve(tenants_.size());
+        for (const std::unique_ptr<Tenant> &tenant : tenants_)
+        {
+            TenantStats stats;
+            stats.name_ = tenant->name_;
+            stats.weight_ = tenant->weight_;
+            stats.queued_ = tenant->queue_.size();
+            stats.executed_ = tenant->executed_.load(std::memory_order_relaxed);
+            stats.busyNs_ = tenant->busyNs_.load(std::memory_order_relaxed);
+            result.push_back(stats);
+        }
+        return result;
+    }
+
+private:
+    struct Tenant : public detail::FairTenant
+    {
+        Tenant(const std::string &name, unsigned weight, std::size_t limit) : detail::FairTenant(name, weight, limit)
+        {
+        }
+
+        std::deque<T> queue_;
+    };
+
+    int64_t quantum(const Tenant *tenant) const
+    {
+        return quantum_ * tenant->weight_;
+    }
+
+    // 轮到一个租户时补充这一轮的额度
+    void newRound(Tenant *tenant)
+    {
+        tenant->deficit_ += quantum(tenant);
+    }
+
+    // 队列空了，离开轮转；没用完的额度作废，欠账保留，避免靠一次只提交一个长任务逃掉计费
+    void deactivate(Tenant *tenant)
+    {
+        tenant->active_ = false;
+        tenant->deficit_ = std::min<int64_t>(tenant->deficit_, 0);
+        bool current = active_.front() == tenant;
+        active_.erase(std::find(active_.begin(), active_.end(), tenant));
+        if (current && !active_.empty())
+            newRound(active_.front());
+    }
+
+    // 每个租户都补充同样的轮数，直到至少有一个租户的额度变为正数
+    void skipRounds()
+    {
+        int64_t rounds = INT64_MAX;
+        for (Tenant *tenant : active_)
+            rounds = std::min(rounds, (-tenant->deficit_) / quantum(tenant));
+        if (rounds <= 0)
+            return;
+        for (Tenant *tenant : active_)
+            tenant->deficit_ += rounds * quantum(tenant);
+    }
+
+    int64_t quantum_;
+    std::size_t size_;
+    std::vector<std::unique_ptr<Tenant>> tenants_; // 租户只增加不删除，凭证里的指针一直有效
+    std::deque<Tenant *> active_;                  // 队列不空的租户，队首是当前轮到的租户
+};
+
+#endif
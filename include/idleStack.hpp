@@ -0,0 +1,142 @@
+#ifndef IDLE_STACK_HPP
+#define IDLE_STACK_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include <completion.hpp>
+
+/*
+空闲线程栈：没有任务的线程把自己的挂起槽位（一个Completion）压栈，然后在槽位上挂起
+提交任务时只弹出栈顶的一个槽位唤醒，而不是 notify_all 把所有线程叫醒去抢锁
+后进先出：最近才空闲的线程cache还是热的，优先唤醒它，长时间空闲的线程留在栈底
+
+约定：
+1. 被弹出的槽位一定会被 post，所以线程离开等待之前如果 remove 失败，
+   说明已经有人弹出了它，要等这次 post 完成（很快）之后才能复用或销毁槽位
+2. 线程先压栈，再检查有没有任务；提交任务的线程先增加任务计数，再看栈里有没有线程，
+   两边都用 seq_cst，保证不会丢失唤醒
+3. 等待任务结果的工作线程没有任务可以帮忙时，把等待的 Completion 作为等待者压栈（pushWaiter），
+   弹出时只 wake() 叫醒它、不标记完成；Completion 属于等待的结果，等待者返回以后可能马上被销毁，
+   所以在持有锁的时候叫醒，等待者 remove 失败时叫醒已经结束
+*/
+class IdleStack
+{
+public:
+    IdleStack() : size_(0)
+    {
+    }
+
+    IdleStack(const IdleStack &) = delete;
+    IdleStack &operator=(const IdleStack &) = delete;
+
+    // 线程空闲，登记自己的槽位
+    void push(Completion *slot)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stack_.push_back(Entry(slot, false));
+        size_.store(stack_.size());
+    }
+
+    // 等待结果的线程登记等待的 Completion，调用前先 arm()
+    void pushWaiter(Completion *done)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stack_.push_back(Entry(done, true));
+        size_.store(stack_.size());
+    }
+
+    // 线程自己离开空闲栈，返回false表示槽位已经被弹出（正在被唤醒）
+    bool remove(Completion *slot)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (std::size_t i = stack_.size(); i > 0; i--)
+        {
+            if (stack_[i - 1].slot_ == slot)
+            {
+                stack_.erase(stack_.begin() + (i - 1));
+                size_.store(stack_.size());
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 唤醒最近空闲的一个线程，没有空闲线程返回false
+    bool wakeOne()
+    {
+        if (size_.load() == 0)
+            return false;
+        Completion *slot;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (stack_.empty())
+                return false;
+            Entry entry = stack_.back();
+            stack_.pop_back();
+            size_.store(stack_.size());
+            if (entry.waiter_)
+            {
+                entry.slot_->wake();
+                return true;
+            }
+            slot = entry.slot_;
+        }
+        slot->post();
+        return true;
+    }
+
+    // 唤醒最多n个空闲线程，返回唤醒的数量
+    std::size_t wake(std::size_t n)
+    {
+        std::size_t woken = 0;
+        while (woken < n && wakeOne())
+            woken++;
+        return woken;
+    }
+
+    // 唤醒所有空闲线程（线程池退出）
+    void wakeAll()
+    {
+        std::vector<Entry> slots;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            slots.swap(stack_);
+            size_.store(0);
+            for (const Entry &entry : slots)
+            {
+                if (entry.waiter_)
+                    entry.slot_->wake();
+            }
+        }
+        for (const Entry &entry : slots)
+        {
+            if (!entry.waiter_)
+                entry.slot_->post();
+        }
+    }
+
+    // 空闲线程的数量
+    std::size_t size() const
+    {
+        return size_.load();
+    }
+
+private:
+    struct Entry
+    {
+        Entry(Completion *slot, bool waiter) : slot_(slot), waiter_(waiter)
+        {
+        }
+
+        Completion *slot_; // 空闲线程的挂起槽位，或者等待者等待的结果
+        bool waiter_;      // 是否是等待结果的线程
+    };
+
+    std::mutex mtx_;
+    std::vector<Entry> stack_;
+    std::atomic<std::size_t> size_;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef IDLE_STRATEGY_HPP
+#define IDLE_STRATEGY_HPP
+
+#include <thread>
+#include <completion.hpp>
+
+/*
+工作线程取不到任务时的等待策略：先自旋（每次检查之间一条 pause 指令），再让出CPU（sched_yield），最后挂起（futex）
+自旋和让出CPU期间线程不在空闲线程栈上，新任务到来时提交任务的线程不需要唤醒它，
+工作线程自己看到任务计数就回去取任务，省掉一次 futex 唤醒和调度延迟，代价是空闲时多占用CPU
+
+pool.setIdleStrategy(IdleStrategy::lowLatency()); // 行情这类延迟敏感、独占CPU的场景
+pool.setIdleStrategy(IdleStrategy::energySaving()); // 批处理机器，空闲时马上挂起（默认）
+*/
+struct IdleStrategy
+{
+    IdleStrategy(unsigned spins = 0, unsigned yields = 0) : spinCount_(spins), yieldCount_(yields)
+    {
+    }
+
+    // 自旋几十到几百微秒，再让出CPU一段时间，短暂的空闲基本不会挂起
+    static IdleStrategy lowLatency()
+    {
+        return IdleStrategy(20000, 200);
+    }
+
+    // 短暂自旋，覆盖任务之间很短的间隔
+    static IdleStrategy balanced()
+    {
+        return IdleStrategy(1000, 10);
+    }
+
+    // 不自旋，马上挂起
+    static IdleStrategy energySaving()
+    {
+        return IdleStrategy(0, 0);
+    }
+
+    unsigned spinCount_;  // 自旋检查的次数
+    unsigned yieldCount_; // 让出CPU的次数
+};
+
+// 空闲的工作线程在哪个阶段等到了任务（或者线程池结束）
+enum class WakeSource
+{
+    WAKE_SPIN,  // 自旋期间
+    WAKE_YIELD, // 让出CPU期间
+    WAKE_PARK   // 挂起以后被唤醒
+};
+
+namespace detail
+{
+    // 按策略自旋、让出CPU，等待 ready() 成立；都没等到返回 WAKE_PARK，调用方接着挂起
+    template <typename Ready>
+    WakeSource idleWait(const IdleStrategy &strategy, Ready ready)
+    {
+        for (unsigned i = 0; i < strategy.spinCount_; i++)
+        {
+            if (ready())
+                return WakeSource::WAKE_SPIN;
+            cpuRelax();
+        }
+        for (unsigned i = 0; i < strategy.yieldCount_; i++)
+        {
+            if (ready())
+                return WakeSource::WAKE_YIELD;
+            std::this_thread::yield();
+        }
+        return WakeSource::WAKE_PARK;
+    }
+}
+
+#endif
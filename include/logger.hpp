@@ -0,0 +1,373 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+异步日志
+1. 日志级别在编译期裁剪：低于 THREADPOOL_LOG_LEVEL 的日志宏展开为空语句，参数不会被求值
+2. 写日志的线程只把格式化好的消息拷贝进自己的环形缓冲区（单生产者单消费者，无锁），
+   不加锁、不做系统调用；后台线程定期把所有线程的缓冲区取空，写到输出文件
+3. 缓冲区满了直接丢弃这条日志并计数，热路径上永远不会因为写日志而阻塞
+
+用法：
+    LOG_INFO("thread count:" << n);
+编译时 -DTHREADPOOL_LOG_LEVEL=LOG_LEVEL_TRACE 打开全部日志，=LOG_LEVEL_OFF 关闭全部日志
+*/
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF 5
+
+#ifndef THREADPOOL_LOG_LEVEL
+#define THREADPOOL_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// 一条日志消息的格式化缓冲区，超出部分截断
+class LogStream
+{
+public:
+    static const std::size_t CAPACITY = 200;
+
+    LogStream() : len_(0)
+    {
+    }
+
+    LogStream &operator<<(const char *str)
+    {
+        append(str == nullptr ? "(null)" : str, str == nullptr ? 6 : std::strlen(str));
+        return *this;
+    }
+
+    LogStream &operator<<(const std::string &str)
+    {
+        append(str.data(), str.size());
+        return *this;
+    }
+
+    LogStream &operator<<(char c)
+    {
+        append(&c, 1);
+        return *this;
+    }
+
+    LogStream &operator<<(bool b)
+    {
+        return *this << (b ? "true" : "false");
+    }
+
+    LogStream &operator<<(double d)
+    {
+        return format("%g", d);
+    }
+
+    LogStream &operator<<(const void *p)
+    {
+        return format("%p", p);
+    }
+
+    // std::thread::id 没有公开的数值，用它的hash值表示
+    LogStream &operator<<(std::thread::id id)
+    {
+        return format("%zu", std::hash<std::thread::id>()(id));
+    }
+
+    // 所有整数类型
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value, LogStream &>::type operator<<(T v)
+    {
+        if (std::is_signed<T>::value)
+            return format("%lld", (long long)v);
+        return format("%llu", (unsigned long long)v);
+    }
+
+    const char *data() const { return buf_; }
+    std::size_t size() const { return len_; }
+
+private:
+    template <typename T>
+    LogStream &format(const char *fmt, T v)
+    {
+        char tmp[32];
+        int n = std::snprintf(tmp, sizeof(tmp), fmt, v);
+        if (n > 0)
+            append(tmp, (std::size_t)n < sizeof(tmp) ? n : sizeof(tmp) - 1);
+        return *this;
+    }
+
+    void append(const char *str, std::size_t n)
+    {
+        if (n > CAPACITY - len_)
+            n = CAPACITY - len_;
+        std::memcpy(buf_ + len_, str, n);
+        len_ += n;
+    }
+
+    char buf_[CAPACITY];
+    std::size_t len_;
+};
+
+class Logger
+{
+public:
+    // 一条日志记录，写入线程缓冲区时整条拷贝
+    struct Record
+    {
+        int64_t time_;     // 微秒时间戳
+        std::size_t tid_;  // 写日志的线程
+        const char *file_; // __FILE__ 是字符串常量，只保存指针
+        int line_;
+        int level_;
+        uint32_t len_;
+        char msg_[LogStream::CAPACITY];
+    };
+
+    // 进程内只有一个日志对象，线程退出时还会访问它，所以不析构
+    static Logger &instance()
+    {
+        static Logger *logger = new Logger();
+        return *logger;
+    }
+
+    // 设置日志输出的位置，默认是标准输出
+    void setOutput(FILE *out)
+    {
+        std::lock_guard<std::mutex> lock(drainMtx_);
+        out_ = out;
+    }
+
+    // 把当前线程的日志放入它自己的缓冲区，缓冲区满了丢弃
+    void write(int level, const char *file, int line, const LogStream &stream)
+    {
+        Ring &ring = localRing();
+        uint32_t tail = ring.tail_.load(std::memory_order_relaxed);
+        if (tail - ring.head_.load(std::memory_order_acquire) >= RING_SIZE)
+        {
+            ring.dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Record &rec = ring.records_[tail & (RING_SIZE - 1)];
+        rec.time_ = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        rec.tid_ = std::hash<std::thread::id>()(std::this_thread::get_id());
+        rec.file_ = file;
+        rec.line_ = line;
+        rec.level_ = level;
+        rec.len_ = (uint32_t)stream.size();
+        std::memcpy(rec.msg_, stream.data(), stream.size());
+        ring.tail_.store(tail + 1, std::memory_order_release);
+        // 缓冲区快满了才提醒后台线程，平时由后台线程定期取
+        if (tail - ring.head_.load(std::memory_order_relaxed) == RING_SIZE / 2)
+            wakeWriter_.notify_one();
+    }
+
+    // 把所有线程缓冲区里面的日志立即写出
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(drainMtx_);
+        drain();
+    }
+
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+
+private:
+    static const uint32_t RING_SIZE = 256; // 每个线程最多缓存的日志条数，必须是2的幂
+
+    // 单生产者（写日志的线程）单消费者（后台线程）的环形缓冲区
+    struct Ring
+    {
+        Ring() : head_(0), tail_(0), dropped_(0), closed_(false)
+        {
+        }
+        Record records_[RING_SIZE];
+        std::atomic<uint32_t> head_; // 后台线程读到的位置
+        std::atomic<uint32_t> tail_; // 写日志的线程写到的位置
+        std::atomic<uint32_t> dropped_;
+        std::atomic_bool closed_; // 所属线程已经退出，取空以后就可以回收
+    };
+
+    // 线程退出时标记缓冲区关闭，剩下的日志由后台线程写完
+    struct RingHolder
+    {
+        std::shared_ptr<Ring> ring_;
+        ~RingHolder()
+        {
+            if (ring_)
+                ring_->closed_ = true;
+        }
+    };
+
+    Logger() : out_(stdout)
+    {
+        std::thread writer(&Logger::writerFunc, this);
+        writer.detach();
+        // 进程正常退出时把没写出的日志写完
+        std::atexit(&Logger::flushAtExit);
+    }
+
+    static void flushAtExit()
+    {
+        instance().flush();
+    }
+
+    Ring &localRing()
+    {
+        static thread_local RingHolder holder;
+        if (!holder.ring_)
+        {
+            holder.ring_ = std::make_shared<Ring>();
+            std::lock_guard<std::mutex> lock(ringsMtx_);
+            rings_.push_back(holder.ring_);
+        }
+        return *holder.ring_;
+    }
+
+    // 后台线程：每隔一段时间（或者有缓冲区快满时）把所有缓冲区取空
+    void writerFunc()
+    {
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(wakeMtx_);
+                wakeWriter_.wait_for(lock, std::chrono::milliseconds(50));
+            }
+            flush();
+        }
+    }
+
+    // 调用时已经持有 drainMtx_
+    void drain()
+    {
+        std::vector<std::shared_ptr<Ring>> rings;
+        {
+            std::lock_guard<std::mutex> lock(ringsMtx_);
+            rings = rings_;
+        }
+        bool wrote = false;
+        for (const std::shared_ptr<Ring> &ring : rings)
+        {
+            bool closed = ring->closed_;
+            uint32_t head = ring->head_.load(std::memory_order_relaxed);
+            uint32_t tail = ring->tail_.load(std::memory_order_acquire);
+            for (; head != tail; head++)
+            {
+                writeRecord(ring->records_[head & (RING_SIZE - 1)]);
+                wrote = true;
+            }
+            ring->head_.store(head, std::memory_order_release);
+            uint32_t dropped = ring->dropped_.exchange(0, std::memory_order_relaxed);
+            if (dropped > 0)
+            {
+                std::fprintf(out_, "[WARN ] %u log records dropped, log buffer is full\n", dropped);
+                wrote = true;
+            }
+            // 线程已经退出并且日志已经取空，回收缓冲区
+            if (closed && head == ring->tail_.load(std::memory_order_acquire))
+            {
+                std::lock_guard<std::mutex> lock(ringsMtx_);
+                for (std::size_t i = 0; i < rings_.size(); i++)
+                {
+                    if (rings_[i] == ring)
+                    {
+                        rings_.erase(rings_.begin() + i);
+                        break;
+                    }
+                }
+            }
+        }
+        if (wrote)
+            std::fflush(out_);
+    }
+
+    void writeRecord(const Record &rec)
+    {
+        static const char *const LEVEL_NAMES[] = {"TRACE", "DEBUG", "INFO ", "WARN ", "ERROR"};
+        std::time_t sec = (std::time_t)(rec.time_ / 1000000);
+        struct tm tmv;
+        localtime_r(&sec, &tmv);
+        char timeBuf[32];
+        std::strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S", &tmv);
+        std::fprintf(out_, "[%s] %s.%06d tid:%zu %.*s;%s:%d\n",
+                     LEVEL_NAMES[rec.level_], timeBuf, (int)(rec.time_ % 1000000), rec.tid_,
+                     (int)rec.len_, rec.msg_, rec.file_, rec.line_);
+    }
+
+    std::mutex ringsMtx_; // 保护 rings_
+    std::vector<std::shared_ptr<Ring>> rings_;
+    std::mutex drainMtx_; // 同一时刻只有一个线程在写输出
+    std::mutex wakeMtx_;
+    std::condition_variable wakeWriter_;
+    FILE *out_;
+};
+
+#define LOG_WRITE(level, str)                                        \
+    do                                                               \
+    {                                                                \
+        LogStream logStream_;                                        \
+        logStream_ << str;                                           \
+        Logger::instance().write(level, __FILE__, __LINE__, logStream_); \
+    } while (0)
+
+#if THREADPOOL_LOG_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(str) LOG_WRITE(LOG_LEVEL_TRACE, str)
+#else
+#define LOG_TRACE(str) \
+    do                 \
+    {                  \
+    } while (0)
+#endif
+
+#if THREADPOOL_LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(str) LOG_WRITE(LOG_LEVEL_DEBUG, str)
+#else
+#define LOG_DEBUG(str) \
+    do                 \
+    {                  \
+    } while (0)
+#endif
+
+#if THREADPOOL_LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(str) LOG_WRITE(LOG_LEVEL_INFO, str)
+#else
+#define LOG_INFO(str) \
+    do                \
+    {                 \
+    } while (0)
+#endif
+
+#if THREADPOOL_LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(str) LOG_WRITE(LOG_LEVEL_WARN, str)
+#else
+#define LOG_WARN(str) \
+    do                \
+    {                 \
+    } while (0)
+#endif
+
+#if THREADPOOL_LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(str) LOG_WRITE(LOG_LEVEL_ERROR, str)
+#else
+#define LOG_ERROR(str) \
+    do                 \
+    {                  \
+    } while (0)
+#endif
+
+#endif
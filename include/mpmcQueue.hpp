@@ -0,0 +1,160 @@
+#ifndef MPMC_QUEUE_HPP
+#define MPMC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// 任务队列的实现方式
+enum class QueueMode
+{
+    MODE_LOCKED,  // std::queue + 互斥锁（默认）
+    MODE_LOCKFREE // 无锁有界环形队列
+};
+
+/*
+无锁有界多生产者多消费者环形队列（Dmitry Vyukov 的 bounded MPMC queue）
+每个槽位带一个序号：
+  seq == pos       槽位空闲，生产者可以写入
+  seq == pos + 1   槽位已写入，消费者可以读取
+生产者和消费者只在各自的位置计数上做一次CAS，不需要互斥锁
+出队的CAS使用seq_cst（x86上 lock cmpxchg 本身就是全屏障），
+线程池依赖它和“等待队列不满的线程数”配合，避免丢失唤醒
+容量会向上取整为2的幂，方便用位运算取下标
+*/
+template <typename T>
+class MpmcQueue
+{
+public:
+    explicit MpmcQueue(std::size_t capacity)
+    {
+        std::size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mask_ = size - 1;
+        cells_ = new Cell[size];
+        for (std::size_t i = 0; i < size; i++)
+        {
+            cells_[i].seq_.store(i, std::memory_order_relaxed);
+        }
+        enqueuePos_.store(0, std::memory_order_relaxed);
+        dequeuePos_.store(0, std::memory_order_relaxed);
+    }
+
+    ~MpmcQueue()
+    {
+        // 析构时已经没有并发访问，直接析构还留在队列里的元素
+        std::size_t tail = enqueuePos_.load(std::memory_order_relaxed);
+        for (std::size_t pos = dequeuePos_.load(std::memory_order_relaxed); pos != tail; pos++)
+        {
+            reinterpret_cast<T *>(&cells_[pos & mask_].storage_)->~T();
+        }
+        delete[] cells_;
+    }
+
+    MpmcQueue(const MpmcQueue &) = delete;
+    MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+    // 放入元素，队列满时返回false，不会阻塞
+    bool tryPush(T &&item)
+    {
+        Cell *cell;
+        std::size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            std::size_t seq = cell->seq_.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+            if (diff == 0)
+            {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                // 槽位上一轮的数据还没有被取走，队列已满
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        new (&cell->storage_) T(std::move(item));
+        cell->seq_.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 取出元素，队列空时返回false，不会阻塞
+    bool tryPop(T &item)
+    {
+        Cell *cell;
+        std::size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            std::size_t seq = cell->seq_.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                // 队列为空
+                return false;
+            }
+            else
+            {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        T *data = reinterpret_cast<T *>(&cell->storage_);
+        item = std::move(*data);
+        data->~T();
+        cell->seq_.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 近似的元素数量，只用于判断队列是否满/空
+    std::size_t size() const
+    {
+        std::size_t tail = enqueuePos_.load(std::memory_order_seq_cst);
+        std::size_t head = dequeuePos_.load(std::memory_order_seq_cst);
+        return tail > head ? tail - head : 0;
+    }
+
+    std::size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+private:
+    static const std::size_t CACHE_LINE_SIZE = 64;
+
+    struct Cell
+    {
+        std::atomic<std::size_t> seq_;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+    };
+
+    // 生产者和消费者的位置计数分别放在独立的cache line上，避免伪共享
+    char pad0_[CACHE_LINE_SIZE];
+    Cell *cells_;
+    std::size_t mask_;
+    char pad1_[CACHE_LINE_SIZE - sizeof(Cell *) - sizeof(std::size_t)];
+    std::atomic<std::size_t> enqueuePos_;
+    char pad2_[CACHE_LINE_SIZE - sizeof(std::atomic<std::size_t>)];
+    std::atomic<std::size_t> dequeuePos_;
+    char pad3_[CACHE_LINE_SIZE - sizeof(std::atomic<std::size_t>)];
+};
+
+#endif
@@ -0,0 +1,406 @@
+#ifndef PARALLEL_ALGORITHM_HPP
+#define PARALLEL_ALGORITHM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <completion.hpp>
+#include <taskFunction.hpp>
+#include <waitHelper.hpp>
+
+/*
+基于线程池的并行算法，替代手工把 1..N 切成 MyTask(begin,end) 再合并结果的写法
+executor 需要提供 bool execute(TaskFunction) 和 std::size_t concurrency()（比如 ThreadPool2）
+
+切分方式：区间切成若干块，调用线程和线程池里的几个帮手线程用一个原子计数器动态领取块，
+谁先做完谁多领，负载自动均衡；调用线程自己也在干活，只等待所有块做完，
+不等待帮手任务本身被调度，所以在线程池线程里调用也不会因为线程都在等待而死锁
+grain 为0时自动选择块大小：每个线程大约分到 CHUNKS_PER_THREAD 块
+*/
+namespace detail
+{
+    const std::size_t CHUNKS_PER_THREAD = 8;
+
+    // 一次并行调用的共享状态，帮手任务可能在调用返回以后才被调度，所以用 shared_ptr 管理
+    class ParallelJob
+    {
+    public:
+        ParallelJob(std::size_t chunks, void (*invoke)(void *, std::size_t), void *body)
+            : chunks_(chunks), next_(0), finished_(0), failed_(false), invoke_(invoke), body_(body)
+        {
+        }
+
+        // 领取并执行块，直到没有块可以领
+        void work()
+        {
+            for (;;)
+            {
+                std::size_t chunk = next_.fetch_add(1, std::memory_order_relaxed);
+                if (chunk >= chunks_)
+                    return;
+                // 已经有块抛出了异常，剩下的块不再执行，只计数
+                if (!failed_.load(std::memory_order_relaxed))
+                {
+                    try
+                    {
+                        invoke_(body_, chunk);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(errorMtx_);
+                        if (!error_)
+                            error_ = std::current_exception();
+                        failed_.store(true, std::memory_order_relaxed);
+                    }
+                }
+                if (finished_.fetch_add(1, std::memory_order_acq_rel) + 1 == chunks_)
+                    done_.post();
+            }
+        }
+
+        // 等待所有块执行完，有异常时重新抛出第一个异常
+        void wait()
+        {
+            helpWait(done_);
+            if (failed_.load(std::memory_order_relaxed))
+                std::rethrow_exception(error_);
+        }
+
+    private:
+        std::size_t chunks_;
+        std::atomic<std::size_t> next_;     // 下一个要领取的块
+        std::atomic<std::size_t> finished_; // 已经执行完的块
+        std::atomic_bool failed_;
+        std::mutex errorMtx_;
+        std::exception_ptr error_;
+        Completion done_;
+        void (*invoke_)(void *, std::size_t); // 执行一个块，body_ 只在还有块没有完成时才会被访问
+        void *body_;
+    };
+
+    template <typename Body>
+    void invokeChunk(void *body, std::size_t chunk)
+    {
+        (*static_cast<Body *>(body))(chunk);
+    }
+
+    // 按区间长度和线程数量决定块的数量
+    template <typename Executor>
+    std::size_t chunkCount(Executor &executor, std::size_t n, std::size_t grain)
+    {
+        if (n == 0)
+            return 0;
+        if (grain == 0)
+        {
+            std::size_t threads = executor.concurrency();
+            std::size_t chunks = (threads == 0 ? 1 : threads) * CHUNKS_PER_THREAD;
+            return chunks < n ? chunks : n;
+        }
+        return (n + grain - 1) / grain;
+    }
+
+    // 并行执行 body(0) ... body(chunks - 1)，返回时所有块都已经执行完
+    template <typename Executor, typename Body>
+    void runChunks(Executor &executor, std::size_t chunks, Body &body)
+    {
+        if (chunks == 0)
+            return;
+        if (chunks == 1)
+        {
+            body(0);
+            return;
+        }
+        std::shared_ptr<ParallelJob> job = std::make_shared<ParallelJob>(chunks, &invokeChunk<Body>, &body);
+        std::size_t helpers = executor.concurrency();
+        if (helpers > chunks - 1)
+            helpers = chunks - 1;
+        for (std::size_t i = 0; i < helpers; i++)
+        {
+            // 队列满提交失败也没关系，剩下的块由调用线程自己执行
+            if (!executor.execute(TaskFunction([job]()
+                                               { job->work(); })))
+                break;
+        }
+        job->work();
+        job->wait();
+    }
+
+    // 第 chunk 块对应的区间 [begin, end)
+    inline void chunkRange(std::size_t n, std::size_t chunks, std::size_t chunk, std::size_t &begin, std::size_t &end)
+    {
+        std::size_t base = n / chunks;
+        std::size_t extra = n % chunks;
+        begin = chunk * base + (chunk < extra ? chunk : extra);
+        end = begin + base + (chunk < extra ? 1 : 0);
+    }
+
+    template <typename Index, typename Func>
+    struct ForIndexBody
+    {
+        Index first_;
+        std::size_t n_;
+        std::size_t chunks_;
+        Func &func_;
+        void operator()(std::size_t chunk)
+        {
+            std::size_t begin, end;
+            chunkRange(n_, chunks_, chunk, begin, end);
+            for (std::size_t i = begin; i < end; i++)
+                func_(static_cast<Index>(first_ + i));
+        }
+    };
+
+    template <typename Iter, typename Func>
+    struct ForEachBody
+    {
+        Iter first_;
+        std::size_t n_;
+        std::size_t chunks_;
+        Func &func_;
+        void operator()(std::size_t chunk)
+        {
+            std::size_t begin, end;
+            chunkRange(n_, chunks_, chunk, begin, end);
+            for (Iter it = first_ + begin, last = first_ + end; it != last; ++it)
+                func_(*it);
+        }
+    };
+
+    // 每块先做 transform，再用 reduce 合并成块内的部分结果
+    template <typename Iter, typename T, typename Reduce, typename Transform>
+    struct TransformReduceBody
+    {
+        Iter first_;
+        std::size_t n_;
+        std::size_t chunks_;
+        Reduce &reduce_;
+        Transform &transform_;
+        std::vector<T> &partials_;
+        void operator()(std::size_t chunk)
+        {
+            std::size_t begin, end;
+            chunkRange(n_, chunks_, chunk, begin, end);
+            Iter it = first_ + begin;
+            Iter last = first_ + end;
+            T partial = transform_(*it);
+            for (++it; it != last; ++it)
+                partial = reduce_(std::move(partial), transform_(*it));
+            partials_[chunk] = std::move(partial);
+        }
+    };
+
+    struct Identity
+    {
+        template <typename T>
+        T &&operator()(T &&value) const
+        {
+            return std::forward<T>(value);
+        }
+    };
+
+    template <typename Iter, typename Compare>
+    struct SortBody
+    {
+        Iter first_;
+        std::size_t n_;
+        std::size_t chunks_;
+        Compare &comp_;
+        void operator()(std::size_t chunk)
+        {
+            std::size_t begin, end;
+            chunkRange(n_, chunks_, chunk, begin, end);
+            std::sort(first_ + begin, first_ + end, comp_);
+        }
+    };
+
+    // 一轮归并：相邻两段 [bounds[2i], bounds[2i+1]) [bounds[2i+1], bounds[2i+2]) 合并
+    template <typename Iter, typename Compare>
+    struct MergeBody
+    {
+        Iter first_;
+        const std::vector<std::size_t> &bounds_;
+        Compare &comp_;
+        void operator()(std::size_t pair)
+        {
+            std::inplace_merge(first_ + bounds_[2 * pair], first_ + bounds_[2 * pair + 1], first_ + bounds_[2 * pair + 2], comp_);
+        }
+    };
+
+    // 扫描的第三步：每块从前面所有块的合计值开始做块内扫描
+    template <typename InIter, typename OutIter, typename T, typename Op>
+    struct ScanBody
+    {
+        InIter first_;
+        OutIter out_;
+        std::size_t n_;
+        std::size_t chunks_;
+        Op &op_;
+        const std::vector<T> &offsets_; // offsets_[i] 是前 i 块的合计，第0块没有
+        void operator()(std::size_t chunk)
+        {
+            std::size_t begin, end;
+            chunkRange(n_, chunks_, chunk, begin, end);
+            InIter it = first_ + begin;
+            InIter last = first_ + end;
+            OutIter out = out_ + begin;
+            T sum = chunk == 0 ? T(*it) : op_(offsets_[chunk], *it);
+            *out = sum;
+            for (++it, ++out; it != last; ++it, ++out)
+            {
+                sum = op_(std::move(sum), *it);
+                *out = sum;
+            }
+        }
+    };
+}
+
+// 对 [first, last) 里面的每个整数 i 并行调用 func(i)
+template <typename Executor, typename Index, typename Func>
+typename std::enable_if<std::is_integral<Index>::value>::type
+parallel_for(Executor &executor, Index first, Index last, Func &&func, std::size_t grain = 0)
+{
+    if (!(first < last))
+        return;
+    std::size_t n = static_cast<std::size_t>(last - first);
+    std::size_t chunks = detail::chunkCount(executor, n, grain);
+    detail::ForIndexBody<Index, typename std::remove_reference<Func>::type> body = {first, n, chunks, func};
+    detail::runChunks(executor, chunks, body);
+}
+
+// 对随机访问区间 [first, last) 里面的每个元素并行调用 func(*it)
+template <typename Executor, typename Iter, typename Func>
+typename std::enable_if<!std::is_integral<Iter>::value>::type
+parallel_for(Executor &executor, Iter first, Iter last, Func &&func, std::size_t grain = 0)
+{
+    std::size_t n = static_cast<std::size_t>(std::distance(first, last));
+    std::size_t chunks = detail::chunkCount(executor, n, grain);
+    detail::ForEachBody<Iter, typename std::remove_reference<Func>::type> body = {first, n, chunks, func};
+    detail::runChunks(executor, chunks, body);
+}
+
+// 并行计算 init reduce transform(*first) reduce ... reduce transform(*(last-1))
+// reduce 需要满足结合律（不要求交换律，块的合并顺序和区间顺序一致）
+template <typename Executor, typename Iter, typename T, typename Reduce, typename Transform>
+T parallel_transform_reduce(Executor &executor, Iter first, Iter last, T init, Reduce reduce, Transform transform, std::size_t grain = 0)
+{
+    std::size_t n = static_cast<std::size_t>(std::distance(first, last));
+    std::size_t chunks = detail::chunkCount(executor, n, grain);
+    if (chunks == 0)
+        return init;
+    std::vector<T> partials(chunks, init);
+    detail::TransformReduceBody<Iter, T, Reduce, Transform> body = {first, n, chunks, reduce, transform, partials};
+    detail::runChunks(executor, chunks, body);
+    for (T &partial : partials)
+        init = reduce(std::move(init), std::move(partial));
+    return init;
+}
+
+// 并行计算 init op *first op ... op *(last-1)，op 需要满足结合律
+template <typename Executor, typename Iter, typename T, typename BinaryOp>
+T parallel_reduce(Executor &executor, Iter first, Iter last, T init, BinaryOp op, std::size_t grain = 0)
+{
+    return parallel_transform_reduce(executor, first, last, std::move(init), op, detail::Identity(), grain);
+}
+
+template <typename Executor, typename Iter, typename T>
+T parallel_reduce(Executor &executor, Iter first, Iter last, T init)
+{
+    return parallel_reduce(executor, first, last, std::move(init), std::plus<T>());
+}
+
+/*
+并行排序（不稳定）：区间切成若干块并行 std::sort，然后逐轮两两并行归并
+块数取线程数量（向上取2的幂），元素太少时直接串行排序
+*/
+template <typename Executor, typename Iter, typename Compare>
+void parallel_sort(Executor &executor, Iter first, Iter last, Compare comp)
+{
+    const std::size_t SERIAL_CUTOFF = 4096;
+    std::size_t n = static_cast<std::size_t>(std::distance(first, last));
+    std::size_t threads = executor.concurrency();
+    if (n <= SERIAL_CUTOFF || threads <= 1)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+    std::size_t chunks = 1;
+    while (chunks < threads && n / (chunks * 2) >= SERIAL_CUTOFF)
+        chunks *= 2;
+    detail::SortBody<Iter, Compare> sortBody = {first, n, chunks, comp};
+    detail::runChunks(executor, chunks, sortBody);
+
+    // bounds 保存每一段的起点，最后一个是 n
+    std::vector<std::size_t> bounds(chunks + 1);
+    for (std::size_t i = 0; i < chunks; i++)
+    {
+        std::size_t end;
+        detail::chunkRange(n, chunks, i, bounds[i], end);
+    }
+    bounds[chunks] = n;
+    while (bounds.size() > 2)
+    {
+        std::size_t pairs = (bounds.size() - 1) / 2;
+        detail::MergeBody<Iter, Compare> mergeBody = {first, bounds, comp};
+        detail::runChunks(executor, pairs, mergeBody);
+        std::vector<std::size_t> merged;
+        for (std::size_t i = 0; i < bounds.size(); i += 2)
+            merged.push_back(bounds[i]);
+        if (merged.back() != n)
+            merged.push_back(n);
+        bounds.swap(merged);
+    }
+}
+
+template <typename Executor, typename Iter>
+void parallel_sort(Executor &executor, Iter first, Iter last)
+{
+    parallel_sort(executor, first, last, std::less<typename std::iterator_traits<Iter>::value_type>());
+}
+
+/*
+并行前缀和：out[i] = in[0] op in[1] op ... op in[i]，out 可以和 in 是同一个区间
+分三步：每块并行求合计 =》 串行求每块之前的合计 =》 每块并行做块内扫描
+返回输出区间的末尾
+*/
+template <typename Executor, typename InIter, typename OutIter, typename BinaryOp>
+OutIter parallel_inclusive_scan(Executor &executor, InIter first, InIter last, OutIter out, BinaryOp op, std::size_t grain = 0)
+{
+    typedef typename std::iterator_traits<InIter>::value_type T;
+    std::size_t n = static_cast<std::size_t>(std::distance(first, last));
+    std::size_t chunks = detail::chunkCount(executor, n, grain);
+    if (chunks == 0)
+        return out;
+
+    std::vector<T> offsets(chunks, T(*first));
+    if (chunks > 1)
+    {
+        // 最后一块的合计用不到，只算前 chunks-1 块
+        detail::Identity identity;
+        std::vector<T> sums(chunks - 1, T(*first));
+        // 块按 chunks 划分（和扫描时一致），但只执行前 chunks-1 块
+        detail::TransformReduceBody<InIter, T, BinaryOp, detail::Identity> sumBody = {first, n, chunks, op, identity, sums};
+        detail::runChunks(executor, chunks - 1, sumBody);
+        offsets[1] = sums[0];
+        for (std::size_t i = 2; i < chunks; i++)
+            offsets[i] = op(offsets[i - 1], sums[i - 1]);
+    }
+    detail::ScanBody<InIter, OutIter, T, BinaryOp> scanBody = {first, out, n, chunks, op, offsets};
+    detail::runChunks(executor, chunks, scanBody);
+    return out + n;
+}
+
+template <typename Executor, typename InIter, typename OutIter>
+OutIter parallel_inclusive_scan(Executor &executor, InIter first, InIter last, OutIter out)
+{
+    return parallel_inclusive_scan(executor, first, last, out, std::plus<typename std::iterator_traits<InIter>::value_type>());
+}
+
+#endif
@@ -0,0 +1,438 @@
+#ifndef POOL_STATS_HPP
+#define POOL_STATS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <idleStrategy.hpp>
+
+/*
+线程池的运行统计
+1. 每个工作线程一份计数器，只有这个线程自己写（relaxed 的 load + store，不需要原子的读改写），
+   前后用一个缓存行隔开，线程之间不会互相争抢缓存行；stats() 读快照时可能看到稍微旧一点的值
+2. 排队时间和执行时间用 HDR 风格的对数直方图统计：每个2的幂区间再分成8份，相对误差不超过12.5%，
+   覆盖 1ns ~ 3天，记录一次只是一次计数加一
+3. 统计默认关闭，setStatsEnabled(true) 以后每个任务多读三次时钟（提交、开始、结束）
+
+example:
+pool.setStatsEnabled(true);
+pool.start(4);
+...
+PoolStats stats = pool.stats();
+printf("p99 queue wait: %llu ns\n", (unsigned long long)stats.queueWait_.percentile(0.99));
+writePrometheusFile(stats, "/var/lib/node_exporter/threadpool.prom");
+*/
+namespace detail
+{
+    inline int64_t statsNowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 只有一个线程写的计数器加上 n
+    inline void bump(std::atomic<uint64_t> &counter, uint64_t n = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+}
+
+// 直方图的快照，可以合并多个线程的直方图
+struct HistogramSnapshot
+{
+    static const int SUB_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_EXPONENT = 47;
+    static const int BUCKETS = (MAX_EXPONENT - SUB_BITS + 2) * SUB_BUCKETS;
+
+    HistogramSnapshot() : counts_(BUCKETS, 0), count_(0), sum_(0), max_(0)
+    {
+    }
+
+    // 数值对应的桶
+    static int bucketOf(uint64_t value)
+    {
+        if (value >= (1ULL << (MAX_EXPONENT + 1)))
+            value = (1ULL << (MAX_EXPONENT + 1)) - 1;
+        if (value < (uint64_t)SUB_BUCKETS)
+            return (int)value;
+        int exponent = 63 - __builtin_clzll(value);
+        int mantissa = (int)(value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return (exponent - SUB_BITS + 1) * SUB_BUCKETS + mantissa;
+    }
+
+    // 桶里最大的数值
+    static uint64_t bucketUpper(int bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return (uint64_t)bucket;
+        int exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+        uint64_t mantissa = (uint64_t)(bucket % SUB_BUCKETS);
+        uint64_t lower = (SUB_BUCKETS + mantissa) << (exponent - SUB_BITS);
+        return lower + (1ULL << (exponent - SUB_BITS)) - 1;
+    }
+
+    void merge(const HistogramSnapshot &other)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+            counts_[i] += other.counts_[i];
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    // 分位数，q 取 0~1，返回所在桶的上界（不超过最大值）
+    uint64_t percentile(double q) const
+    {
+        if (count_ == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(q * (double)count_);
+        if (rank >= count_)
+            rank = count_ - 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += counts_[i];
+            if (seen > rank)
+                return std::min(bucketUpper(i), max_);
+        }
+        return max_;
+    }
+
+    double mean() const
+    {
+        return count_ == 0 ? 0 : (double)sum_ / (double)count_;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_;
+    uint64_t sum_; // 所有记录值的和，单位纳秒
+    uint64_t max_;
+};
+
+// 一个线程写、任意线程读的直方图，单位纳秒
+class LatencyHistogram
+{
+public:
+    LatencyHistogram() : count_(0), sum_(0), max_(0)
+    {
+        for (int i = 0; i < HistogramSnapshot::BUCKETS; i++)
+            counts_[i].store(0, std::memory_order_relaxed);
+    }
+
+    // 只能由所属的线程调用
+    void record(uint64_t ns)
+    {
+        detail::bump(counts_[HistogramSnapshot::bucketOf(ns)]);
+        detail::bump(count_);
+        detail::bump(sum_, ns);
+        if (ns > max_.load(std::memory_order_relaxed))
+            max_.store(ns, std::memory_order_relaxed);
+    }
+
+    // 把当前的计数合并到快照里
+    void collect(HistogramSnapshot &snapshot) const
+    {
+        for (int i = 0; i < HistogramSnapshot::BUCKETS; i++)
+            snapshot.counts_[i] += counts_[i].load(std::memory_order_relaxed);
+        snapshot.count_ += count_.load(std::memory_order_relaxed);
+        snapshot.sum_ += sum_.load(std::memory_order_relaxed);
+        snapshot.max_ = std::max(snapshot.max_, max_.load(std::memory_order_relaxed));
+    }
+
+private:
+    std::atomic<uint64_t> counts_[HistogramSnapshot::BUCKETS];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+// 一个工作线程的统计快照
+struct WorkerStats
+{
+    std::size_t index_;              // 线程槽位，cached模式下退出的线程归还槽位，新线程接着使用
+    bool active_;                    // 线程是否还在运行（cached模式下线程会退出）
+    uint64_t executed_;              // 执行的任务数量
+    uint64_t stolen_;                // 从其他线程偷来的任务数量
+    std::chrono::nanoseconds busy_;  // 执行任务的总时间
+    std::chrono::nanoseconds idle_;  // 挂起等待任务的总时间
+    uint64_t spinWakeups_;           // 空闲时在自旋阶段等到任务的次数
+    uint64_t yieldWakeups_;          // 空闲时在让出CPU阶段等到任务的次数
+    uint64_t parkWakeups_;           // 空闲时挂起以后被唤醒的次数
+};
+
+// 一个租户（ThreadPool2::addTenant）的统计快照
+struct TenantStats
+{
+    std::string name_;
+    unsigned weight_;   // 权重
+    std::size_t queued_; // 排队的任务数量
+    uint64_t executed_; // 执行完的任务数量
+    uint64_t busyNs_;   // 执行任务的总时间（纳秒），长时间忙碌时各租户的比例接近权重的比例
+};
+
+// 线程池的统计快照
+struct PoolStats
+{
+    PoolStats() : submitted_(0), rejected_(0), queueDepth_(0), queueHighWater_(0), threads_(0), idleThreads_(0)
+    {
+    }
+
+    std::vector<WorkerStats> workers_;
+    uint64_t submitted_;            // 成功提交的任务数量
+    uint64_t rejected_;             // 队列满提交失败的任务数量，REJECT_CALLER_RUNS 下由提交线程执行的不算
+    std::size_t queueDepth_;        // 当前排队的任务数量
+    std::size_t queueHighWater_;    // 排队任务数量的最大值
+    int threads_;                   // 当前线程数量
+    int idleThreads_;               // 当前空闲线程数量
+    HistogramSnapshot queueWait_;   // 任务从提交到开始执行的时间
+    HistogramSnapshot execTime_;    // 任务执行的时间
+    std::vector<TenantStats> tenants_; // 每个租户的统计
+};
+
+/*
+工作线程的计数器，由工作线程自己更新
+前后各留一个缓存行，和相邻对象里被其他线程频繁写的数据隔开
+*/
+class WorkerCounters
+{
+public:
+    WorkerCounters() : active_(false), executed_(0), stolen_(0), busyNs_(0), idleNs_(0), spinWakeups_(0), yieldWakeups_(0), parkWakeups_(0)
+    {
+    }
+
+    // 执行完一个任务：enqueueTime 是提交时间，start/end 是开始和结束执行的时间
+    void taskDone(int64_t enqueueTime, int64_t start, int64_t end)
+    {
+        detail::bump(executed_);
+        detail::bump(busyNs_, (uint64_t)(end - start));
+        if (enqueueTime != 0 && start > enqueueTime)
+            queueWait_.record((uint64_t)(start - enqueueTime));
+        else
+            queueWait_.record(0);
+        execTime_.record((uint64_t)(end - start));
+    }
+
+    void taskStolen()
+    {
+        detail::bump(stolen_);
+    }
+
+    void idleFor(int64_t ns)
+    {
+        if (ns > 0)
+            detail::bump(idleNs_, (uint64_t)ns);
+    }
+
+    // 空闲以后在哪个阶段等到了任务
+    void wokeFrom(WakeSource source)
+    {
+        if (source == WakeSource::WAKE_SPIN)
+            detail::bump(spinWakeups_);
+        else if (source == WakeSource::WAKE_YIELD)
+            detail::bump(yieldWakeups_);
+        else
+            detail::bump(parkWakeups_);
+    }
+
+    // cached模式下线程退出时标记，槽位上再启动线程时重新标记
+    void setActive(bool active)
+    {
+        active_.store(active, std::memory_order_relaxed);
+    }
+
+    // 读快照，直方图合并到 stats 里
+    WorkerStats collect(std::size_t index, PoolStats &stats) const
+    {
+        WorkerStats worker;
+        worker.index_ = index;
+        worker.active_ = active_.load(std::memory_order_relaxed);
+        worker.executed_ = executed_.load(std::memory_order_relaxed);
+        worker.stolen_ = stolen_.load(std::memory_order_relaxed);
+        worker.busy_ = std::chrono::nanoseconds(busyNs_.load(std::memory_order_relaxed));
+        worker.idle_ = std::chrono::nanoseconds(idleNs_.load(std::memory_order_relaxed));
+        worker.spinWakeups_ = spinWakeups_.load(std::memory_order_relaxed);
+        worker.yieldWakeups_ = yieldWakeups_.load(std::memory_order_relaxed);
+        worker.parkWakeups_ = parkWakeups_.load(std::memory_order_relaxed);
+        queueWait_.collect(stats.queueWait_);
+        execTime_.collect(stats.execTime_);
+        return worker;
+    }
+
+private:
+    char padFront_[64];
+    std::atomic_bool active_;
+    std::atomic<uint64_t> executed_;
+    std::atomic<uint64_t> stolen_;
+    std::atomic<uint64_t> busyNs_;
+    std::atomic<uint64_t> idleNs_;
+    std::atomic<uint64_t> spinWakeups_;
+    std::atomic<uint64_t> yieldWakeups_;
+    std::atomic<uint64_t> parkWakeups_;
+    LatencyHistogram queueWait_;
+    LatencyHistogram execTime_;
+    char padBack_[64];
+};
+
+// 多个线程更新的最大值（排队任务数量的最大值），只有超过时才写
+inline void updateHighWater(std::atomic<std::size_t> &highWater, std::size_t value)
+{
+    std::size_t cur = highWater.load(std::memory_order_relaxed);
+    while (value > cur && !highWater.compare_exchange_weak(cur, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+namespace detail
+{
+    // 标签值按 Prometheus 文本格式转义：反斜杠、双引号和换行
+    inline std::string escapeLabel(const std::string &value)
+    {
+        std::string escaped;
+        escaped.reserve(value.size());
+        for (char c : value)
+        {
+            if (c == '\\')
+                escaped += "\\\\";
+            else if (c == '"')
+                escaped += "\\\"";
+            else if (c == '\n')
+                escaped += "\\n";
+            else
+                escaped += c;
+        }
+        return escaped;
+    }
+
+    inline void appendMetric(std::string &out, const char *fmt, const std::string &pool, double value)
+    {
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), fmt, pool.c_str(), value);
+        out += buf;
+    }
+
+    inline void appendWorkerMetric(std::string &out, const char *name, const std::string &pool, std::size_t worker, double value)
+    {
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), "%s{pool=\"%s\",worker=\"%zu\"} %.9g\n", name, pool.c_str(), worker, value);
+        out += buf;
+    }
+
+    inline void appendWakeupMetric(std::string &out, const std::string &pool, std::size_t worker, const char *phase, uint64_t value)
+    {
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), "threadpool_worker_wakeups_total{pool=\"%s\",worker=\"%zu\",phase=\"%s\"} %llu\n",
+                      pool.c_str(), worker, phase, (unsigned long long)value);
+        out += buf;
+    }
+
+    // 租户名由用户给出，长度不限，不经过固定大小的缓冲区；pool 已经转义过
+    inline void appendTenantMetric(std::string &out, const char *name, const std::string &pool, const std::string &tenant, double value)
+    {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "\"} %.9g\n", value);
+        out += name;
+        out += "{pool=\"";
+        out += pool;
+        out += "\",tenant=\"";
+        out += escapeLabel(tenant);
+        out += buf;
+    }
+
+    // 直方图导出为 Prometheus 的 summary，单位秒
+    inline void appendSummary(std::string &out, const char *name, const char *help, const std::string &pool, const HistogramSnapshot &h)
+    {
+        static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s summary\n", name, help, name);
+        out += buf;
+        for (double q : QUANTILES)
+        {
+            std::snprintf(buf, sizeof(buf), "%s{pool=\"%s\",quantile=\"%g\"} %.9f\n", name, pool.c_str(), q, (double)h.percentile(q) / 1e9);
+            out += buf;
+        }
+        std::snprintf(buf, sizeof(buf), "%s_sum{pool=\"%s\"} %.9f\n%s_count{pool=\"%s\"} %llu\n",
+                      name, pool.c_str(), (double)h.sum_ / 1e9, name, pool.c_str(), (unsigned long long)h.count_);
+        out += buf;
+    }
+}
+
+// 统计快照格式化为 Prometheus 文本格式，poolName 作为标签区分同一进程里的多个线程池，标签值会被转义
+inline std::string formatPrometheus(const PoolStats &stats, const std::string &poolName = "threadpool")
+{
+    const std::string pool = detail::escapeLabel(poolName);
+    std::string out;
+    out += "# HELP threadpool_tasks_submitted_total Tasks accepted by the pool.\n# TYPE threadpool_tasks_submitted_total counter\n";
+    detail::appendMetric(out, "threadpool_tasks_submitted_total{pool=\"%s\"} %.9g\n", pool, (double)stats.submitted_);
+    out += "# HELP threadpool_tasks_rejected_total Tasks rejected because the queue was full.\n# TYPE threadpool_tasks_rejected_total counter\n";
+    detail::appendMetric(out, "threadpool_tasks_rejected_total{pool=\"%s\"} %.9g\n", pool, (double)stats.rejected_);
+    out += "# HELP threadpool_queue_depth Tasks waiting to run.\n# TYPE threadpool_queue_depth gauge\n";
+    detail::appendMetric(out, "threadpool_queue_depth{pool=\"%s\"} %.9g\n", pool, (double)stats.queueDepth_);
+    out += "# HELP threadpool_queue_depth_high_water Highest queue depth seen.\n# TYPE threadpool_queue_depth_high_water gauge\n";
+    detail::appendMetric(out, "threadpool_queue_depth_high_water{pool=\"%s\"} %.9g\n", pool, (double)stats.queueHighWater_);
+    out += "# HELP threadpool_threads Worker threads.\n# TYPE threadpool_threads gauge\n";
+    detail::appendMetric(out, "threadpool_threads{pool=\"%s\"} %.9g\n", pool, (double)stats.threads_);
+    out += "# HELP threadpool_idle_threads Idle worker threads.\n# TYPE threadpool_idle_threads gauge\n";
+    detail::appendMetric(out, "threadpool_idle_threads{pool=\"%s\"} %.9g\n", pool, (double)stats.idleThreads_);
+
+    out += "# HELP threadpool_worker_tasks_executed_total Tasks executed by each worker.\n# TYPE threadpool_worker_tasks_executed_total counter\n";
+    for (const WorkerStats &w : stats.workers_)
+        detail::appendWorkerMetric(out, "threadpool_worker_tasks_executed_total", pool, w.index_, (double)w.executed_);
+    out += "# HELP threadpool_worker_tasks_stolen_total Tasks each worker stole from other workers.\n# TYPE threadpool_worker_tasks_stolen_total counter\n";
+    for (const WorkerStats &w : stats.workers_)
+        detail::appendWorkerMetric(out, "threadpool_worker_tasks_stolen_total", pool, w.index_, (double)w.stolen_);
+    out += "# HELP threadpool_worker_busy_seconds_total Time each worker spent running tasks.\n# TYPE threadpool_worker_busy_seconds_total counter\n";
+    for (const WorkerStats &w : stats.workers_)
+        detail::appendWorkerMetric(out, "threadpool_worker_busy_seconds_total", pool, w.index_, (double)w.busy_.count() / 1e9);
+    out += "# HELP threadpool_worker_idle_seconds_total Time each worker spent parked.\n# TYPE threadpool_worker_idle_seconds_total counter\n";
+    for (const WorkerStats &w : stats.workers_)
+        detail::appendWorkerMetric(out, "threadpool_worker_idle_seconds_total", pool, w.index_, (double)w.idle_.count() / 1e9);
+    out += "# HELP threadpool_worker_wakeups_total Idle waits that ended with work, by idle phase (spin, yield, park).\n# TYPE threadpool_worker_wakeups_total counter\n";
+    for (const WorkerStats &w : stats.workers_)
+    {
+        detail::appendWakeupMetric(out, pool, w.index_, "spin", w.spinWakeups_);
+        detail::appendWakeupMetric(out, pool, w.index_, "yield", w.yieldWakeups_);
+        detail::appendWakeupMetric(out, pool, w.index_, "park", w.parkWakeups_);
+    }
+
+    if (!stats.tenants_.empty())
+    {
+        out += "# HELP threadpool_tenant_queue_depth Tasks waiting in each tenant queue.\n# TYPE threadpool_tenant_queue_depth gauge\n";
+        for (const TenantStats &t : stats.tenants_)
+            detail::appendTenantMetric(out, "threadpool_tenant_queue_depth", pool, t.name_, (double)t.queued_);
+        out += "# HELP threadpool_tenant_tasks_executed_total Tasks executed for each tenant.\n# TYPE threadpool_tenant_tasks_executed_total counter\n";
+        for (const TenantStats &t : stats.tenants_)
+            detail::appendTenantMetric(out, "threadpool_tenant_tasks_executed_total", pool, t.name_, (double)t.executed_);
+        out += "# HELP threadpool_tenant_busy_seconds_total Worker time spent on each tenant.\n# TYPE threadpool_tenant_busy_seconds_total counter\n";
+        for (const TenantStats &t : stats.tenants_)
+            detail::appendTenantMetric(out, "threadpool_tenant_busy_seconds_total", pool, t.name_, (double)t.busyNs_ / 1e9);
+    }
+
+    detail::appendSummary(out, "threadpool_queue_wait_seconds", "Time from submit to start of execution.", pool, stats.queueWait_);
+    detail::appendSummary(out, "threadpool_task_execution_seconds", "Task execution time.", pool, stats.execTime_);
+    return out;
+}
+
+// 写到 path：先写临时文件再改名，node_exporter 这类读取方不会读到写了一半的文件
+inline bool writePrometheusFile(const PoolStats &stats, const std::string &path, const std::string &pool = "threadpool")
+{
+    std::string text = formatPrometheus(stats, pool);
+    std::string tmp = path + ".tmp";
+    FILE *fp = std::fopen(tmp.c_str(), "w");
+    if (fp == nullptr)
+        return false;
+    bool ok = std::fwrite(text.data(), 1, text.size(), fp) == text.size();
+    ok = std::fclose(fp) == 0 && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+#endif
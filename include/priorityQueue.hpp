@@ -0,0 +1,206 @@
+#ifndef PRIORITY_QUEUE_HPP
+#define PRIORITY_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <mpmcQueue.hpp>
+
+// 任务优先级
+enum class TaskPriority
+{
+    PRIORITY_HIGH,   // 延迟敏感的任务
+    PRIORITY_NORMAL, // 默认优先级
+    PRIORITY_LOW     // 后台批处理任务
+};
+
+const int TASK_PRIORITY_LEVELS = 3;
+
+/*
+老化：高优先级的队列一直有任务时，低优先级的任务会被饿死
+每次取任务时，如果有更低优先级的队列不空却被跳过了，它就“变老”一次，
+被跳过 PRIORITY_AGING_LIMIT 次以后，下一次取任务先从它里面取一个，然后重新计数
+这样高优先级任务最多让出 1/PRIORITY_AGING_LIMIT 的调度机会，低优先级任务也不会无限等待
+*/
+const unsigned PRIORITY_AGING_LIMIT = 16;
+
+namespace detail
+{
+    // 按优先级和老化规则选出要取任务的队列，nonEmpty(level) 判断某一级队列是否有任务
+    // 返回 -1 表示所有队列都是空的
+    template <typename Counter, typename NonEmpty>
+    int selectLevel(Counter *skipped, NonEmpty nonEmpty)
+    {
+        // 先照顾等待太久的低优先级队列
+        for (int level = TASK_PRIORITY_LEVELS - 1; level > 0; level--)
+        {
+            if (skipped[level] >= PRIORITY_AGING_LIMIT && nonEmpty(level))
+            {
+                skipped[level] = 0;
+                return level;
+            }
+        }
+        for (int level = 0; level < TASK_PRIORITY_LEVELS; level++)
+        {
+            if (!nonEmpty(level))
+                continue;
+            // 比选中的队列优先级低、又有任务的队列，这次被跳过了
+            for (int lower = level + 1; lower < TASK_PRIORITY_LEVELS; lower++)
+            {
+                if (nonEmpty(lower))
+                    skipped[lower]++;
+            }
+            return level;
+        }
+        return -1;
+    }
+}
+
+/*
+多级任务队列，在 taskQueueMtx_ 保护下使用，本身不是线程安全的
+每个优先级一个先进先出队列，同一优先级内的任务保持提交顺序
+*/
+template <typename T>
+class PriorityTaskQueue
+{
+public:
+    PriorityTaskQueue() : size_(0)
+    {
+        for (int i = 0; i < TASK_PRIORITY_LEVELS; i++)
+            skipped_[i] = 0;
+    }
+
+    void emplace(T &&item, TaskPriority priority = TaskPriority::PRIORITY_NORMAL)
+    {
+        queues_[(int)priority].emplace_back(std::move(item));
+        size_++;
+    }
+
+    // 取出下一个要执行的任务，priority 返回它的优先级
+    bool pop(T &item, TaskPriority *priority = nullptr)
+    {
+        int level = detail::selectLevel(skipped_, [this](int l) -> bool
+                                        { return !queues_[l].empty(); });
+        if (level < 0)
+            return false;
+        item = std::move(queues_[level].front());
+        queues_[level].pop_front();
+        size_--;
+        if (priority != nullptr)
+            *priority = (TaskPriority)level;
+        return true;
+    }
+
+    // 队列满时给优先级为 priority 的新任务腾出位置：从最低优先级往上找，
+    // 丢弃第一个不比新任务重要的非空队列里最早的任务，没有这样的任务返回false
+    bool popOldest(T &item, TaskPriority priority, TaskPriority *popped = nullptr)
+    {
+        for (int level = TASK_PRIORITY_LEVELS - 1; level >= (int)priority; level--)
+        {
+            if (queues_[level].empty())
+                continue;
+            item = std::move(queues_[level].front());
+            queues_[level].pop_front();
+            size_--;
+            if (popped != nullptr)
+                *popped = (TaskPriority)level;
+            return true;
+        }
+        return false;
+    }
+
+    // 所有优先级的任务总数
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+private:
+    std::deque<T> queues_[TASK_PRIORITY_LEVELS];
+    unsigned skipped_[TASK_PRIORITY_LEVELS];
+    std::size_t size_;
+};
+
+/*
+无锁模式下的多级任务队列：每个优先级一个无锁环形队列，每一级的容量都是 capacity
+取任务时用队列的近似大小判断是否为空，老化计数也是近似的，只影响公平性，不影响正确性
+*/
+template <typename T>
+class LockFreePriorityQueue
+{
+public:
+    explicit LockFreePriorityQueue(std::size_t capacity)
+    {
+        for (int i = 0; i < TASK_PRIORITY_LEVELS; i++)
+        {
+            queues_[i].reset(new MpmcQueue<T>(capacity));
+            skipped_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // 只有成功放入时才会移走item
+    bool tryPush(T &&item, TaskPriority priority = TaskPriority::PRIORITY_NORMAL)
+    {
+        return queues_[(int)priority]->tryPush(std::move(item));
+    }
+
+    bool tryPop(T &item, TaskPriority *priority = nullptr)
+    {
+        int level = detail::selectLevel(skipped_, [this](int l) -> bool
+                                        { return !queues_[l]->empty(); });
+        if (level < 0)
+            return false;
+        if (queues_[level]->tryPop(item))
+        {
+            if (priority != nullptr)
+                *priority = (TaskPriority)level;
+            return true;
+        }
+        // 看到的任务被别的线程取走了（或者还没有写完），按优先级把每一级都试一次
+        for (int l = 0; l < TASK_PRIORITY_LEVELS; l++)
+        {
+            if (l != level && queues_[l]->tryPop(item))
+            {
+                if (priority != nullptr)
+                    *priority = (TaskPriority)l;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 从某一级队列取出最早的任务，队列满时丢弃最早的任务用（每一级单独计算容量）
+    bool tryPopLevel(T &item, TaskPriority priority)
+    {
+        return queues_[(int)priority]->tryPop(item);
+    }
+
+    // 某一级队列是否已满
+    bool full(TaskPriority priority) const
+    {
+        const MpmcQueue<T> &queue = *queues_[(int)priority];
+        return queue.size() >= queue.capacity();
+    }
+
+    // 近似的任务总数
+    std::size_t size() const
+    {
+        std::size_t size = 0;
+        for (int i = 0; i < TASK_PRIORITY_LEVELS; i++)
+            size += queues_[i]->size();
+        return size;
+    }
+
+private:
+    std::unique_ptr<MpmcQueue<T>> queues_[TASK_PRIORITY_LEVELS];
+    std::atomic<unsigned> skipped_[TASK_PRIORITY_LEVELS];
+};
+
+#endif
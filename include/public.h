@@ -1,3 +1,4 @@
-#define LOG(str) \
-    std::cout << "LOG: " << str << ";" << __FILE__ << ";" << __TIMESTAMP__ << std::endl;
-    
\ No newline at end of file
+#include <logger.hpp>
+
+// 兼容原来的写法，LOG 等同于 INFO 级别的异步日志
+#define LOG(str) LOG_INFO(str)
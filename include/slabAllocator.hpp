@@ -0,0 +1,312 @@
+#ifndef SLAB_ALLOCATOR_HPP
+#define SLAB_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/*
+提交任务时需要的小对象（Future的共享状态、Result、Any保存的返回值、放不进 TaskFunction 内部的函数对象）
+大小固定、数量多，并且经常在一个线程分配（提交任务的线程）、在另一个线程释放（执行任务的线程）
+这里按大小分级，每个线程为每一级缓存一些释放掉的对象，稳定运行时提交任务不需要调用 malloc
+
+线程池通过 setAllocator 指定内存来源，默认 slabResource()；用 ASan、valgrind 查内存问题时可以换成 heapResource()
+*/
+class MemoryResource
+{
+public:
+    virtual ~MemoryResource() = default;
+
+    // 分配 size 字节、按 align 对齐的内存
+    virtual void *allocate(std::size_t size, std::size_t align) = 0;
+
+    // 释放内存，size 和 align 必须和分配时一样
+    virtual void deallocate(void *p, std::size_t size, std::size_t align) = 0;
+};
+
+// 不超过这个大小、对齐要求不超过 SLAB_ALIGN 的对象走分级缓存，更大的直接用 operator new
+const std::size_t SLAB_MAX_SIZE = 256;
+const std::size_t SLAB_ALIGN = alignof(std::max_align_t);
+
+namespace detail
+{
+    /*
+    大小分级的空闲链表，每一级对象大小是 SLAB_ALIGN 的整数倍
+    每个线程缓存一些释放掉的对象，线程缓存满了以后把一批对象还给这一级全局的仓库，
+    缓存空了再从仓库整批取回，加锁的次数是每 BATCH_SIZE 个对象一次
+    线程缓存和仓库都有上限，突发的大量任务结束以后多出来的内存还给系统，占用的内存不会一直增长
+    */
+    class SlabCache
+    {
+    public:
+        static const std::size_t CLASS_COUNT = SLAB_MAX_SIZE / SLAB_ALIGN;
+
+        // size 对应的级别，超过 SLAB_MAX_SIZE 时返回 CLASS_COUNT
+        static std::size_t sizeClass(std::size_t size)
+        {
+            if (size == 0)
+                size = 1;
+            if (size > SLAB_MAX_SIZE)
+                return CLASS_COUNT;
+            return (size - 1) / SLAB_ALIGN;
+        }
+
+        static void *allocate(std::size_t sizeClass)
+        {
+            Local *local = Local::current();
+            if (local != nullptr)
+            {
+                FreeList &list = local->lists_[sizeClass];
+                if (list.head_ == nullptr)
+                    list.refill(sizeClass);
+                if (list.head_ != nullptr)
+                {
+                    Node *node = list.head_;
+                    list.head_ = node->next_;
+                    list.count_--;
+                    return node;
+                }
+            }
+            return ::operator new(classSize(sizeClass));
+        }
+
+        static void deallocate(void *p, std::size_t sizeClass)
+        {
+            Local *local = Local::current();
+            // 线程退出时线程缓存已经析构，直接还给系统
+            if (local == nullptr)
+            {
+                ::operator delete(p);
+                return;
+            }
+            FreeList &list = local->lists_[sizeClass];
+            Node *node = static_cast<Node *>(p);
+            node->next_ = list.head_;
+            list.head_ = node;
+            list.count_++;
+            if (list.count_ >= 2 * BATCH_SIZE)
+                list.flush(sizeClass, BATCH_SIZE);
+        }
+
+    private:
+        static const std::size_t BATCH_SIZE = 64;
+        static const std::size_t MAX_DEPOT_BATCHES = 64;
+
+        static std::size_t classSize(std::size_t sizeClass)
+        {
+            return (sizeClass + 1) * SLAB_ALIGN;
+        }
+
+        struct Node
+        {
+            Node *next_;
+        };
+
+        // 全局仓库，每一级一个，保存整批的空闲对象
+        struct Depot
+        {
+            std::mutex mtx_;
+            std::vector<Node *> batches_;
+        };
+
+        // 线程退出时线程缓存还会访问仓库，所以仓库不析构
+        static Depot &depot(std::size_t sizeClass)
+        {
+            static Depot *depots = new Depot[CLASS_COUNT];
+            return depots[sizeClass];
+        }
+
+        static void freeChain(Node *node)
+        {
+            while (node != nullptr)
+            {
+                Node *next = node->next_;
+                ::operator delete(node);
+                node = next;
+            }
+        }
+
+        struct FreeList
+        {
+            FreeList() : head_(nullptr), count_(0)
+            {
+            }
+
+            // 从链表头部摘下n个对象，整批放入仓库
+            void flush(std::size_t sizeClass, std::size_t n)
+            {
+                Node *batch = head_;
+                Node *tail = head_;
+                for (std::size_t i = 1; i < n; i++)
+                    tail = tail->next_;
+                head_ = tail->next_;
+                tail->next_ = nullptr;
+                count_ -= n;
+
+                Depot &d = depot(sizeClass);
+                {
+                    std::lock_guard<std::mutex> lock(d.mtx_);
+                    if (d.batches_.size() < MAX_DEPOT_BATCHES)
+                    {
+                        d.batches_.push_back(batch);
+                        return;
+                    }
+                }
+                // 仓库也满了，内存还给系统
+                freeChain(batch);
+            }
+
+            // 从仓库整批取回对象
+            void refill(std::size_t sizeClass)
+            {
+                Depot &d = depot(sizeClass);
+                std::lock_guard<std::mutex> lock(d.mtx_);
+                if (d.batches_.empty())
+                    return;
+                head_ = d.batches_.back();
+                d.batches_.pop_back();
+                count_ = BATCH_SIZE;
+            }
+
+            Node *head_;
+            std::size_t count_;
+        };
+
+        // 一个线程的所有级别的缓存
+        struct Local
+        {
+            // 线程退出，缓存的对象整批还给仓库，给其他线程使用，零头还给系统
+            ~Local()
+            {
+                dead() = true;
+                for (std::size_t i = 0; i < CLASS_COUNT; i++)
+                {
+                    FreeList &list = lists_[i];
+                    while (list.count_ >= BATCH_SIZE)
+                        list.flush(i, BATCH_SIZE);
+                    freeChain(list.head_);
+                }
+            }
+
+            // 当前线程的缓存，线程退出过程中缓存已经析构时返回nullptr
+            static Local *current()
+            {
+                if (dead())
+                    return nullptr;
+                static thread_local Local local;
+                return &local;
+            }
+
+            // 缓存是否已经析构；bool 类型的 thread_local 没有析构，缓存析构以后还能读
+            static bool &dead()
+            {
+                static thread_local bool value = false;
+                return value;
+            }
+
+            FreeList lists_[CLASS_COUNT];
+        };
+    };
+}
+
+// 默认的内存来源：大小分级的线程缓存
+class SlabResource : public MemoryResource
+{
+public:
+    void *allocate(std::size_t size, std::size_t align) override
+    {
+        std::size_t sizeClass = detail::SlabCache::sizeClass(size);
+        if (sizeClass == detail::SlabCache::CLASS_COUNT || align > SLAB_ALIGN)
+            return ::operator new(size);
+        return detail::SlabCache::allocate(sizeClass);
+    }
+
+    void deallocate(void *p, std::size_t size, std::size_t align) override
+    {
+        std::size_t sizeClass = detail::SlabCache::sizeClass(size);
+        if (sizeClass == detail::SlabCache::CLASS_COUNT || align > SLAB_ALIGN)
+        {
+            ::operator delete(p);
+            return;
+        }
+        detail::SlabCache::deallocate(p, sizeClass);
+    }
+};
+
+// 直接使用 operator new / delete
+class HeapResource : public MemoryResource
+{
+public:
+    void *allocate(std::size_t size, std::size_t) override
+    {
+        return ::operator new(size);
+    }
+
+    void deallocate(void *p, std::size_t, std::size_t) override
+    {
+        ::operator delete(p);
+    }
+};
+
+// 进程内唯一的实例，线程退出、程序结束时还可能被使用，所以不析构
+inline MemoryResource *slabResource()
+{
+    static MemoryResource *resource = new SlabResource();
+    return resource;
+}
+
+inline MemoryResource *heapResource()
+{
+    static MemoryResource *resource = new HeapResource();
+    return resource;
+}
+
+// 把 MemoryResource 包装成标准库的分配器，用于 std::allocate_shared 等
+template <typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+
+    PoolAllocator(MemoryResource *resource = slabResource()) : resource_(resource)
+    {
+    }
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &other) : resource_(other.resource())
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T *>(resource_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n)
+    {
+        resource_->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    MemoryResource *resource() const
+    {
+        return resource_;
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U> &other) const
+    {
+        return resource_ == other.resource();
+    }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U> &other) const
+    {
+        return resource_ != other.resource();
+    }
+
+private:
+    MemoryResource *resource_;
+};
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef TASK_FUNCTION_HPP
+#define TASK_FUNCTION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <slabAllocator.hpp>
+
+/*
+线程池任务的函数对象类型，替代 std::function<void()>
+1. 只能移动，不能拷贝：可以保存 unique_ptr 等只能移动的对象
+2. 小对象优化：不超过 INLINE_SIZE 字节的函数对象直接保存在对象内部，不需要堆内存
+   （捕获几个int、一个指针这种常见任务提交时没有任何堆内存分配），
+   更大的函数对象才会放在堆上（从 slabResource() 的线程缓存分配）
+3. 只能调用一次语义，调用后里面的对象依然保留，直到TaskFunction析构或被覆盖
+*/
+class TaskFunction
+{
+public:
+    static const std::size_t INLINE_SIZE = 48;
+
+    TaskFunction() : ops_(nullptr), enqueueTime_(0)
+    {
+    }
+
+    TaskFunction(std::nullptr_t) : ops_(nullptr), enqueueTime_(0)
+    {
+    }
+
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, TaskFunction>::value>::type>
+    TaskFunction(F &&f) : ops_(nullptr), enqueueTime_(0)
+    {
+        typedef typename std::decay<F>::type Fn;
+        init<Fn>(std::forward<F>(f), std::integral_constant<bool, fitsInline<Fn>()>());
+    }
+
+    TaskFunction(TaskFunction &&other) noexcept : ops_(other.ops_), enqueueTime_(other.enqueueTime_)
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->move(&storage_, &other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    TaskFunction &operator=(TaskFunction &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            ops_ = other.ops_;
+            enqueueTime_ = other.enqueueTime_;
+            if (ops_ != nullptr)
+            {
+                ops_->move(&storage_, &other.storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    TaskFunction &operator=(std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+
+    TaskFunction(const TaskFunction &) = delete;
+    TaskFunction &operator=(const TaskFunction &) = delete;
+
+    ~TaskFunction()
+    {
+        reset();
+    }
+
+    void operator()()
+    {
+        ops_->invoke(&storage_);
+    }
+
+    // 不执行任务，直接丢弃：函数对象有 cancel() 成员时调用它（比如让任务的Future得到 TaskCancelled）然后丢弃，返回true
+    // 没有 cancel() 的函数对象（协程恢复、任务图的节点等，丢弃以后等待的一方永远等不到）保持不变，返回false，调用方应该执行它
+    bool cancel()
+    {
+        if (ops_ == nullptr || !ops_->cancel(&storage_))
+            return false;
+        reset();
+        return true;
+    }
+
+    explicit operator bool() const
+    {
+        return ops_ != nullptr;
+    }
+
+    // 放入任务队列的时间（纳秒），线程池打开统计时用来计算排队时间
+    void setEnqueueTime(int64_t ns) { enqueueTime_ = ns; }
+    int64_t enqueueTime() const { return enqueueTime_; }
+
+    friend bool operator==(const TaskFunction &f, std::nullptr_t) { return f.ops_ == nullptr; }
+    friend bool operator!=(const TaskFunction &f, std::nullptr_t) { return f.ops_ != nullptr; }
+
+private:
+    // 类型擦除：每种函数对象类型对应一张静态的操作表
+    struct Ops
+    {
+        void (*invoke)(void *self);
+        void (*move)(void *dst, void *src); // 移动构造到dst，并析构src
+        void (*destroy)(void *self);
+        bool (*cancel)(void *self);
+    };
+
+    template <typename Fn>
+    static auto cancelTarget(Fn &fn, int) -> decltype(fn.cancel(), bool())
+    {
+        fn.cancel();
+        return true;
+    }
+
+    template <typename Fn>
+    static bool cancelTarget(Fn &, long)
+    {
+        return false;
+    }
+
+    typedef typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type Storage;
+
+    template <typename Fn>
+    static constexpr bool fitsInline()
+    {
+        return sizeof(Fn) <= INLINE_SIZE && alignof(Fn) <= alignof(Storage) && std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    // 函数对象直接保存在storage_里面
+    template <typename Fn>
+    struct InlineOps
+    {
+        static void invoke(void *self) { (*static_cast<Fn *>(self))(); }
+        static void move(void *dst, void *src)
+        {
+            Fn *from = static_cast<Fn *>(src);
+            new (dst) Fn(std::move(*from));
+            from->~Fn();
+        }
+        static void destroy(void *self) { static_cast<Fn *>(self)->~Fn(); }
+        static bool cancel(void *self) { return cancelTarget(*static_cast<Fn *>(self), 0); }
+        static const Ops *table()
+        {
+            static const Ops ops = {&InlineOps::invoke, &InlineOps::move, &InlineOps::destroy, &InlineOps::cancel};
+            return &ops;
+        }
+    };
+
+    // 函数对象放在堆上，storage_里面只保存指针
+    template <typename Fn>
+    struct HeapOps
+    {
+        static Fn *&ptr(void *self) { return *static_cast<Fn **>(self); }
+        static void invoke(void *self) { (*ptr(self))(); }
+        static void move(void *dst, void *src)
+        {
+            new (dst) Fn *(ptr(src));
+            ptr(src) = nullptr;
+        }
+        static void destroy(void *self)
+        {
+            ptr(self)->~Fn();
+            slabResource()->deallocate(ptr(self), sizeof(Fn), alignof(Fn));
+        }
+        static bool cancel(void *self) { return cancelTarget(*ptr(self), 0); }
+        static const Ops *table()
+        {
+            static const Ops ops = {&HeapOps::invoke, &HeapOps::move, &HeapOps::destroy, &HeapOps::cancel};
+            return &ops;
+        }
+    };
+
+    template <typename Fn, typename F>
+    void init(F &&f, std::true_type)
+    {
+        new (&storage_) Fn(std::forward<F>(f));
+        ops_ = InlineOps<Fn>::table();
+    }
+
+    template <typename Fn, typename F>
+    void init(F &&f, std::false_type)
+    {
+        void *p = slabResource()->allocate(sizeof(Fn), alignof(Fn));
+        try
+        {
+            new (&storage_) Fn *(new (p) Fn(std::forward<F>(f)));
+        }
+        catch (...)
+        {
+            slabResource()->deallocate(p, sizeof(Fn), alignof(Fn));
+            throw;
+        }
+        ops_ = HeapOps<Fn>::table();
+    }
+
+    void reset()
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    Storage storage_;
+    const Ops *ops_;
+    int64_t enqueueTime_; // 放在 ops_ 后面的对齐填充里，不增加对象大小
+};
+
+#endif
@@ -0,0 +1,689 @@
+#ifndef TASK_FUTURE_HPP
+#define TASK_FUTURE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <completion.hpp>
+#include <cancellation.hpp>
+#include <slabAllocator.hpp>
+#include <taskFunction.hpp>
+#include <waitHelper.hpp>
+
+/*
+ThreadPool2::submitTask 的返回值类型，替代 std::packaged_task + std::future
+std::packaged_task 的共享状态、std::function 的堆内存、std::bind 每次提交都要分配，
+这里 Promise 和 Future 共享一个侵入式引用计数的状态对象，状态对象从线程池指定的 MemoryResource 分配
+（默认是每个线程自己的空闲链表，见 slabAllocator.hpp），稳定运行时提交任务不会调用 malloc
+*/
+namespace detail
+{
+    // 结果的存储：普通类型、引用类型、void
+    template <typename T>
+    class ValueStorage
+    {
+    public:
+        ValueStorage() : hasValue_(false)
+        {
+        }
+        ~ValueStorage()
+        {
+            if (hasValue_)
+                ptr()->~T();
+        }
+        template <typename U>
+        void set(U &&value)
+        {
+            new (&storage_) T(std::forward<U>(value));
+            hasValue_ = true;
+        }
+        T take() { return std::move(*ptr()); }
+
+    private:
+        T *ptr() { return reinterpret_cast<T *>(&storage_); }
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+        bool hasValue_;
+    };
+
+    template <typename T>
+    class ValueStorage<T &>
+    {
+    public:
+        ValueStorage() : ptr_(nullptr)
+        {
+        }
+        void set(T &value) { ptr_ = &value; }
+        T &take() { return *ptr_; }
+
+    private:
+        T *ptr_;
+    };
+
+    // void类型用 setValue(nullptr) 表示完成
+    template <>
+    class ValueStorage<void>
+    {
+    public:
+        void set(std::nullptr_t) {}
+        void take() {}
+    };
+
+    // Promise和Future共享的状态，同时记录任务是否开始执行、是否被取消
+    template <typename T>
+    class FutureState : public CancelState
+    {
+    public:
+        explicit FutureState(MemoryResource *resource) : refs_(2), contState_(CONT_NONE), resource_(resource)
+        {
+        }
+
+        static FutureState *create(MemoryResource *resource)
+        {
+            return new (resource->allocate(sizeof(FutureState), alignof(FutureState))) FutureState(resource);
+        }
+
+        void release()
+        {
+            if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                MemoryResource *resource = resource_;
+                this->~FutureState();
+                resource->deallocate(this, sizeof(FutureState), alignof(FutureState));
+            }
+        }
+
+        // 任务还没开始时取消：直接完成，Future 得到 TaskCancelled；已经开始时请求停止，返回false
+        bool cancel()
+        {
+            if (!tryCancel())
+                return false;
+            exception_ = std::make_exception_ptr(TaskCancelled());
+            markReady();
+            return true;
+        }
+
+        // 结果（或者异常）已经写入之后调用
+        void markReady()
+        {
+            done_.post();
+            if (contState_.exchange(CONT_READY, std::memory_order_acq_rel) == CONT_SET)
+                runContinuation();
+        }
+
+        // 注册完成之后要执行的后续操作（只能注册一次），已经完成的话立即执行
+        // 两边都用 exchange：注册和完成谁后到，谁负责执行
+        void setContinuation(TaskFunction &&continuation)
+        {
+            continuation_ = std::move(continuation);
+            if (contState_.exchange(CONT_SET, std::memory_order_acq_rel) == CONT_READY)
+                runContinuation();
+        }
+
+        bool isReady() const
+        {
+            return done_.isDone();
+        }
+
+        // 工作线程等待时帮忙执行其他任务
+        void wait()
+        {
+            helpWait(done_);
+        }
+
+        template <typename Rep, typename Period>
+        bool waitFor(const std::chrono::duration<Rep, Period> &timeout)
+        {
+            return done_.waitFor(timeout);
+        }
+
+        ValueStorage<T> value_;
+        std::exception_ptr exception_;
+
+    private:
+        static const uint32_t CONT_NONE = 0;
+        static const uint32_t CONT_SET = 1;
+        static const uint32_t CONT_READY = 2;
+
+        void runContinuation()
+        {
+            TaskFunction continuation = std::move(continuation_);
+            continuation();
+        }
+
+        std::atomic_int refs_;
+        Completion done_;
+        std::atomic<uint32_t> contState_;
+        TaskFunction continuation_;
+        MemoryResource *resource_; // 状态对象的内存来源，释放时还给它
+    };
+
+    template <std::size_t... I>
+    struct IndexSeq
+    {
+    };
+
+    template <std::size_t N, std::size_t... I>
+    struct MakeIndexSeq : MakeIndexSeq<N - 1, N - 1, I...>
+    {
+    };
+
+    template <std::size_t... I>
+    struct MakeIndexSeq<0, I...>
+    {
+        typedef IndexSeq<I...> type;
+    };
+
+    // 函数对象能否以 (CancellationToken, 参数...) 调用，能的话执行时传入任务的 CancellationToken
+    template <typename Func, typename... Args>
+    struct AcceptsToken
+    {
+        template <typename F>
+        static auto test(int) -> decltype(std::declval<F &>()(std::declval<CancellationToken>(), std::declval<Args>()...), std::true_type());
+        template <typename F>
+        static std::false_type test(...);
+
+        static const bool value = decltype(test<Func>(0))::value;
+    };
+
+    template <bool Token, typename Func, typename... Args>
+    struct TaskResult
+    {
+        typedef typename std::result_of<Func(Args...)>::type type;
+    };
+
+    template <typename Func, typename... Args>
+    struct TaskResult<true, Func, Args...>
+    {
+        typedef typename std::result_of<Func(CancellationToken, Args...)>::type type;
+    };
+}
+
+template <typename T>
+class Future;
+
+namespace detail
+{
+    template <typename T, typename R, typename F>
+    class ThenTask;
+
+    template <typename T, typename R, typename F, typename Executor>
+    class ThenContinuation;
+
+    // then 的函数以前一个任务的返回值为参数，void任务的后续函数没有参数
+    template <typename F, typename T>
+    struct ThenResult
+    {
+        typedef typename std::result_of<typename std::decay<F>::type(T)>::type type;
+    };
+
+    template <typename F>
+    struct ThenResult<F, void>
+    {
+        typedef typename std::result_of<typename std::decay<F>::type()>::type type;
+    };
+}
+
+// 任务执行的一端，写入任务的返回值或者异常
+template <typename T>
+class Promise
+{
+public:
+    // 共享状态从 resource 分配，resource 要比 Promise 和 Future 都活得长
+    explicit Promise(MemoryResource *resource = slabResource()) : state_(detail::FutureState<T>::create(resource)), futureRetrieved_(false)
+    {
+    }
+
+    Promise(Promise &&other) noexcept : state_(other.state_), futureRetrieved_(other.futureRetrieved_)
+    {
+        other.state_ = nullptr;
+    }
+
+    Promise &operator=(Promise &&other) noexcept
+    {
+        if (this != &other)
+        {
+            abandon();
+            state_ = other.state_;
+            futureRetrieved_ = other.futureRetrieved_;
+            other.state_ = nullptr;
+        }
+        return *this;
+    }
+
+    Promise(const Promise &) = delete;
+    Promise &operator=(const Promise &) = delete;
+
+    ~Promise()
+    {
+        abandon();
+    }
+
+    // 只能获取一次，Future持有状态的另一份引用
+    Future<T> getFuture();
+
+    // 已经被取消时不写入，直接放弃
+    template <typename U>
+    void setValue(U &&value)
+    {
+        if (!state_->claim())
+        {
+            drop();
+            return;
+        }
+        state_->value_.set(std::forward<U>(value));
+        finish();
+    }
+
+    void setException(std::exception_ptr e)
+    {
+        if (!state_->claim())
+        {
+            drop();
+            return;
+        }
+        state_->exception_ = e;
+        finish();
+    }
+
+    // 开始执行任务，任务已经通过 Future::cancel 取消时返回false，不需要再执行
+    bool start()
+    {
+        return state_->claim();
+    }
+
+    // 任务没有执行就被取消（线程池以 SHUTDOWN_CANCEL_PENDING 方式关闭），Future 得到 TaskCancelled
+    void cancel()
+    {
+        if (state_ != nullptr)
+            state_->cancel();
+    }
+
+    // 线程池 SHUTDOWN_ABORT 时设置的标志，任务的 CancellationToken 也会检查它
+    void setPoolStop(const std::atomic_bool *poolStop)
+    {
+        state_->resetCancel(poolStop);
+    }
+
+    // 传给任务函数的 CancellationToken
+    CancellationToken token() const
+    {
+        return CancellationToken(state_);
+    }
+
+private:
+    void finish()
+    {
+        state_->markReady();
+        drop();
+    }
+
+    void drop()
+    {
+        state_->release();
+        state_ = nullptr;
+    }
+
+    // 任务没有执行就被销毁了（比如线程池被强制关闭），让等待的一方得到 broken_promise
+    void abandon()
+    {
+        if (state_ == nullptr)
+            return;
+        if (!futureRetrieved_)
+        {
+            // Future从来没有被取出，状态对象的另一份引用也要释放
+            state_->release();
+        }
+        setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+    }
+
+    template <typename U>
+    friend class Promise;
+    friend class Future<T>;
+
+    detail::FutureState<T> *state_;
+    bool futureRetrieved_;
+};
+
+// 用户持有的一端，获取任务的返回值
+template <typename T>
+class Future
+{
+public:
+    Future() : state_(nullptr)
+    {
+    }
+
+    Future(Future &&other) noexcept : state_(other.state_)
+    {
+        other.state_ = nullptr;
+    }
+
+    Future &operator=(Future &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (state_ != nullptr)
+                state_->release();
+            state_ = other.state_;
+            other.state_ = nullptr;
+        }
+        return *this;
+    }
+
+    Future(const Future &) = delete;
+    Future &operator=(const Future &) = delete;
+
+    ~Future()
+    {
+        if (state_ != nullptr)
+            state_->release();
+    }
+
+    bool valid() const
+    {
+        return state_ != nullptr;
+    }
+
+    // 任务是否已经执行完成，不阻塞
+    bool isReady() const
+    {
+        return state_ != nullptr && state_->isReady();
+    }
+
+    // 取消任务：还没开始执行时O(1)取消，返回true，之后 get() 抛出 TaskCancelled
+    // 已经开始执行时返回false，只是请求停止，任务通过 CancellationToken 看到以后可以提前返回
+    bool cancel()
+    {
+        return state_ != nullptr && state_->cancel();
+    }
+
+    void wait() const
+    {
+        state_->wait();
+    }
+
+    template <typename Rep, typename Period>
+    std::future_status wait_for(const std::chrono::duration<Rep, Period> &timeout) const
+    {
+        return state_->waitFor(timeout) ? std::future_status::ready : std::future_status::timeout;
+    }
+
+    // 阻塞直到任务执行完成，取出返回值（任务抛出的异常在这里重新抛出），之后Future不再有效
+    T get()
+    {
+        if (state_ == nullptr)
+            throw std::future_error(std::future_errc::no_state);
+        detail::FutureState<T> *state = state_;
+        state_ = nullptr;
+        Releaser guard(state);
+        state->wait();
+        if (state->exception_)
+            std::rethrow_exception(state->exception_);
+        return state->value_.take();
+    }
+
+    /*
+    后续任务：这个Future完成以后，把 func(返回值) 提交到 executor 上执行，返回后续任务的Future
+    不会阻塞任何线程等待；前一个任务抛出的异常直接传给后续任务的Future，func不会被调用
+    executor 需要提供 bool execute(TaskFunction)（比如 ThreadPool2），并且要活到后续任务提交之后
+    调用以后这个Future不再有效
+    */
+    template <typename Executor, typename F>
+    Future<typename detail::ThenResult<F, T>::type> then(Executor &executor, F &&func);
+
+    // 完成以后在完成任务的线程上调用 func()，已经完成的话立即在当前线程调用，之后 get() 不会阻塞
+    // 和 then 一样只能注册一次；协程 co_await Future 时用它挂起
+    template <typename F>
+    void whenReady(F &&func)
+    {
+        state_->setContinuation(TaskFunction(std::forward<F>(func)));
+    }
+
+private:
+    struct Releaser
+    {
+        explicit Releaser(detail::FutureState<T> *state) : state_(state) {}
+        ~Releaser() { state_->release(); }
+        detail::FutureState<T> *state_;
+    };
+
+    explicit Future(detail::FutureState<T> *state) : state_(state)
+    {
+    }
+
+    friend class Promise<T>;
+    template <typename U>
+    friend class Future;
+
+    detail::FutureState<T> *state_;
+};
+
+template <typename T>
+Future<T> Promise<T>::getFuture()
+{
+    if (futureRetrieved_)
+        throw std::future_error(std::future_errc::future_already_retrieved);
+    futureRetrieved_ = true;
+    return Future<T>(state_);
+}
+
+/*
+打包后的任务：保存函数对象、参数和Promise
+参数在执行时以右值传入，所以只能移动的参数（unique_ptr、缓冲区）也可以提交，
+这个对象本身足够小，可以放进 TaskFunction 的内部存储里
+*/
+template <typename R, typename Func, typename... Args>
+class PackagedTask
+{
+public:
+    template <typename F, typename... A>
+    PackagedTask(Promise<R> &&promise, F &&func, A &&...args)
+        : func_(std::forward<F>(func)), args_(std::forward<A>(args)...), promise_(std::move(promise))
+    {
+    }
+
+    void operator()()
+    {
+        // 已经取消的任务留在队列里，取到时直接跳过
+        if (!promise_.start())
+            return;
+        try
+        {
+            fulfill(typename detail::MakeIndexSeq<sizeof...(Args)>::type(), std::is_void<R>(), TakesToken());
+        }
+        catch (...)
+        {
+            promise_.setException(std::current_exception());
+        }
+    }
+
+    // 任务没有执行就被取消
+    void cancel()
+    {
+        promise_.cancel();
+    }
+
+private:
+    typedef std::integral_constant<bool, detail::AcceptsToken<Func, Args...>::value> TakesToken;
+
+    template <std::size_t... I>
+    void fulfill(detail::IndexSeq<I...>, std::false_type, std::false_type)
+    {
+        promise_.setValue(func_(std::move(std::get<I>(args_))...));
+    }
+
+    template <std::size_t... I>
+    void fulfill(detail::IndexSeq<I...>, std::true_type, std::false_type)
+    {
+        func_(std::move(std::get<I>(args_))...);
+        promise_.setValue(nullptr);
+    }
+
+    template <std::size_t... I>
+    void fulfill(detail::IndexSeq<I...>, std::false_type, std::true_type)
+    {
+        promise_.setValue(func_(promise_.token(), std::move(std::get<I>(args_))...));
+    }
+
+    template <std::size_t... I>
+    void fulfill(detail::IndexSeq<I...>, std::true_type, std::true_type)
+    {
+        func_(promise_.token(), std::move(std::get<I>(args_))...);
+        promise_.setValue(nullptr);
+    }
+
+    Func func_;
+    std::tuple<Args...> args_;
+    Promise<R> promise_;
+};
+
+// 以右值参数调用函数对象的返回值类型，函数对象第一个参数是 CancellationToken 时不算在 Args 里
+template <typename Func, typename... Args>
+using TaskResultOf = typename detail::TaskResult<detail::AcceptsToken<typename std::decay<Func>::type, typename std::decay<Args>::type...>::value,
+                                                 typename std::decay<Func>::type, typename std::decay<Args>::type...>::type;
+
+namespace detail
+{
+    // 前一个任务完成后在executor上执行的后续任务，持有前一个任务状态的引用
+    template <typename T, typename R, typename F>
+    class ThenTask
+    {
+    public:
+        ThenTask(FutureState<T> *state, Promise<R> &&promise, F &&func)
+            : state_(state), promise_(std::move(promise)), func_(std::move(func))
+        {
+        }
+
+        ThenTask(ThenTask &&other) noexcept(std::is_nothrow_move_constructible<F>::value)
+            : state_(other.state_), promise_(std::move(other.promise_)), func_(std::move(other.func_))
+        {
+            other.state_ = nullptr;
+        }
+
+        ThenTask(const ThenTask &) = delete;
+
+        ~ThenTask()
+        {
+            if (state_ != nullptr)
+                state_->release();
+        }
+
+        void operator()()
+        {
+            if (!promise_.start())
+                return;
+            try
+            {
+                if (state_->exception_)
+                    promise_.setException(state_->exception_);
+                else
+                    fulfill(std::is_void<T>(), std::is_void<R>());
+            }
+            catch (...)
+            {
+                promise_.setException(std::current_exception());
+            }
+        }
+
+        void cancel()
+        {
+            promise_.cancel();
+        }
+
+    private:
+        void fulfill(std::false_type, std::false_type) { promise_.setValue(func_(state_->value_.take())); }
+        void fulfill(std::true_type, std::false_type) { promise_.setValue(func_()); }
+        void fulfill(std::false_type, std::true_type)
+        {
+            func_(state_->value_.take());
+            promise_.setValue(nullptr);
+        }
+        void fulfill(std::true_type, std::true_type)
+        {
+            func_();
+            promise_.setValue(nullptr);
+        }
+
+        FutureState<T> *state_;
+        Promise<R> promise_;
+        F func_;
+    };
+
+    // 注册在前一个任务状态上的后续操作：前一个任务完成时把 ThenTask 提交到 executor
+    template <typename T, typename R, typename F, typename Executor>
+    class ThenContinuation
+    {
+    public:
+        ThenContinuation(ThenTask<T, R, F> &&task, Executor *executor)
+            : task_(std::move(task)), executor_(executor)
+        {
+        }
+
+        ThenContinuation(ThenContinuation &&other) = default;
+
+        void operator()()
+        {
+            // 队列满提交失败时任务被销毁，后续任务的Future得到 broken_promise
+            executor_->execute(TaskFunction(std::move(task_)));
+        }
+
+    private:
+        ThenTask<T, R, F> task_;
+        Executor *executor_;
+    };
+}
+
+namespace detail
+{
+    // 在 executor 上运行的任务的 Promise：executor 提供 makePromise<R>()（比如 ThreadPool2）时由它创建，
+    // 共享状态来自线程池设置的内存来源，SHUTDOWN_ABORT 也能传到任务；否则使用默认的 slabResource()
+    template <typename R, typename Executor>
+    auto makeExecutorPromise(Executor &executor, int) -> decltype(executor.template makePromise<R>())
+    {
+        return executor.template makePromise<R>();
+    }
+
+    template <typename R, typename Executor>
+    Promise<R> makeExecutorPromise(Executor &, long)
+    {
+        return Promise<R>();
+    }
+}
+
+template <typename T>
+template <typename Executor, typename F>
+Future<typename detail::ThenResult<F, T>::type> Future<T>::then(Executor &executor, F &&func)
+{
+    typedef typename detail::ThenResult<F, T>::type R;
+    typedef typename std::decay<F>::type Fn;
+    if (state_ == nullptr)
+        throw std::future_error(std::future_errc::no_state);
+    Promise<R> promise = detail::makeExecutorPromise<R>(executor, 0);
+    Future<R> result = promise.getFuture();
+    detail::FutureState<T> *state = state_;
+    state_ = nullptr;
+    // 状态对象的这份引用交给后续任务，后续任务执行完（或者被丢弃）时释放
+    detail::ThenTask<T, R, Fn> task(state, std::move(promise), Fn(std::forward<F>(func)));
+    state->setContinuation(TaskFunction(detail::ThenContinuation<T, R, Fn, Executor>(std::move(task), &executor)));
+    return result;
+}
+
+// 创建一个已经完成、保存着异常 e 的Future
+template <typename R>
+Future<R> makeExceptionFuture(std::exception_ptr e)
+{
+    Promise<R> promise;
+    Future<R> future = promise.getFuture();
+    promise.setException(e);
+    return future;
+}
+
+#endif
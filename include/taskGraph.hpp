@@ -0,0 +1,265 @@
+#ifndef TASK_GRAPH_HPP
+#define TASK_GRAPH_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <taskFunction.hpp>
+#include <taskFuture.hpp>
+
+/*
+任务依赖图（DAG）：每个任务声明它依赖的前驱任务，前驱全部执行完以后它才会被放入线程池
+不会有线程阻塞在 get() 上等待前驱：每个任务带一个原子的“未完成前驱数量”，
+前驱执行完时减一，减到0的那个线程负责把它提交出去；
+变为可执行的后继任务里，第一个直接在当前线程接着执行，其余的提交到线程池
+
+example:
+TaskGraph graph;
+GraphNode load = graph.emplace([]{ ... });
+GraphNode sum1 = graph.emplace([]{ ... });
+GraphNode sum2 = graph.emplace([]{ ... });
+GraphNode merge = graph.emplace([]{ ... });
+load.precede(sum1, sum2);
+merge.succeed(sum1, sum2);
+graph.run(pool).get();
+*/
+class TaskGraph;
+
+// 图中一个任务的句柄，用来声明依赖关系
+class GraphNode
+{
+public:
+    GraphNode() : node_(nullptr)
+    {
+    }
+
+    // 当前任务执行完以后，others 才能执行
+    template <typename... Nodes>
+    GraphNode &precede(GraphNode other, Nodes... others);
+
+    // others 都执行完以后，当前任务才能执行
+    template <typename... Nodes>
+    GraphNode &succeed(GraphNode other, Nodes... others);
+
+    bool valid() const
+    {
+        return node_ != nullptr;
+    }
+
+private:
+    struct Node
+    {
+        Node(std::function<void()> &&work) : work_(std::move(work)), predecessors_(0), pending_(0)
+        {
+        }
+        std::function<void()> work_;    // 图可以多次运行，所以任务用可以多次调用的 std::function 保存
+        std::vector<Node *> successors_; // 后继任务
+        int predecessors_;               // 前驱任务的数量
+        std::atomic_int pending_;        // 本次运行中还没有执行完的前驱数量
+    };
+
+    explicit GraphNode(Node *node) : node_(node)
+    {
+    }
+
+    GraphNode &precede() { return *this; }
+    GraphNode &succeed() { return *this; }
+
+    friend class TaskGraph;
+
+    Node *node_;
+};
+
+template <typename... Nodes>
+GraphNode &GraphNode::precede(GraphNode other, Nodes... others)
+{
+    node_->successors_.push_back(other.node_);
+    other.node_->predecessors_++;
+    return precede(others...);
+}
+
+template <typename... Nodes>
+GraphNode &GraphNode::succeed(GraphNode other, Nodes... others)
+{
+    other.precede(*this);
+    return succeed(others...);
+}
+
+class TaskGraph
+{
+public:
+    TaskGraph() : remaining_(0), failed_(false)
+    {
+    }
+
+    TaskGraph(const TaskGraph &) = delete;
+    TaskGraph &operator=(const TaskGraph &) = delete;
+
+    // 添加一个任务，任务没有参数也没有返回值，结果通过捕获的变量传给后继任务
+    template <typename Func>
+    GraphNode emplace(Func &&func)
+    {
+        nodes_.emplace_back(new GraphNode::Node(std::function<void()>(std::forward<Func>(func))));
+        return GraphNode(nodes_.back().get());
+    }
+
+    std::size_t size() const
+    {
+        return nodes_.size();
+    }
+
+    /*
+    在 executor（需要提供 bool execute(TaskFunction)，比如 ThreadPool2）上运行整个图，
+    返回的Future在所有任务执行完以后就绪
+    某个任务抛出异常后，还没有开始的任务不再执行，Future得到第一个异常
+    图有环时Future得到 std::logic_error
+    运行期间不能修改图，也不能再次运行；图对象要活到返回的Future就绪
+    */
+    template <typename Executor>
+    Future<void> run(Executor &executor)
+    {
+        promise_ = detail::makeExecutorPromise<void>(executor, 0);
+        Future<void> result = promise_.getFuture();
+        error_ = nullptr;
+        failed_ = false;
+
+        std::vector<GraphNode::Node *> roots;
+        for (const std::unique_ptr<GraphNode::Node> &node : nodes_)
+        {
+            if (node->predecessors_ == 0)
+                roots.push_back(node.get());
+        }
+        if (hasCycle(roots))
+        {
+            promise_.setException(std::make_exception_ptr(std::logic_error("task graph has a cycle")));
+            return result;
+        }
+        if (nodes_.empty())
+        {
+            promise_.setValue(nullptr);
+            return result;
+        }
+
+        remaining_.store(nodes_.size(), std::memory_order_relaxed);
+        for (GraphNode::Node *node : roots)
+            schedule(node, &executor);
+        return result;
+    }
+
+private:
+    typedef GraphNode::Node Node;
+
+    // 放入线程池执行的一个图任务
+    template <typename Executor>
+    struct NodeTask
+    {
+        TaskGraph *graph_;
+        Node *node_;
+        Executor *executor_;
+        void operator()() { graph_->runFrom(node_, executor_); }
+    };
+
+    template <typename Executor>
+    void schedule(Node *node, Executor *executor)
+    {
+        NodeTask<Executor> task = {this, node, executor};
+        // 提交失败（队列满）时直接在当前线程执行，保证图一定能执行完
+        if (!executor->execute(TaskFunction(task)))
+            runFrom(node, executor);
+    }
+
+    // 执行一个任务，然后沿着第一个变为可执行的后继任务继续执行
+    template <typename Executor>
+    void runFrom(Node *node, Executor *executor)
+    {
+        while (node != nullptr)
+        {
+            if (!failed_.load(std::memory_order_acquire))
+            {
+                try
+                {
+                    node->work_();
+                }
+                catch (...)
+                {
+                    setError(std::current_exception());
+                }
+            }
+
+            Node *next = nullptr;
+            for (Node *successor : node->successors_)
+            {
+                if (successor->pending_.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                    continue;
+                if (next == nullptr)
+                    next = successor;
+                else
+                    schedule(successor, executor);
+            }
+
+            // 最后一个任务执行完，图对象可能马上被析构，之后不能再访问成员
+            if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                finish();
+                return;
+            }
+            node = next;
+        }
+    }
+
+    void setError(std::exception_ptr error)
+    {
+        std::lock_guard<std::mutex> lock(errorMtx_);
+        if (!error_)
+            error_ = error;
+        failed_.store(true, std::memory_order_release);
+    }
+
+    // Future就绪以后图对象可能马上被析构，所以先把Promise移到局部变量里再设置
+    void finish()
+    {
+        Promise<void> promise(std::move(promise_));
+        if (failed_.load(std::memory_order_acquire))
+            promise.setException(error_);
+        else
+            promise.setValue(nullptr);
+    }
+
+    // 按拓扑顺序遍历一遍，走不到的任务说明在环上；遍历完把每个任务的前驱计数重置好
+    bool hasCycle(const std::vector<Node *> &roots) const
+    {
+        std::vector<Node *> ready(roots);
+        std::size_t visited = 0;
+        for (const std::unique_ptr<Node> &node : nodes_)
+            node->pending_.store(node->predecessors_, std::memory_order_relaxed);
+        while (!ready.empty())
+        {
+            Node *node = ready.back();
+            ready.pop_back();
+            visited++;
+            for (Node *successor : node->successors_)
+            {
+                if (successor->pending_.fetch_sub(1, std::memory_order_relaxed) == 1)
+                    ready.push_back(successor);
+            }
+        }
+        for (const std::unique_ptr<Node> &node : nodes_)
+            node->pending_.store(node->predecessors_, std::memory_order_relaxed);
+        return visited != nodes_.size();
+    }
+
+    std::vector<std::unique_ptr<Node>> nodes_;
+    std::atomic_size_t remaining_; // 本次运行中还没有执行完的任务数量
+    std::atomic_bool failed_;      // 有任务抛出了异常
+    std::mutex errorMtx_;
+    std::exception_ptr error_; // 第一个异常
+    Promise<void> promise_;
+};
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef TASK_GROUP_HPP
+#define TASK_GROUP_HPP
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <taskFunction.hpp>
+#include <backpressure.hpp>
+#include <cancellation.hpp>
+#include <waitHelper.hpp>
+
+/*
+结构化的任务组：一组任务一起提交、一起等待、一起取消
+executor 需要提供 bool execute(TaskFunction) 和 bool runPendingTask()（比如 ThreadPool2）
+
+TaskGroup<ThreadPool2> group(pool);
+group.run([&]() { left = fib(n - 1); });   // 任务里面可以再创建任务组，递归地 fork-join
+group.run([&]() { right = fib(n - 2); });
+group.wait();                              // 等待期间当前线程帮忙执行排队的任务，不会挂起占着线程
+
+wait() 重新抛出组里第一个任务抛出的异常；一个任务抛出异常以后，组里还没开始的任务不再执行
+*/
+namespace detail
+{
+    // 任务组的共享状态，组里的任务被线程池丢弃时可能在 TaskGroup 析构以后才析构，所以用 shared_ptr 管理
+    class TaskGroupState
+    {
+    public:
+        TaskGroupState() : pending_(0), cancelled_(false)
+        {
+        }
+
+        // 只有创建任务组的线程调用；从0开始计数时没有线程在等待，可以重置完成通知
+        void add()
+        {
+            if (pending_.fetch_add(1, std::memory_order_relaxed) == 0)
+                idle_.reset();
+        }
+
+        // 一个任务结束（执行完、被取消或者被丢弃），最后一个任务结束时唤醒等待的线程
+        void finish()
+        {
+            if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                idle_.post();
+        }
+
+        template <typename F>
+        void run(F &func)
+        {
+            if (!cancelled_.load(std::memory_order_relaxed))
+            {
+                try
+                {
+                    func();
+                }
+                catch (...)
+                {
+                    fail(std::current_exception());
+                }
+            }
+            finish();
+        }
+
+        // 记录第一个异常，并取消组里剩下的任务
+        void fail(std::exception_ptr error)
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (!error_)
+                error_ = error;
+            cancelled_.store(true, std::memory_order_relaxed);
+        }
+
+        void cancel()
+        {
+            cancelled_.store(true, std::memory_order_relaxed);
+        }
+
+        bool isCancelled() const
+        {
+            return cancelled_.load(std::memory_order_relaxed);
+        }
+
+        bool done() const
+        {
+            return pending_.load(std::memory_order_acquire) == 0;
+        }
+
+        // 没有任务可以帮忙时挂起：工作线程挂起在线程池的空闲栈上，组里的任务都结束或者有新任务时唤醒；
+        // 其他线程一直挂起到组里的任务都结束
+        void sleep()
+        {
+            WaitHelper *helper = WaitHelper::current();
+            if (helper != nullptr)
+                helper->park(idle_);
+            else
+                idle_.wait();
+        }
+
+        // 所有任务都结束以后调用：取出第一个异常，恢复成可以继续使用的状态
+        std::exception_ptr reset()
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            std::exception_ptr error = error_;
+            error_ = nullptr;
+            cancelled_.store(false, std::memory_order_relaxed);
+            return error;
+        }
+
+    private:
+        std::atomic<std::size_t> pending_; // 还没有结束的任务数量
+        std::atomic_bool cancelled_;
+        Completion idle_;                  // 所有任务都结束
+        std::mutex mtx_;                   // 保护 error_
+        std::exception_ptr error_;
+    };
+
+    // 放进线程池的任务：没有执行就被销毁（被线程池拒绝或者丢弃）时也要让任务组知道
+    template <typename F>
+    class GroupTask
+    {
+    public:
+        GroupTask(std::shared_ptr<TaskGroupState> state, F func) : state_(std::move(state)), func_(std::move(func))
+        {
+        }
+
+        GroupTask(GroupTask &&) = default;
+
+        ~GroupTask()
+        {
+            if (state_ != nullptr)
+            {
+                state_->fail(std::make_exception_ptr(TaskRejected()));
+                state_->finish();
+            }
+        }
+
+        void operator()()
+        {
+            std::shared_ptr<TaskGroupState> state = std::move(state_);
+            state->run(func_);
+        }
+
+        // 线程池 shutdown 时还没执行的任务被取消，组的 wait 得到 TaskCancelled
+        void cancel()
+        {
+            if (state_ == nullptr)
+                return;
+            std::shared_ptr<TaskGroupState> state = std::move(state_);
+            state->fail(std::make_exception_ptr(TaskCancelled()));
+            state->finish();
+        }
+
+    private:
+        std::shared_ptr<TaskGroupState> state_; // 执行或者移走以后为空
+        F func_;
+    };
+}
+
+template <typename Executor>
+class TaskGroup
+{
+public:
+    explicit TaskGroup(Executor &executor) : executor_(executor), state_(std::make_shared<detail::TaskGroupState>())
+    {
+    }
+
+    // 析构前等待所有任务结束，异常被忽略（需要异常的话先调用 wait）
+    ~TaskGroup()
+    {
+        try
+        {
+            wait();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    // 提交一个无参数、无返回值的任务；被线程池拒绝时 wait() 抛出 TaskRejected
+    template <typename F>
+    void run(F &&func)
+    {
+        state_->add();
+        // 被拒绝的任务对象已经析构，析构时记录了异常并结束了计数
+        executor_.execute(TaskFunction(detail::GroupTask<typename std::decay<F>::type>(state_, std::forward<F>(func))));
+    }
+
+    // 等待组里所有任务结束，等待期间当前线程帮忙执行线程池里排队的任务
+    // 有任务抛出异常时重新抛出第一个异常；返回以后任务组可以继续使用
+    void wait()
+    {
+        while (!state_->done())
+        {
+            if (!executor_.runPendingTask())
+                state_->sleep();
+        }
+        std::exception_ptr error = state_->reset();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // 取消：组里还没开始执行的任务不再执行，正在执行的任务可以用 isCancelled() 检查后提前返回
+    void cancel()
+    {
+        state_->cancel();
+    }
+
+    bool isCancelled() const
+    {
+        return state_->isCancelled();
+    }
+
+private:
+    Executor &executor_;
+    std::shared_ptr<detail::TaskGroupState> state_;
+};
+
+#endif
@@ -14,9 +14,30 @@
 #include <unordered_map>
 #include <future>
 #include <thread>
+#include <iterator>
+#include <algorithm>
+#include <workStealingQueue.hpp>
+#include <mpmcQueue.hpp>
+#include <taskFunction.hpp>
+#include <taskFuture.hpp>
+#include <idleStack.hpp>
+#include <priorityQueue.hpp>
+#include <timerWheel.hpp>
+#include <taskGraph.hpp>
+#include <parallelAlgorithm.hpp>
+#include <cpuTopology.hpp>
+#include <adaptiveSizing.hpp>
+#include <poolStats.hpp>
+#include <backpressure.hpp>
+#include <cancellation.hpp>
+#include <fairShare.hpp>
+#include <idleStrategy.hpp>
+#include <traceRecorder.hpp>
+#include <coroutineTask.hpp>
+#include <taskGroup.hpp>
+#include <waitHelper.hpp>
 const int TASK_MAX_THRESHHOLD = 4;
 const int THREAD_MAX_THRESHHOLD = 10;
-const int THREAD_MAX_IDLE_TIME = 10; // 单位：秒
 
 // 线程支持的模式
 enum class PoolMode
@@ -38,15 +59,18 @@ public:
     {
     }
 
-    // 线程析构
-    ~Thread() = default;
+    // 线程析构，没有 join 的线程（线程池没有正常关闭）只能分离
+    ~Thread()
+    {
+        if (thread_.joinable())
+            thread_.detach();
+    }
 
     // 启动线程
     void start()
     {
-        // 创建一个线程来执行一个线程函数
-        std::thread t(func_, threadId_); // C++11来说，线程对象t 和线程函数func_
-        t.detach();                      // 设置分离线程  pthread_detach  pthread_t设置成分离线程
+        // 创建一个线程来执行一个线程函数，线程池关闭时 join
+        thread_ = std::thread(func_, threadId_);
         /**
          * 这里为什么要绑定 ThreadPool中的 threadFunc
          * 因为线程池创建线程，线程执行线程函数理应由线程池提供线程所需要执行的函数
@@ -54,6 +78,13 @@ public:
          */
     }
 
+    // 等待线程函数返回
+    void join()
+    {
+        if (thread_.joinable())
+            thread_.join();
+    }
+
     // 获取线程id
     int getId() const
     {
@@ -64,6 +95,7 @@ private:
     ThreadFunc func_;
     static int generateId_;
     int threadId_; // 保存线程id，方便后续删除线程对象
+    std::thread thread_;
 };
 
 /*
@@ -84,19 +116,68 @@ class ThreadPool2
 public:
     // 线程池构造
     ThreadPool2()
-        : initThreadSize_(0), taskCnt_(0), taskQueueMaxThreshHold_(TASK_MAX_THRESHHOLD), poolMode_(PoolMode::MODE_FIXED), isRunning_(false), idleThreadSize_(0), maxThreadSize_(THREAD_MAX_THRESHHOLD), curThreadSize_(0)
+        : initThreadSize_(0), taskCnt_(0), taskQueueMaxThreshHold_(TASK_MAX_THRESHHOLD), poolMode_(PoolMode::MODE_FIXED), isRunning_(false), idleThreadSize_(0), maxThreadSize_(THREAD_MAX_THRESHHOLD), curThreadSize_(0), injectCnt_(0), highCnt_(0), fairCnt_(0), tenantCnt_(0), queueMode_(QueueMode::MODE_LOCKED), waitingProducers_(0), overflowCnt_(0), statsEnabled_(false), submitted_(0), rejected_(0), queueHighWater_(0), rejectPolicy_(RejectPolicy::REJECT_TIMEOUT), submitTimeout_(SUBMIT_TIMEOUT_DEFAULT), resource_(slabResource()), stopping_(false), cancelPending_(false), abort_(false)
     {
+        // 到期的定时任务按普通优先级放入全局队列，定时器线程不等待也不执行任务
+        // 到期的任务不能丢失，队列满时也超额放入，不受任务队列上限限制
+        timerWheel_.reset(new TimerWheel([this](Task task)
+                                         {
+            // 线程池已经 shutdown，Future 得到 TaskCancelled
+            if (stopping_)
+            {
+                task.cancel();
+                return;
+            }
+            int64_t submitStart = stampTask(task);
+            pushUnbounded(task, TaskPriority::PRIORITY_NORMAL);
+            countSubmitted(1, 0);
+            if (submitStart != 0)
+                trace_.recordSubmit(submitStart, true); }));
     }
 
     // 线程池析构
     ~ThreadPool2()
     {
+        // 先停止定时器线程，没有到期的定时任务不再执行
+        timerWheel_.reset();
+        // 没有调用过 shutdown 时执行完所有任务再退出；之前的 shutdown 超时返回时，这里一直等到线程退出
+        shutdown();
+    }
+
+    /*
+    关闭线程池：不再接受线程池外部提交的任务（正在执行的任务提交的子任务仍然接受），然后等待所有线程退出并 join
+    SHUTDOWN_DRAIN 执行完所有排队的任务；SHUTDOWN_CANCEL_PENDING 排队的任务不再执行，Future 得到 TaskCancelled；
+    SHUTDOWN_ABORT 同时让正在执行的任务的 CancellationToken 变成已取消
+    最多等待 timeout，超时返回false，线程池继续关闭，可以再次调用（比如换成 SHUTDOWN_ABORT）；
+    C++ 没有办法安全地强制结束线程，不响应取消的任务只能等它执行完，析构时会一直等待
+    不能和另一个 shutdown 或者析构同时调用
+    */
+    bool shutdown(ShutdownMode mode = ShutdownMode::SHUTDOWN_DRAIN, std::chrono::milliseconds timeout = SHUTDOWN_WAIT_FOREVER)
+    {
+        stopping_ = true;
+        if (mode != ShutdownMode::SHUTDOWN_DRAIN)
+            cancelPending_ = true;
+        if (mode == ShutdownMode::SHUTDOWN_ABORT)
+            abort_ = true;
         isRunning_ = false;
         // 等待线程池里面所有的线程返回  有两种状态：阻塞 & 正在执行任务中
-        std::unique_lock<std::mutex> lock(taskQueueMtx_);
-        notEmpty_.notify_all();
-        exitCond_.wait(lock, [&]() -> bool
-                       { return threads_.size() == 0; });
+        idleWorkers_.wakeAll();
+        {
+            std::unique_lock<std::mutex> lock(taskQueueMtx_);
+            auto exited = [&]() -> bool
+            { return threads_.size() == 0; };
+            if (timeout == SHUTDOWN_WAIT_FOREVER)
+                exitCond_.wait(lock, exited);
+            else if (!exitCond_.wait_for(lock, timeout, exited))
+                return false;
+            reapThreads();
+        }
+        // 和关闭同时提交、没有线程来得及执行的任务，在当前线程上处理掉
+        Task task;
+        FairTicket ticket;
+        while (popInjected(task) || popFair(task, ticket) || stealAny(task))
+            runTask(nullptr, task, ticket);
+        return true;
     }
 
     // 设置线程池的工作模式
@@ -107,37 +188,74 @@ public:
         poolMode_ = mode;
     }
 
-    // 开始线程池,默认大小为CPU核心数量
-    void start(int initThreadSize = std::thread::hardware_concurrency())
+    // 设置全局任务队列的实现方式，无锁模式下队列容量为任务队列上限阈值（向上取整为2的幂）
+    void setQueueMode(QueueMode mode)
+    {
+        if (checkRunningState())
+            return;
+        queueMode_ = mode;
+    }
+
+    // 开始线程池,默认大小为CPU核心数量，placement 指定工作线程的绑核方式
+    void start(int initThreadSize = std::thread::hardware_concurrency(), const PlacementPolicy &placement = PlacementPolicy())
     {
         // 修改运行状态
         isRunning_ = true;
+        if (queueMode_ == QueueMode::MODE_LOCKFREE)
+            lockFreeQueue_.reset(new LockFreePriorityQueue<Task>(taskQueueMaxThreshHold_));
         // 记录初始线程个数，默认为4
         initThreadSize_ = initThreadSize;
         curThreadSize_ = initThreadSize;
 
+        // 每个线程槽位对应一个私有任务队列，cached模式下按线程数量上限预先分配，
+        // 这样偷取任务时遍历的数组不会随着线程的增减而变化
+        std::size_t slotSize = initThreadSize_;
+        if (poolMode_ == PoolMode::MODE_CACHED && maxThreadSize_ > slotSize)
+            slotSize = maxThreadSize_;
+        workers_.reserve(slotSize);
+        for (std::size_t i = 0; i < slotSize; i++)
+        {
+            workers_.emplace_back(new Worker(this, i));
+            workers_[i]->cpus_ = placement.cpusFor(i);
+            workers_[i]->node_ = placement.nodeFor(i);
+        }
+        // 偷取顺序：从自己的下一个槽位开始依次偷取，避免所有线程都去偷同一个线程；
+        // 绑核以后同一NUMA节点的线程排在前面，任务和它的数据尽量留在本节点
+        for (std::size_t i = 0; i < slotSize; i++)
+        {
+            Worker *self = workers_[i].get();
+            for (std::size_t j = 1; j < slotSize; j++)
+                self->stealOrder_.push_back((i + j) % slotSize);
+            std::stable_partition(self->stealOrder_.begin(), self->stealOrder_.end(), [&](std::size_t victim) -> bool
+                                  { return workers_[victim]->node_ == self->node_; });
+        }
+
         // 创建线程对象
+        std::vector<int> threadIds;
         threads_.reserve(initThreadSize_);
         for (int i = 0; i < initThreadSize_; i++)
         {
             // 创建thread线程对象的时候，把线程函数给到thread线程对象
-            std::unique_ptr<Thread> ptr(new Thread(std::bind(&ThreadPool2::threadFunc, this, std::placeholders::_1)));
+            workers_[i]->active_ = true;
+            std::unique_ptr<Thread> ptr(new Thread(std::bind(&ThreadPool2::threadFunc, this, std::placeholders::_1, (std::size_t)i)));
             int threadId = ptr->getId();
             // C++14 std::unique_ptr<Thread> ptr = make_unique<THread>(std::bind(&ThreadPool::threadFunc, this));
             // C++11 std::make_shared   C++14才更新make_unique
 
             // 同时unique_ptr禁止了拷贝构造，所以emplace_back应该传入右值
             threads_.emplace(threadId, std::move(ptr));
+            threadIds.push_back(threadId);
         }
 
         /**
          * 为保证线程创建和启动的公平性，统一创建，统一启动
+         * 线程id是全局递增的，不一定从0开始，所以这里按照记录下来的id启动
          */
 
-        // 启动所有线程     std::vector<Thread *> threads_;
-        for (int i = 0; i < initThreadSize_; i++)
+        // 启动所有线程
+        for (int threadId : threadIds)
         {
-            threads_[i]->start(); // 需要执行一个线程函数
+            threads_[threadId]->start(); // 需要执行一个线程函数
             idleThreadSize_++;
         }
     }
@@ -150,28 +268,578 @@ public:
         taskQueueMaxThreshHold_ = threshHold;
     }
 
+    // 设置队列满时的处理策略，timeout 是 REJECT_TIMEOUT 策略的最长等待时间
+    void setRejectPolicy(RejectPolicy policy, std::chrono::milliseconds timeout = SUBMIT_TIMEOUT_DEFAULT)
+    {
+        if (checkRunningState())
+            return;
+        rejectPolicy_ = policy;
+        submitTimeout_ = timeout;
+    }
+
+    // 设置每次提交任务时 Future 共享状态的内存来源，默认 slabResource()
+    // resource 要比线程池返回的所有 Future 都活得长
+    void setAllocator(MemoryResource *resource)
+    {
+        if (checkRunningState())
+            return;
+        resource_ = resource;
+    }
+
     // 定义cached模式下线程阈值
     void setThreadSizeThreshhold(int threshHold)
     {
         if (checkRunningState())
             return;
-        if (poolMode_ == PoolMode::MODE_FIXED)
+        if (poolMode_ == PoolMode::MODE_CACHED)
             maxThreadSize_ = threshHold;
     }
 
+    // 定义cached模式下线程数量的调节策略
+    void setSizingPolicy(const SizingPolicy &policy)
+    {
+        if (checkRunningState())
+            return;
+        sizer_.setPolicy(policy);
+    }
+
+    // 设置工作线程空闲时的等待策略（自旋、让出CPU、挂起），默认马上挂起
+    // 打开统计以后 WorkerStats 里记录每次空闲是在哪个阶段等到任务的
+    void setIdleStrategy(const IdleStrategy &strategy)
+    {
+        if (checkRunningState())
+            return;
+        idleStrategy_ = strategy;
+    }
+
+    // 打开运行统计：每个线程执行的任务数量、忙碌/空闲时间、排队时间和执行时间的直方图等
+    void setStatsEnabled(bool enabled)
+    {
+        if (checkRunningState())
+            return;
+        statsEnabled_ = enabled;
+    }
+
+    // 运行统计的快照，没有打开统计时只有线程数量、排队任务数量和拒绝数量
+    PoolStats stats() const
+    {
+        PoolStats stats;
+        for (const std::unique_ptr<Worker> &worker : workers_)
+            stats.workers_.push_back(worker->stats_.collect(worker->index_, stats));
+        stats.submitted_ = submitted_.load(std::memory_order_relaxed);
+        stats.rejected_ = rejected_.load(std::memory_order_relaxed);
+        stats.queueDepth_ = taskCnt_.load(std::memory_order_relaxed);
+        stats.queueHighWater_ = queueHighWater_.load(std::memory_order_relaxed);
+        stats.threads_ = curThreadSize_;
+        stats.idleThreads_ = idleThreadSize_;
+        {
+            std::lock_guard<std::mutex> lock(taskQueueMtx_);
+            stats.tenants_ = fairQueue_.stats();
+        }
+        return stats;
+    }
+
+    // 每隔 period 把统计快照以 Prometheus 文本格式写到 path，返回的句柄用来停止
+    TimerHandle exportPrometheus(const std::string &path, std::chrono::milliseconds period, const std::string &pool = "threadpool")
+    {
+        return submitEvery(period, [this, path, pool]()
+                           {
+            if (!writePrometheusFile(stats(), path, pool))
+                LOG_WARN("write prometheus file fail:" << path); });
+    }
+
+    // 打开任务时间线：每个线程记录提交、执行、偷取、空闲和等锁的时间，最多 eventsPerThread 个事件（见 traceRecorder.hpp）
+    void setTraceEnabled(bool enabled, std::size_t eventsPerThread = TRACE_EVENTS_PER_THREAD)
+    {
+        if (checkRunningState())
+            return;
+        trace_.setEnabled(enabled, eventsPerThread);
+    }
+
+    // 到目前为止的时间线，Chrome trace event 格式的 JSON，pool 作为进程名
+    std::string traceJson(const std::string &pool = "threadpool") const
+    {
+        return trace_.toJson(pool);
+    }
+
+    // 把时间线写到 path，用 chrome://tracing 或者 ui.perfetto.dev 打开
+    bool writeTrace(const std::string &path, const std::string &pool = "threadpool") const
+    {
+        return trace_.writeFile(path, pool);
+    }
+
     // 给线程池提交任务
     // 使用可变参模板编程，让submitTask可以接收任意任务函数和任意数量的参数
+    // 参数按值保存在任务里，执行时以右值传给任务函数，所以可以传入 unique_ptr 这样只能移动的参数
+    template <typename Func, typename... Args,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<Func>::type, TaskPriority>::value>::type>
+    auto submitTask(Func &&func, Args &&...args) -> Future<TaskResultOf<Func, Args...>>
+    {
+        return submitTask(TaskPriority::PRIORITY_NORMAL, std::forward<Func>(func), std::forward<Args>(args)...);
+    }
+
+    // 按优先级提交任务：高优先级的任务先执行，同一优先级内先进先出
     template <typename Func, typename... Args>
-    auto submitTask(Func &&func, Args &&...args) -> std::future<decltype(func(args...))>
+    auto submitTask(TaskPriority priority, Func &&func, Args &&...args) -> Future<TaskResultOf<Func, Args...>>
     {
         // 打包任务，放入任务队列
-        using RType = decltype(func(args...));
-        auto task = std::make_shared<std::packaged_task<RType()>>(
-            std::bind(std::forward<Func>(func), std::forward<Args>(args)...));
-        std::future<RType> result = task->get_future();
+        // 函数、参数和Promise一起放在 TaskFunction 的内部存储里，常见的小任务提交不需要分配堆内存
+        using RType = TaskResultOf<Func, Args...>;
+        Promise<RType> promise = makePromise<RType>();
+        Future<RType> result = promise.getFuture();
+        Task task(PackagedTask<RType, typename std::decay<Func>::type, typename std::decay<Args>::type...>(
+            std::move(promise), std::forward<Func>(func), std::forward<Args>(args)...));
+
+        // 队列满被拒绝时，Future得到 TaskRejected 异常
+        if (pushTask(std::move(task), priority) == SubmitStatus::SUBMIT_REJECTED)
+        {
+            LOG_WARN("task queue is full,submit task fail.");
+            return makeExceptionFuture<RType>(std::make_exception_ptr(TaskRejected()));
+        }
+        // 返回任务的 Result 对象
+        return result;
+    }
+
+    // 不等待地提交任务：队列满时不阻塞，也不在当前线程执行任务（REJECT_DISCARD_OLDEST 策略仍然生效）
+    // 返回 SUBMIT_OK 时 result 是任务的Future，被拒绝时 result 得到 TaskRejected 异常
+    template <typename Func, typename... Args,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<Func>::type, TaskPriority>::value>::type>
+    SubmitStatus trySubmit(Future<TaskResultOf<Func, Args...>> &result, Func &&func, Args &&...args)
+    {
+        return trySubmit(result, TaskPriority::PRIORITY_NORMAL, std::forward<Func>(func), std::forward<Args>(args)...);
+    }
+
+    // 按优先级不等待地提交任务
+    template <typename Func, typename... Args>
+    SubmitStatus trySubmit(Future<TaskResultOf<Func, Args...>> &result, TaskPriority priority, Func &&func, Args &&...args)
+    {
+        using RType = TaskResultOf<Func, Args...>;
+        Promise<RType> promise = makePromise<RType>();
+        result = promise.getFuture();
+        Task task(PackagedTask<RType, typename std::decay<Func>::type, typename std::decay<Args>::type...>(
+            std::move(promise), std::forward<Func>(func), std::forward<Args>(args)...));
+        SubmitStatus status = pushTask(std::move(task), priority, true);
+        if (status == SubmitStatus::SUBMIT_REJECTED)
+            result = makeExceptionFuture<RType>(std::make_exception_ptr(TaskRejected()));
+        return status;
+    }
+
+    // 提交一个不需要返回值的任务，不创建Future，队列满时按拒绝策略处理，被拒绝返回false
+    // Future::then 和 TaskGraph 用它把后续任务放入线程池
+    bool execute(TaskFunction task, TaskPriority priority = TaskPriority::PRIORITY_NORMAL)
+    {
+        if (pushTask(std::move(task), priority) == SubmitStatus::SUBMIT_REJECTED)
+        {
+            LOG_WARN("task queue is full,submit task fail.");
+            return false;
+        }
+        return true;
+    }
+
+    // 不等待地提交一个不需要返回值的任务，被拒绝的任务直接销毁
+    SubmitStatus tryExecute(TaskFunction task, TaskPriority priority = TaskPriority::PRIORITY_NORMAL)
+    {
+        return pushTask(std::move(task), priority, true);
+    }
+
+    /*
+    多租户：每个租户一个有权重、有上限的任务队列，工作线程按执行时间在租户之间公平轮转（见 fairShare.hpp）
+    一个租户把自己的队列塞满，也不会占用其他租户的队列和全局队列，长时间忙碌时各租户得到的线程时间和权重成正比
+    queueLimit 为0时使用任务队列上限阈值；任何时候都可以增加租户，租户不能删除
+    */
+    TenantId addTenant(const std::string &name, unsigned weight = 1, std::size_t queueLimit = 0)
+    {
+        std::lock_guard<std::mutex> lock(taskQueueMtx_);
+        TenantId tenant = fairQueue_.addTenant(name, weight, queueLimit > 0 ? queueLimit : (std::size_t)taskQueueMaxThreshHold_);
+        tenantCnt_.store(tenant + 1, std::memory_order_release);
+        return tenant;
+    }
+
+    // 提交任务到租户的队列，租户的队列满时按拒绝策略处理，被拒绝时 Future 得到 TaskRejected 异常
+    // 不存在的租户总是被拒绝，不按拒绝策略处理
+    template <typename Func, typename... Args>
+    auto submitTo(TenantId tenant, Func &&func, Args &&...args) -> Future<TaskResultOf<Func, Args...>>
+    {
+        using RType = TaskResultOf<Func, Args...>;
+        Promise<RType> promise = makePromise<RType>();
+        Future<RType> result = promise.getFuture();
+        Task task(PackagedTask<RType, typename std::decay<Func>::type, typename std::decay<Args>::type...>(
+            std::move(promise), std::forward<Func>(func), std::forward<Args>(args)...));
+        if (pushTenantTask(std::move(task), tenant) == SubmitStatus::SUBMIT_REJECTED)
+            return makeExceptionFuture<RType>(std::make_exception_ptr(TaskRejected()));
+        return result;
+    }
+
+#ifdef THREADPOOL_HAS_COROUTINES
+    // co_await pool.schedule()：协程切换到线程池的工作线程上继续执行，队列满时按拒绝策略处理
+    detail::ScheduleAwaitable<ThreadPool2> schedule()
+    {
+        return detail::ScheduleAwaitable<ThreadPool2>(*this);
+    }
+#endif
+
+    // 在当前线程上执行一个排队的任务，没有任务返回false，TaskGroup 等待时用它帮忙
+    // 工作线程按自己取任务的顺序取，其他线程从全局队列取，或者从工作线程的队列偷取
+    bool runPendingTask()
+    {
+        Worker *self = currentWorker();
+        if (self != nullptr && self->pool_ == this)
+            return helpOne(self);
+        Task task;
+        FairTicket ticket;
+        if (!popInjected(task) && !popFair(task, ticket) && !stealAny(task))
+            return false;
+        runTask(nullptr, task, ticket);
+        return true;
+    }
+
+    // 当前线程数量，并行算法按它决定切分的块数
+    std::size_t concurrency() const
+    {
+        return curThreadSize_;
+    }
+
+    // 延迟 delay 之后执行任务
+    template <typename Rep, typename Period, typename Func, typename... Args>
+    auto submitAfter(const std::chrono::duration<Rep, Period> &delay, Func &&func, Args &&...args) -> ScheduledFuture<TaskResultOf<Func, Args...>>
+    {
+        return submitAt(std::chrono::steady_clock::now() + delay, std::forward<Func>(func), std::forward<Args>(args)...);
+    }
+
+    // 在 when 时刻执行任务，when 可以是任意时钟的时间点
+    template <typename Clock, typename Duration, typename Func, typename... Args>
+    auto submitAt(const std::chrono::time_point<Clock, Duration> &when, Func &&func, Args &&...args) -> ScheduledFuture<TaskResultOf<Func, Args...>>
+    {
+        using RType = TaskResultOf<Func, Args...>;
+        Promise<RType> promise = makePromise<RType>();
+        ScheduledFuture<RType> result;
+        result.future = promise.getFuture();
+        Task task(PackagedTask<RType, typename std::decay<Func>::type, typename std::decay<Args>::type...>(
+            std::move(promise), std::forward<Func>(func), std::forward<Args>(args)...));
+        result.timer = timerWheel_->schedule(toSteady(when), std::move(task));
+        return result;
+    }
+
+    // 每隔 period 执行一次任务，第一次在 period 之后执行，直到通过返回的句柄取消或者线程池析构
+    // 上一次还没有执行完时到期的那一次会被跳过；函数和参数会被多次调用，每次以左值传入
+    template <typename Rep, typename Period, typename Func, typename... Args>
+    TimerHandle submitEvery(const std::chrono::duration<Rep, Period> &period, Func &&func, Args &&...args)
+    {
+        std::shared_ptr<detail::PeriodicBase> periodic = std::make_shared<detail::PeriodicCall<typename std::decay<Func>::type, typename std::decay<Args>::type...>>(
+            std::forward<Func>(func), std::forward<Args>(args)...);
+        auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+        return timerWheel_->scheduleEvery(std::chrono::steady_clock::now() + interval, interval, std::move(periodic));
+    }
+
+    // 批量提交任务：整批任务只获取一次锁，并且只唤醒需要的线程数量
+    // 每个元素都是无参数的可调用对象，返回每个任务对应的Future，顺序和输入一致
+    // 队列满时按拒绝策略处理，被拒绝的任务和 submitTask 一样返回带 TaskRejected 异常的Future
+    template <typename Iter>
+    auto submitBatch(Iter first, Iter last) -> std::vector<Future<TaskResultOf<typename std::iterator_traits<Iter>::value_type>>>
+    {
+        using Func = typename std::decay<typename std::iterator_traits<Iter>::value_type>::type;
+        using RType = TaskResultOf<Func>;
+        std::vector<Future<RType>> results;
+        std::vector<Task> tasks;
+        results.reserve(std::distance(first, last));
+        tasks.reserve(results.capacity());
+        for (; first != last; ++first)
+        {
+            Promise<RType> promise = makePromise<RType>();
+            results.push_back(promise.getFuture());
+            tasks.emplace_back(PackagedTask<RType, Func>(std::move(promise), *first));
+        }
+
+        std::size_t pushed = pushBatch(tasks);
+        if (pushed < tasks.size())
+        {
+            LOG_WARN("task queue is full,submit task fail.");
+            for (std::size_t i = pushed; i < results.size(); i++)
+                results[i] = makeExceptionFuture<RType>(std::make_exception_ptr(TaskRejected()));
+        }
+        return results;
+    }
+
+    // 批量提交，任务对象从vector里面移动出来
+    template <typename Func>
+    auto submitBatch(std::vector<Func> funcs) -> std::vector<Future<TaskResultOf<Func>>>
+    {
+        return submitBatch(std::make_move_iterator(funcs.begin()), std::make_move_iterator(funcs.end()));
+    }
+
+    // 任务的 Promise：状态从 resource_ 分配，SHUTDOWN_ABORT 时任务的 CancellationToken 变成已取消
+    // Future::then、协程、TaskGraph 在线程池上创建的 Promise 也通过它，和 submitTask 一致
+    template <typename R>
+    Promise<R> makePromise()
+    {
+        Promise<R> promise(resource_);
+        promise.setPoolStop(&abort_);
+        return promise;
+    }
+
+    // 禁用拷贝构造函数
+    ThreadPool2(const ThreadPool2 &) = delete;
+
+    // 禁用拷贝构造函数
+    ThreadPool2 &operator=(const ThreadPool2 &) = delete;
+
+private:
+    // Task任务 =》 只能移动、带小对象优化的函数对象
+    using Task = TaskFunction;
+
+    // shutdown 以后拒绝线程池外部提交的任务，线程池自己的线程提交的子任务仍然接受
+    bool isStopped() const
+    {
+        if (!stopping_)
+            return false;
+        Worker *self = currentWorker();
+        return self == nullptr || self->pool_ != this;
+    }
+
+    // 线程槽位：每个工作线程一个，保存它私有的任务队列
+    // 槽位上的线程等待任务结果时，通过 WaitHelper 帮忙执行任务
+    struct Worker : public WaitHelper
+    {
+        Worker(ThreadPool2 *pool, std::size_t index)
+            : pool_(pool), index_(index), node_(-1), active_(false), fairTurn_(false)
+        {
+        }
+
+        bool runOne() override
+        {
+            return pool_->helpOne(this);
+        }
+
+        void park(Completion &done) override
+        {
+            parkWaiter(pool_->idleWorkers_, pool_->taskCnt_, done);
+        }
+
+        ThreadPool2 *pool_;                  // 所属的线程池，区分多个线程池的线程
+        std::size_t index_;                  // 槽位下标
+        std::vector<int> cpus_;              // 槽位上的线程绑定的CPU，空表示不绑核
+        int node_;                           // 绑定的NUMA节点，不绑核时为 -1
+        std::vector<std::size_t> stealOrder_; // 偷取任务时依次尝试的槽位
+        WorkerCounters stats_;               // 槽位上的线程的统计，前后隔开缓存行
+        std::atomic_bool active_;            // 槽位上是否有线程在运行（cached模式线程会回收）
+        WorkStealingQueue<Task> localQueue_; // 私有任务队列
+        Completion parkSlot_;                // 空闲时挂起在这里，等待被单独唤醒
+        bool fairTurn_;                      // 这次取任务时租户队列是否优先
+    };
+
+    // 当前线程对应的线程槽位，非线程池线程为nullptr
+    static Worker *&currentWorker()
+    {
+        static thread_local Worker *worker = nullptr;
+        return worker;
+    }
+
+    // 把打包好的任务放入任务队列，队列满时按拒绝策略处理
+    // tryOnly 为true时（trySubmit）不等待，也不在当前线程执行任务
+    SubmitStatus pushTask(Task task, TaskPriority priority, bool tryOnly = false)
+    {
+        if (isStopped())
+        {
+            countSubmitted(0, 1);
+            return SubmitStatus::SUBMIT_REJECTED;
+        }
+        int64_t submitStart = stampTask(task);
+        // 被挤掉的任务在这个函数返回时析构，这时已经不持有锁（析构可能触发 then 的后续任务）
+        Task evicted;
+        bool ok = enqueue(task, priority, SubmitWait(rejectPolicy_, submitTimeout_, tryOnly), evicted);
+        // 由当前线程执行的任务不算拒绝，和 pushBatch 一样
+        bool callerRuns = !ok && rejectPolicy_ == RejectPolicy::REJECT_CALLER_RUNS && !tryOnly;
+        countSubmitted(ok ? 1 : 0, (ok || callerRuns ? 0 : 1) + (evicted != nullptr ? 1 : 0));
+        if (submitStart != 0)
+            trace_.recordSubmit(submitStart, ok);
+        if (ok)
+            return SubmitStatus::SUBMIT_OK;
+        if (callerRuns)
+        {
+            task();
+            return SubmitStatus::SUBMIT_CALLER_RAN;
+        }
+        return SubmitStatus::SUBMIT_REJECTED;
+    }
+
+    // 把任务放入租户的队列，和 pushTask 一样按拒绝策略处理，只和这个租户自己排队的任务比较
+    SubmitStatus pushTenantTask(Task task, TenantId tenant, bool tryOnly = false)
+    {
+        // 不存在的租户是调用错误，不是队列满：不在当前线程执行，也不算作拒绝的数量
+        if (tenant >= tenantCnt_.load(std::memory_order_acquire))
+        {
+            LOG_WARN("unknown tenant:" << tenant << ",submit task fail.");
+            return SubmitStatus::SUBMIT_REJECTED;
+        }
+        if (isStopped())
+        {
+            countSubmitted(0, 1);
+            return SubmitStatus::SUBMIT_REJECTED;
+        }
+        int64_t submitStart = stampTask(task);
+        Task evicted;
+        bool ok = enqueueTenant(task, tenant, SubmitWait(rejectPolicy_, submitTimeout_, tryOnly), evicted);
+        bool callerRuns = !ok && rejectPolicy_ == RejectPolicy::REJECT_CALLER_RUNS && !tryOnly;
+        countSubmitted(ok ? 1 : 0, (ok || callerRuns ? 0 : 1) + (evicted != nullptr ? 1 : 0));
+        if (submitStart != 0)
+            trace_.recordSubmit(submitStart, ok);
+        if (ok)
+            return SubmitStatus::SUBMIT_OK;
+        if (callerRuns)
+        {
+            task();
+            return SubmitStatus::SUBMIT_CALLER_RAN;
+        }
+        LOG_WARN("tenant queue is full,submit task fail.");
+        return SubmitStatus::SUBMIT_REJECTED;
+    }
+
+    // pushTenantTask 的实现，线程池线程提交的也放入租户队列，这样才能按租户计算线程时间
+    // 线程池线程不能等待（所有线程都在等队列腾出位置时会死锁），租户队列满了也直接放入
+    bool enqueueTenant(Task &task, TenantId tenant, const SubmitWait &wait, Task &evicted)
+    {
+        Worker *self = currentWorker();
+        bool ownWorker = self != nullptr && self->pool_ == this;
+        std::unique_lock<std::mutex> lock = lockQueue();
+        if (!ownWorker && !wait.wait(tenantNotFull_, lock, [&]() -> bool
+                                     { return !fairQueue_.full(tenant); }))
+        {
+            // REJECT_DISCARD_OLDEST：丢弃这个租户最早的一个任务
+            if (rejectPolicy_ != RejectPolicy::REJECT_DISCARD_OLDEST || !fairQueue_.popOldest(tenant, evicted))
+                return false;
+            fairCnt_--;
+            taskCnt_--;
+        }
+        fairQueue_.push(tenant, std::move(task));
+        fairCnt_++;
+        taskCnt_++;
+        growThreads();
+        lock.unlock();
+        idleWorkers_.wakeOne();
+        return true;
+    }
+
+    // 把一批任务放入队列，返回被接受（放入队列或者由当前线程执行）的数量，总是前面的一部分
+    std::size_t pushBatch(std::vector<Task> &tasks)
+    {
+        if (isStopped())
+        {
+            countSubmitted(0, tasks.size());
+            return 0;
+        }
+        // 打开时间线时每个任务一个不重复的提交时间，作为任务的 id
+        std::vector<int64_t> stamps;
+        if (trace_.enabled())
+        {
+            stamps.reserve(tasks.size());
+            for (Task &task : tasks)
+            {
+                stamps.push_back(trace_.stamp());
+                task.setEnqueueTime(stamps.back());
+            }
+        }
+        else if (statsEnabled_)
+        {
+            int64_t now = detail::statsNowNs();
+            for (Task &task : tasks)
+                task.setEnqueueTime(now);
+        }
+        std::size_t pushed = enqueueBatch(tasks, SubmitWait(rejectPolicy_, submitTimeout_, false));
+        countSubmitted(pushed, 0);
+        // 放不下的部分按拒绝策略逐个处理，由当前线程执行的任务不算拒绝
+        std::size_t accepted = pushed;
+        while (accepted < tasks.size())
+        {
+            if (rejectPolicy_ == RejectPolicy::REJECT_CALLER_RUNS)
+            {
+                tasks[accepted]();
+            }
+            else if (rejectPolicy_ == RejectPolicy::REJECT_DISCARD_OLDEST)
+            {
+                Task evicted;
+                bool ok = enqueue(tasks[accepted], TaskPriority::PRIORITY_NORMAL, SubmitWait(rejectPolicy_, submitTimeout_, true), evicted);
+                countSubmitted(ok ? 1 : 0, evicted != nullptr ? 1 : 0);
+                if (!ok)
+                    break;
+            }
+            else
+            {
+                break;
+            }
+            accepted++;
+        }
+        countSubmitted(0, tasks.size() - accepted);
+        trace_.recordBatch(stamps, accepted);
+        return accepted;
+    }
+
+    // 打开统计时记录提交时间；打开时间线时提交时间同时是任务的 id，返回它，没有打开时间线返回0
+    int64_t stampTask(Task &task)
+    {
+        if (trace_.enabled())
+        {
+            int64_t stamp = trace_.stamp();
+            task.setEnqueueTime(stamp);
+            return stamp;
+        }
+        if (statsEnabled_)
+            task.setEnqueueTime(detail::statsNowNs());
+        return 0;
+    }
+
+    // 获取 taskQueueMtx_，打开时间线时记录等锁的时间
+    std::unique_lock<std::mutex> lockQueue()
+    {
+        return trace_.lock(taskQueueMtx_);
+    }
+
+    // 更新提交数量、拒绝数量和排队任务数量的最大值，拒绝数量总是统计
+    void countSubmitted(std::size_t submitted, std::size_t rejected)
+    {
+        if (rejected > 0)
+            rejected_.fetch_add(rejected, std::memory_order_relaxed);
+        if (statsEnabled_ && submitted > 0)
+        {
+            submitted_.fetch_add(submitted, std::memory_order_relaxed);
+            updateHighWater(queueHighWater_, taskCnt_.load(std::memory_order_relaxed));
+        }
+    }
+
+    // pushTask 的实现：私有队列 / 无锁队列 / 加锁的多级队列
+    // 只有放入队列时才移走 task；REJECT_DISCARD_OLDEST 策略下被挤掉的任务放在 evicted 里
+    bool enqueue(Task &task, TaskPriority priority, const SubmitWait &wait, Task &evicted)
+    {
+        // 线程池里面的线程提交的普通优先级任务（任务里面再提交任务），直接放入该线程自己的任务队列，
+        // 不经过全局的 taskQueueMtx_，空闲的线程会过来偷取
+        // 其他优先级的任务要放入全局的多级队列，才能按优先级调度；线程池线程不能等待队列腾出位置
+        // （所有线程都在等待时会死锁），队列满了也超额放入
+        Worker *self = currentWorker();
+        if (self != nullptr && self->pool_ == this)
+        {
+            if (priority == TaskPriority::PRIORITY_NORMAL)
+                pushLocal(self, std::move(task));
+            else
+                pushUnbounded(task, priority);
+            return true;
+        }
+
+        if (queueMode_ == QueueMode::MODE_LOCKFREE)
+        {
+            if (!pushLockFree(task, priority, wait, evicted))
+            {
+                return false;
+            }
+            // cached模式下到了采样时间才获取锁
+            if (poolMode_ == PoolMode::MODE_CACHED && sizer_.due())
+            {
+                std::unique_lock<std::mutex> lock = lockQueue();
+                growThreads();
+            }
+            return true;
+        }
 
         // 获取锁
-        std::unique_lock<std::mutex> lock(taskQueueMtx_);
+        std::unique_lock<std::mutex> lock = lockQueue();
         // 线程的通信    等待任务队列有空余
         //  while(taskCnt_==taskQueueMaxThreshHold_){
         //      notFull_.wait(lock);
@@ -184,36 +852,222 @@ public:
         // wait:一直等待，直到条件满足，再进行后续操作
         // wait_for:等待有时长限制，比如3s，1s，时间一到，不再等待
         // wait_until:设置等待时间的截止点
-        //  用户提交任务最长不能阻塞超过1s，否则判断题脚任务失败
-        if (!notFull_.wait_for(lock, std::chrono::seconds(1), [&]() -> bool
-                               { return taskQueue_.size() < (size_t)taskQueueMaxThreshHold_; }))
-        {
-            // 返回false，表示notFull_等待1s，条件依然没有满足
-            std::cerr << "task queue is full,submit task fail." << std::endl;
-            LOG("task queue is full,submit task fail.");
-            auto temp = std::make_shared<std::packaged_task<RType()>>(
-                []() -> RType
-                { return RType(); });
-            return temp->get_future();
-        }
-        // 如果有空余，把任务放入任务队列中
-        //using Task = std::future<void()>;
-        //std::queue<Task> taskQueue_; // 任务队列 类型
-        taskQueue_.emplace([task](){
-            //去执行下面的任务
-            (*task)();
-        });
+        //  等待多久由拒绝策略决定，默认最长不能阻塞超过1s，否则判断提交任务失败
+        if (!wait.wait(notFull_, lock, [&]() -> bool
+                       { return taskQueue_.size() < (size_t)taskQueueMaxThreshHold_; }))
+        {
+            // 返回false，表示等待结束，条件依然没有满足
+            // REJECT_DISCARD_OLDEST：丢弃一个不比新任务重要的最早的任务，给新任务腾出位置
+            TaskPriority evictedPriority;
+            if (rejectPolicy_ != RejectPolicy::REJECT_DISCARD_OLDEST || !taskQueue_.popOldest(evicted, priority, &evictedPriority))
+                return false;
+            taskPopped(evictedPriority);
+        }
+        // 如果有空余，把任务放入全局任务队列中
+        taskQueue_.emplace(std::move(task), priority);
+        injectCnt_++;
+        if (priority == TaskPriority::PRIORITY_HIGH)
+            highCnt_++;
         taskCnt_++;
-        // 因为新放了任务，任务队列肯定不空了，在notEmpty_上进行通知
-        notEmpty_.notify_all();
 
         // cached模式，任务处理比较紧急 场景：小而快的任务，
-        // 需要根据任务数量和空闲线程的数量，判断是否需要创建新的线程出来？
-        if (poolMode_ == PoolMode::MODE_CACHED && taskCnt_ > idleThreadSize_ && curThreadSize_ < maxThreadSize_)
+        // 需要根据排队时间和吞吐量，判断是否需要创建新的线程出来？
+        growThreads();
+        lock.unlock();
+
+        // 因为新放了任务，任务队列肯定不空了，只唤醒一个最近空闲的线程
+        idleWorkers_.wakeOne();
+
+        return true;
+    }
+
+    // 不受 taskQueueMaxThreshHold_ 限制，把任务放入全局队列，用于不能等待也不能丢弃的任务
+    // 无锁模式下环形队列的容量是固定的，放不下的任务暂存在 taskQueue_ 里，取任务时先取它们
+    void pushUnbounded(Task &task, TaskPriority priority)
+    {
+        bool high = priority == TaskPriority::PRIORITY_HIGH;
+        // 先增加任务计数再放入队列，和挂起线程的检查配合避免丢失通知
+        taskCnt_++;
+        injectCnt_++;
+        if (high)
+            highCnt_++;
+        if (queueMode_ != QueueMode::MODE_LOCKFREE || !lockFreeQueue_->tryPush(std::move(task), priority))
+        {
+            std::unique_lock<std::mutex> lock = lockQueue();
+            taskQueue_.emplace(std::move(task), priority);
+            if (queueMode_ == QueueMode::MODE_LOCKFREE)
+                overflowCnt_++;
+            growThreads();
+        }
+        idleWorkers_.wakeOne();
+    }
+
+    // 其他时钟的时间点换算成 steady_clock
+    template <typename Clock, typename Duration>
+    static std::chrono::steady_clock::time_point toSteady(const std::chrono::time_point<Clock, Duration> &when)
+    {
+        return std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(when - Clock::now());
+    }
+
+    static std::chrono::steady_clock::time_point toSteady(const std::chrono::steady_clock::time_point &when)
+    {
+        return when;
+    }
+
+    // 线程池线程把任务放入自己的私有队列，不获取全局的 taskQueueMtx_
+    void pushLocal(Worker *self, Task task)
+    {
+        // 私有队列太长时先尝试放入全局队列
+        if (self->localQueue_.size() >= LOCAL_QUEUE_MAX && spillTask(task))
+            return;
+        // 先增加任务计数，再放入队列：准备挂起的线程要么看到任务计数，要么被下面的通知唤醒
+        taskCnt_++;
+        self->localQueue_.push(std::move(task));
+        // 有空闲线程才唤醒一个过来偷取
+        idleWorkers_.wakeOne();
+    }
+
+    // 私有队列超过 LOCAL_QUEUE_MAX 时，把任务放入全局队列；全局队列满了不等待，返回false
+    bool spillTask(Task &task)
+    {
+        if (queueMode_ == QueueMode::MODE_LOCKFREE)
         {
-            LOG("Create new Thread!!!");
+            taskCnt_++;
+            injectCnt_++;
+            if (!lockFreeQueue_->tryPush(std::move(task)))
+            {
+                injectCnt_--;
+                taskCnt_--;
+                return false;
+            }
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock = lockQueue();
+            if (taskQueue_.size() >= (size_t)taskQueueMaxThreshHold_)
+                return false;
+            taskQueue_.emplace(std::move(task));
+            injectCnt_++;
+            taskCnt_++;
+        }
+        idleWorkers_.wakeOne();
+        return true;
+    }
+
+    // pushBatch 的实现，放不下时按 wait 等待，返回放入的数量
+    std::size_t enqueueBatch(std::vector<Task> &tasks, const SubmitWait &wait)
+    {
+        // 线程池里面的线程提交的，整批放入自己的私有队列
+        Worker *self = currentWorker();
+        if (self != nullptr && self->pool_ == this)
+        {
+            // 超出私有队列上限的部分尽量放入全局队列
+            std::size_t size = self->localQueue_.size();
+            std::size_t room = size < LOCAL_QUEUE_MAX ? LOCAL_QUEUE_MAX - size : 0;
+            std::size_t local = tasks.size();
+            while (local > room && spillTask(tasks[local - 1]))
+                local--;
+            taskCnt_ += local;
+            self->localQueue_.pushBatch(std::make_move_iterator(tasks.begin()), std::make_move_iterator(tasks.begin() + local));
+            idleWorkers_.wake(local);
+            return tasks.size();
+        }
+
+        std::size_t pushed = 0;
+        std::size_t woken = 0;
+        if (queueMode_ == QueueMode::MODE_LOCKFREE)
+        {
+            while (pushed < tasks.size())
+            {
+                taskCnt_++;
+                injectCnt_++;
+                if (lockFreeQueue_->tryPush(std::move(tasks[pushed])))
+                {
+                    pushed++;
+                    continue;
+                }
+                injectCnt_--;
+                taskCnt_--;
+
+                // 队列满了，先唤醒线程去执行已经放入的任务，再等待队列腾出空间
+                idleWorkers_.wake(pushed - woken);
+                woken = pushed;
+                if (!wait.mayWait())
+                    break;
+                std::unique_lock<std::mutex> lock = lockQueue();
+                waitingProducers_++;
+                bool notFull = wait.wait(notFull_, lock, [&]() -> bool
+                                         { return !lockFreeQueue_->full(TaskPriority::PRIORITY_NORMAL); });
+                waitingProducers_--;
+                if (!notFull)
+                    break;
+            }
+            idleWorkers_.wake(pushed - woken);
+            std::unique_lock<std::mutex> lock = lockQueue();
+            growThreads();
+            return pushed;
+        }
+
+        // 整批任务只获取一次锁
+        std::unique_lock<std::mutex> lock = lockQueue();
+        while (pushed < tasks.size())
+        {
+            if (!wait.wait(notFull_, lock, [&]() -> bool
+                           { return taskQueue_.size() < (size_t)taskQueueMaxThreshHold_; }))
+                break;
+            while (pushed < tasks.size() && taskQueue_.size() < (size_t)taskQueueMaxThreshHold_)
+            {
+                taskQueue_.emplace(std::move(tasks[pushed++]));
+                injectCnt_++;
+                taskCnt_++;
+            }
+            // 唤醒线程去执行已经放入的任务，队列满的时候这样才能腾出空间
+            idleWorkers_.wake(pushed - woken);
+            woken = pushed;
+        }
+        // 队列还有空余，把通知传给下一个等待的提交线程
+        if (taskQueue_.size() < (size_t)taskQueueMaxThreshHold_)
+            notFull_.notify_one();
+        growThreads();
+        return pushed;
+    }
+
+    // cached模式下按调节器的采样结果增减线程，调用时已经持有 taskQueueMtx_
+    void growThreads()
+    {
+        if (poolMode_ != PoolMode::MODE_CACHED)
+            return;
+        reapThreads();
+        int retire = 0;
+        int grow = sizer_.sample(taskCnt_, idleThreadSize_, curThreadSize_, minThreads(), (int)maxThreadSize_, &retire);
+        for (int i = 0; i < grow; i++)
+        {
+            if (!addThread())
+                break;
+        }
+        // 唤醒空闲线程去领取退出名额
+        if (retire > 0)
+            idleWorkers_.wake(retire);
+    }
+
+    // cached模式下最少保留的线程数量
+    int minThreads() const
+    {
+        int minThreads = sizer_.policy().minThreads_;
+        return minThreads > 0 ? minThreads : (int)initThreadSize_;
+    }
+
+    // cached模式下找一个空闲的线程槽位创建新线程，调用时已经持有 taskQueueMtx_
+    bool addThread()
+    {
+        for (std::size_t i = 0; i < workers_.size(); i++)
+        {
+            if (workers_[i]->active_)
+                continue;
+            LOG_DEBUG("Create new Thread!!!");
+            workers_[i]->active_ = true;
             // 创建新线程
-            std::unique_ptr<Thread> ptr(new Thread(std::bind(&ThreadPool2::threadFunc, this, std::placeholders::_1)));
+            std::unique_ptr<Thread> ptr(new Thread(std::bind(&ThreadPool2::threadFunc, this, std::placeholders::_1, i)));
             int threadId = ptr->getId();
             threads_.emplace(threadId, std::move(ptr));
             // 启动新的线程对象
@@ -221,125 +1075,365 @@ public:
             // 修改线程个数相关的变量
             idleThreadSize_++;
             curThreadSize_++;
+            return true;
         }
+        return false;
+    }
 
-        // 返回任务的 Result 对象
-        return result;
+    // 无锁模式下把任务放入全局队列，队列满时按 wait 等待，只有放入时才移走 task
+    bool pushLockFree(Task &task, TaskPriority priority, const SubmitWait &wait, Task &evicted)
+    {
+        bool high = priority == TaskPriority::PRIORITY_HIGH;
+        for (;;)
+        {
+            // 先增加任务计数再放入队列，和挂起线程的检查配合避免丢失通知
+            taskCnt_++;
+            injectCnt_++;
+            if (high)
+                highCnt_++;
+            if (lockFreeQueue_->tryPush(std::move(task), priority))
+                break;
+            if (high)
+                highCnt_--;
+            injectCnt_--;
+            taskCnt_--;
+
+            // REJECT_DISCARD_OLDEST：每一级队列单独计算容量，丢弃同一优先级里最早的任务，只丢弃一个
+            if (rejectPolicy_ == RejectPolicy::REJECT_DISCARD_OLDEST && evicted == nullptr && lockFreeQueue_->tryPopLevel(evicted, priority))
+            {
+                taskPopped(priority);
+                continue;
+            }
+            if (!wait.mayWait())
+                return false;
+
+            // 队列满了才使用条件变量等待
+            std::unique_lock<std::mutex> lock = lockQueue();
+            waitingProducers_++;
+            bool notFull = wait.wait(notFull_, lock, [&]() -> bool
+                                     { return !lockFreeQueue_->full(priority); });
+            waitingProducers_--;
+            if (!notFull)
+                return false;
+        }
+
+        // 只有有线程空闲时才需要唤醒，只唤醒一个
+        idleWorkers_.wakeOne();
+        return true;
     }
 
-    // 禁用拷贝构造函数
-    ThreadPool2(const ThreadPool2 &) = delete;
+    // 获取一个任务：私有队列（LIFO） =》 全局队列 / 租户队列 =》 从其他线程的队列偷取（FIFO）
+    // 全局队列里面有高优先级的任务时，先取全局队列；取到租户的任务时 ticket 记录结算用的凭证
+    bool acquireTask(Worker *self, Task &task, FairTicket &ticket)
+    {
+        if (highCnt_ > 0 && popInjected(task))
+            return true;
 
-    // 禁用拷贝构造函数
-    ThreadPool2 &operator=(const ThreadPool2 &) = delete;
+        if (self->localQueue_.pop(task))
+        {
+            taskCnt_--;
+            return true;
+        }
+
+        // 全局队列和租户队列轮流优先，全局队列一直有任务时租户也不会被饿死
+        bool fairFirst = fairCnt_ > 0 && (self->fairTurn_ = !self->fairTurn_);
+        if (fairFirst && popFair(task, ticket))
+            return true;
+        if (popInjected(task))
+            return true;
+        if (!fairFirst && popFair(task, ticket))
+            return true;
+
+        // 按槽位的偷取顺序依次偷取，同一NUMA节点的线程优先
+        for (std::size_t victimIndex : self->stealOrder_)
+        {
+            Worker *victim = workers_[victimIndex].get();
+            if (victim->localQueue_.steal(task))
+            {
+                taskCnt_--;
+                if (statsEnabled_)
+                    self->stats_.taskStolen();
+                if (trace_.enabled())
+                    trace_.record(TraceEventType::TRACE_STEAL, detail::statsNowNs(), 0, (int64_t)victimIndex);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 工作线程等待结果时帮忙执行一个任务，没有任务返回false
+    bool helpOne(Worker *self)
+    {
+        Task task;
+        FairTicket ticket;
+        if (!acquireTask(self, task, ticket))
+            return false;
+        runTask(self, task, ticket);
+        sampleSizing();
+        return true;
+    }
+
+    // 不是工作线程的线程从任意一个工作线程的队列偷取任务
+    bool stealAny(Task &task)
+    {
+        for (const std::unique_ptr<Worker> &victim : workers_)
+        {
+            if (victim->localQueue_.steal(task))
+            {
+                taskCnt_--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 执行一个取到的任务，统计执行时间；租户的任务按执行时间结算额度
+    // 不是工作线程（self 为nullptr）时不记录线程的统计，时间线记录在当前线程上
+    void runTask(Worker *self, Task &task, const FairTicket &ticket)
+    {
+        bool timed = statsEnabled_ || ticket.tenant_ != nullptr || trace_.enabled();
+        int64_t start = timed ? detail::statsNowNs() : 0;
+        // 当前线程负责执行这个任务
+        if (task != nullptr)
+        {
+            // SHUTDOWN_CANCEL_PENDING 以后取到的任务不再执行，直接取消（不能取消的内部任务照常执行）
+            if (!cancelPending_ || !task.cancel())
+                task(); // 执行 TaskFunction
+        }
+        if (!timed)
+            return;
+        int64_t end = detail::statsNowNs();
+        if (ticket.tenant_ != nullptr)
+            FairShareQueue<Task>::finish(ticket, end - start);
+        if (statsEnabled_ && self != nullptr)
+            self->stats_.taskDone(task.enqueueTime(), start, end);
+        if (trace_.enabled())
+            trace_.record(TraceEventType::TRACE_TASK, start, end - start, task.enqueueTime());
+    }
+
+    // 执行完一个任务以后调用
+    // cached模式下统计吞吐量；一次提交了很多任务时后面没有提交来触发采样，由工作线程采样
+    void sampleSizing()
+    {
+        if (poolMode_ == PoolMode::MODE_CACHED)
+        {
+            sizer_.taskDone();
+            if (sizer_.due())
+            {
+                std::unique_lock<std::mutex> lock = lockQueue();
+                growThreads();
+            }
+        }
+    }
+
+    // 从全局的多级任务队列里面按优先级取一个任务
+    bool popInjected(Task &task)
+    {
+        if (injectCnt_ == 0)
+            return false;
+        TaskPriority priority;
+        if (queueMode_ == QueueMode::MODE_LOCKFREE)
+        {
+            // 环形队列满时超额放入的任务放得更早，先取
+            if (overflowCnt_ > 0)
+            {
+                std::unique_lock<std::mutex> lock = lockQueue();
+                if (taskQueue_.pop(task, &priority))
+                {
+                    overflowCnt_--;
+                    taskPopped(priority);
+                    return true;
+                }
+            }
+            if (!lockFreeQueue_->tryPop(task, &priority))
+                return false;
+            taskPopped(priority);
+            // 只有真的有提交线程在等待时才去碰锁和条件变量
+            // 每个优先级的队列单独计算容量，空出的位置不一定是等待的线程需要的，所以全部通知
+            if (waitingProducers_ > 0)
+            {
+                std::unique_lock<std::mutex> lock = lockQueue();
+                notFull_.notify_all();
+            }
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lock = lockQueue();
+        // 从任务队列中按优先级取一个任务出来
+        if (!taskQueue_.pop(task, &priority))
+            return false;
+        taskPopped(priority);
+        // 取出一个任务，空出一个位置，通知一个等待的提交线程
+        notFull_.notify_one();
+        return true;
+    }
+
+    // 从租户队列按公平调度取一个任务
+    bool popFair(Task &task, FairTicket &ticket)
+    {
+        if (fairCnt_ == 0)
+            return false;
+        std::unique_lock<std::mutex> lock = lockQueue();
+        if (!fairQueue_.pop(task, ticket))
+            return false;
+        fairCnt_--;
+        taskCnt_--;
+        // 等待的提交线程可能在等不同的租户，全部通知
+        tenantNotFull_.notify_all();
+        return true;
+    }
+
+    // 从全局队列取出任务后更新计数
+    void taskPopped(TaskPriority priority)
+    {
+        if (priority == TaskPriority::PRIORITY_HIGH)
+            highCnt_--;
+        injectCnt_--;
+        taskCnt_--;
+    }
 
-private:
     // 定义线程函数
-    void threadFunc(int threadId)
-    {
-        // 操作过程
-#if 0
-// 获取锁
-std::unique_lock<std::mutex> lock(taskQueueMtx_);
-// 判断队列是否为空
-// while (taskCnt_ == 0)
-// {
-//     notEmpty_.wait(lock);
-// }
-notEmpty_.wait(lock, [&]() -> bool
-               { return taskCnt_ > 0; });
-// 有生产者放入了任务
-std::shared_ptr<Task> task = taskQueue_.front();
-task->run();
-taskQueue_.pop();
-taskCnt_--;
-notFull_.notify_all();
-#else
-        auto lastTime = std::chrono::high_resolution_clock().now();
+    void threadFunc(int threadId, std::size_t index)
+    {
+        Worker *self = workers_[index].get();
+        currentWorker() = self;
+        WaitHelper::current() = self;
+        if (!detail::pinCurrentThread(self->cpus_))
+            LOG_WARN("pin worker thread to cpu fail, slot:" << index);
+        bool stats = statsEnabled_;
+        bool traced = trace_.enabled();
+        self->stats_.setActive(true);
+        if (traced)
+            trace_.bindWorker(index);
 
         // 所有任务必须执行完成，线程池才可以回收所有线程资源
         for (;;)
         {
             ThreadPool2::Task task;
+            FairTicket ticket;
+            // 私有队列、全局队列、租户队列、偷取都没有拿到任务，才去挂起
+            if (!acquireTask(self, task, ticket))
             {
-                // 先获取锁
-                std::unique_lock<std::mutex> lock(taskQueueMtx_);
-                std::cout << "tid:" << std::this_thread::get_id() << "尝试获取任务..." << std::endl;
-
-                // 锁 + 双重判断
-                // 以解决 FIXED模式下，在该循环死锁的问题，notify后while条件仍然为true，然后进行wait（）产生死锁
-                while (taskCnt_ == 0)
+                int64_t parkStart = stats || traced ? detail::statsNowNs() : 0;
+                // 先按空闲策略自旋、让出CPU，这期间看到新任务就回去取，不用挂起；线程池结束时去 park 里退出
+                WakeSource source = detail::idleWait(idleStrategy_, [this]() -> bool
+                                                     { return taskCnt_ != 0 || !isRunning_; });
+                // 线程退出以后线程池可能马上被析构，不能再访问槽位
+                if ((source == WakeSource::WAKE_PARK || !isRunning_) && !park(threadId, self))
+                    return; // 线程函数结束，线程结束
+                if (stats)
                 {
-                    // 线程池要结束，回收线程资源
-                    if (!isRunning_)
-                    {
-                        threads_.erase(threadId);
-                        exitCond_.notify_all();
-                        std::cout << "threadid:" << std::this_thread::get_id() << "exit!!" << std::endl;
-                        return; // 线程函数结束，线程结束
-                    }
-                    if (poolMode_ == PoolMode::MODE_CACHED)
-                    {
-                        // 条件变量超时返回
-                        //  cached模式下，有可能已经创建了很多的线程，但是空闲时间超过60s，
-                        //  应该把多余的线程结束回收掉（超过initThreadSize_数量的线程要进行回收）
-                        // 当前时间 - 上一次线程执行的时间 > 60s
-
-                        //  每一秒钟返回一次     怎么区分，超时返回？还是有任务待执行返回
-                        if (std::cv_status::timeout == notEmpty_.wait_for(lock, std::chrono::seconds(1)))
-                        {
-                            auto now = std::chrono::high_resolution_clock().now();
-                            // 转换为 s
-                            auto dur = std::chrono::duration_cast<std::chrono::seconds>(now - lastTime);
-                            if (dur.count() >= THREAD_MAX_IDLE_TIME && curThreadSize_ > initThreadSize_)
-                            {
-                                // 开始回收当前线程
-                                // 记录线程数量相关的值的修改
-                                // 把线程对象从线程列表容器中删除   没有办法  threadFunc <=> thread 对象
-                                // thread_id ---->线程对象
-                                threads_.erase(threadId);
-                                curThreadSize_--;
-                                idleThreadSize_--;
-                                std::cout << "threadid:" << std::this_thread::get_id() << "exit!!" << std::endl;
-                                return;
-                            }
-                        }
-                    }
-                    else
-                    {
-                        // 等待empty条件
-                        notEmpty_.wait(lock);
-                    }
+                    self->stats_.idleFor(detail::statsNowNs() - parkStart);
+                    self->stats_.wokeFrom(source);
                 }
-                idleThreadSize_--;
-                std::cout << "tid:" << std::this_thread::get_id() << "获取任务成功" << std::endl;
-                // 从任务队列中取一个任务出来
-                task = taskQueue_.front();
-                taskQueue_.pop();
-                taskCnt_--;
+                if (traced)
+                    trace_.recordSince(TraceEventType::TRACE_IDLE, parkStart, (int64_t)source);
+                // 被唤醒了，重新去各个队列里面取
+                continue;
+            }
 
-                // 如果依然有剩余任务，继续通知其他的线程执行任务
-                if (taskCnt_ > 0)
-                    notEmpty_.notify_all();
+            idleThreadSize_--;
+            runTask(self, task, ticket);
+            idleThreadSize_++;
+            sampleSizing();
+        }
+    }
 
-                // 取出一个任务，进行通知,通知可以继续提交生产任务
-                notFull_.notify_all();
-            } // 就应该把锁释放掉
-            // 当前线程负责执行这个任务
-            if (task!=nullptr)
+    // 没有任务时挂起在自己的槽位上，返回false表示线程要退出
+    bool park(int threadId, Worker *self)
+    {
+        // 先登记为空闲线程，再检查任务数量：提交任务的线程先增加任务计数，再看有没有空闲线程，
+        // 两边至少有一边能看到对方，唤醒不会丢失
+        Completion &slot = self->parkSlot_;
+        slot.reset();
+        idleWorkers_.push(&slot);
+        if (taskCnt_ != 0)
+        {
+            leaveIdle(slot);
+            return true;
+        }
+        // 线程池要结束，回收线程资源
+        if (!isRunning_)
+        {
+            leaveIdle(slot);
             {
-                // task->run();    //执行任务；把任务的返回值通过setVal方法给到Result
-                task(); //执行 function<void()>
+                std::unique_lock<std::mutex> lock = lockQueue();
+                exitThread(threadId, self);
             }
+            LOG_DEBUG("thread exit!!");
+            return false;
+        }
+        if (poolMode_ != PoolMode::MODE_CACHED)
+        {
+            // 等待被唤醒
+            slot.wait();
+            return true;
+        }
 
-            idleThreadSize_++;
-            // 更新线程执行完的时间
-            lastTime = std::chrono::high_resolution_clock().now();
+        // cached模式下，超过最少线程数量的线程只做一次 keepAlive 的定时等待，到期还没有任务就退出
+        if (curThreadSize_ <= minThreads())
+            slot.wait();
+        else if (!slot.waitFor(sizer_.policy().keepAlive_))
+        {
+            if (!idleWorkers_.remove(&slot))
+            {
+                // 超时的同时被唤醒了，继续工作
+                slot.wait();
+                return true;
+            }
+            return !retire(threadId, self);
         }
+        // 被唤醒：有新任务，或者调节器在负载持续很低时让空闲线程退出
+        if (taskCnt_ == 0 && isRunning_ && sizer_.takeRetireCredit())
+            return !retire(threadId, self);
+        return true;
+    }
+
+    // cached模式下回收当前线程，线程数量已经降到最少时不回收，返回是否回收
+    bool retire(int threadId, Worker *self)
+    {
+        {
+            std::unique_lock<std::mutex> lock = lockQueue();
+            if (curThreadSize_ <= minThreads())
+                return false;
+            // 记录线程数量相关的值的修改
+            // 把线程对象从线程列表容器中删除   没有办法  threadFunc <=> thread 对象
+            // thread_id ---->线程对象
+            curThreadSize_--;
+            idleThreadSize_--;
+            exitThread(threadId, self);
+        }
+        LOG_DEBUG("thread exit!!");
+        return true;
+    }
+
+    // 离开空闲栈：如果槽位已经被其他线程弹出，要等它的唤醒完成，槽位才能复用
+    void leaveIdle(Completion &slot)
+    {
+        if (!idleWorkers_.remove(&slot))
+            slot.wait();
+    }
+
+    // 线程退出，调用时已经持有 taskQueueMtx_
+    void exitThread(int threadId, Worker *self)
+    {
+        self->active_ = false;
+        self->stats_.setActive(false);
+        currentWorker() = nullptr;
+        WaitHelper::current() = nullptr;
+        // 线程对象留到 join 以后再销毁
+        exited_.push_back(std::move(threads_[threadId]));
         threads_.erase(threadId);
         exitCond_.notify_all();
-        std::cout << "threadid:" << std::this_thread::get_id() << "exit!!" << std::endl;
-        return;
+    }
+
+    // join 已经退出的线程，调用时已经持有 taskQueueMtx_
+    // 退出的线程登记以后不再获取锁，马上就会返回，这里不会等待很久
+    void reapThreads()
+    {
+        for (std::unique_ptr<Thread> &thread : exited_)
+            thread->join();
+        exited_.clear();
     }
 
     // 检查pool的运行状态
@@ -352,27 +1446,58 @@ private:
     // TODO:下划线加在命名后面，为了避免与linux系统库产生冲突，开源代码的编码习惯
     // std::vector<std::unique_ptr<Thread>> threads_; // 线程列表
     std::unordered_map<int, std::unique_ptr<Thread>> threads_;
+    std::vector<std::unique_ptr<Thread>> exited_;  // 已经退出、还没有 join 的线程
+    std::vector<std::unique_ptr<Worker>> workers_; // 线程槽位，启动后大小不再变化
     std::size_t initThreadSize_;     // 初始的线程数量
     std::size_t maxThreadSize_;      // 线程数量上限阈值
     std::atomic_int curThreadSize_;  // 记录当前线程池里面线程的总数量
     std::atomic_int idleThreadSize_; // 记录空闲线程的数量
 
-    // Task任务 =》 函数对象
-    using Task = std::function<void()>;
-    std::queue<Task> taskQueue_; // 任务队列
+    PriorityTaskQueue<Task> taskQueue_; // 全局的多级任务队列，线程池外部提交的任务放在这里；无锁模式下只放超额放入的任务
+
+    std::atomic_uint taskCnt_;   // 任务的数量（全局队列 + 所有私有队列）
+    std::atomic_uint injectCnt_; // 全局任务队列中的任务数量
+    std::atomic_uint highCnt_;   // 全局任务队列中高优先级任务的数量
 
-    std::atomic_uint taskCnt_;   // 任务的数量
+    FairShareQueue<Task> fairQueue_;           // 租户的任务队列，由 taskQueueMtx_ 保护
+    std::atomic_uint fairCnt_;                 // 租户队列中的任务数量
+    std::atomic<std::size_t> tenantCnt_;       // 租户的数量，提交时不加锁检查租户是否存在
+    std::condition_variable tenantNotFull_;    // 租户的队列不满
     int taskQueueMaxThreshHold_; // 任务队列数量上限的阈值
 
-    std::mutex taskQueueMtx_; // 保证任务队列的线程安全
+    QueueMode queueMode_;                          // 全局任务队列的实现方式
+    std::unique_ptr<LockFreePriorityQueue<Task>> lockFreeQueue_; // 无锁模式下的全局任务队列
+    std::atomic_int waitingProducers_;             // 无锁模式下等待队列不满的提交线程数量
+    std::atomic_uint overflowCnt_;                 // 无锁模式下超额放入 taskQueue_ 的任务数量
+
+    mutable std::mutex taskQueueMtx_; // 保证任务队列的线程安全
     /*
     condition_variable type
     notFull/notEmpty
     */
     std::condition_variable notFull_;  // 表示任务队列不满
-    std::condition_variable notEmpty_; // 表示任务队列不空
+    IdleStack idleWorkers_;            // 空闲线程栈，有新任务时只唤醒栈顶的一个线程
     std::condition_variable exitCond_; // 等待线程执行完毕
 
+    std::unique_ptr<TimerWheel> timerWheel_; // 延迟任务和周期任务的时间轮
+
+    SizingController sizer_; // cached模式的线程数量调节器
+    IdleStrategy idleStrategy_; // 工作线程空闲时的等待策略
+
+    bool statsEnabled_;                         // 是否统计排队时间、执行时间等
+    std::atomic<uint64_t> submitted_;           // 成功提交的任务数量
+    std::atomic<uint64_t> rejected_;            // 队列满提交失败的任务数量
+    std::atomic<std::size_t> queueHighWater_;   // 排队任务数量的最大值
+    TraceRecorder trace_;                       // 任务时间线
+
+    RejectPolicy rejectPolicy_;                 // 队列满时的处理策略
+    std::chrono::milliseconds submitTimeout_;   // REJECT_TIMEOUT 策略的最长等待时间
+    MemoryResource *resource_;                  // Future 共享状态的内存来源
+
+    std::atomic_bool stopping_;      // 已经调用 shutdown，不再接受外部提交的任务
+    std::atomic_bool cancelPending_; // 取到的任务不再执行，直接取消
+    std::atomic_bool abort_;         // 正在执行的任务的 CancellationToken 变成已取消
+
     PoolMode poolMode_; // 线程池的工作模式
 
     // 表示当前线程池的启动状态
@@ -380,5 +1505,3 @@ private:
 };
 
 #endif
-
-#endif
\ No newline at end of file
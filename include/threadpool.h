@@ -11,80 +11,231 @@
 #include <thread>
 #include <public.h>
 #include <unordered_map>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <mpmcQueue.hpp>
+#include <slabAllocator.hpp>
+#include <workStealingQueue.hpp>
+#include <taskFuture.hpp>
+#include <completion.hpp>
+#include <idleStack.hpp>
+#include <priorityQueue.hpp>
+#include <cpuTopology.hpp>
+#include <adaptiveSizing.hpp>
+#include <poolStats.hpp>
+#include <backpressure.hpp>
+#include <waitHelper.hpp>
+#include <cancellation.hpp>
+#include <idleStrategy.hpp>
+#include <traceRecorder.hpp>
 
 /*
 模版代码的实现只能写在头文件中
 编译阶段进行实例化，实例化之后才能产生真正的可执行的函数
 */
 // Any类型：可以接受任意数据的类型
+/*
+小对象直接保存在Any对象内部（unsigned long long、指针、小结构体），不需要堆内存，
+大对象才放到堆上（从 slabResource() 的线程缓存分配）；取值时把数据移动出来，所以只能移动的类型也可以保存；
+类型检查比较的是每个类型唯一的一个静态变量地址，不需要RTTI和dynamic_cast
+*/
 class Any
 {
 public:
-    Any() = default;
+    static const std::size_t INLINE_SIZE = 32;
+
+    Any() : ops_(nullptr)
+    {
+    }
+
+    // nullptr表示空的Any
+    Any(std::nullptr_t) : ops_(nullptr)
+    {
+    }
 
-    ~Any() = default;
+    ~Any()
+    {
+        reset();
+    }
 
-    // 禁止左值构造函数，因为该类中有一个unique_ptr，该成员是禁止左值构造的
+    // 禁止左值构造函数，Any只能移动
     //拷贝构造
     Any(const Any &) = delete;
     Any &operator=(const Any &) = delete;
     // 右值构造
     //移动构造
-    Any(Any &&) = default;
-    Any &operator=(Any &&) = default;
+    Any(Any &&other) noexcept : ops_(other.ops_)
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->move(&storage_, &other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+    Any &operator=(Any &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            ops_ = other.ops_;
+            if (ops_ != nullptr)
+            {
+                ops_->move(&storage_, &other.storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
 
-    // 这个构造函数可以让Any类型接受任意其他的数据
-    template <typename T>
-    Any(T data) : base_(new Derive<T>(data)) // C++14 std::make_unique<Derive<T>>(data)
+    // 这个构造函数可以让Any类型接受任意其他的数据，右值会被移动进来
+    template <typename T,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<T>::type, Any>::value &&
+                                                 !std::is_same<typename std::decay<T>::type, std::nullptr_t>::value>::type>
+    Any(T &&data) : ops_(nullptr)
     {
+        typedef typename std::decay<T>::type U;
+        init<U>(std::forward<T>(data), std::integral_constant<bool, fitsInline<U>()>());
     }
 
     // 这个方法能把Any对象里面存储的data数据提取出来
+    // 数据是移动出来的，提取之后Any里面只剩下被移动过的对象
     template <typename T>
     T cast_()
     {
-        // 我们怎么从base_找到他所指向的Derive对象，从它里面取出data成员变量
-        // 基类指针 =》 派生类指针      RTTI类型识别转换
-        Derive<T> *pd = dynamic_cast<Derive<T> *>(base_.get());
-        if (pd == nullptr)
+        if (!is<T>())
         {
             // 转换失败
             throw "type is incompatible!";
         }
-        return pd->data_;
+        return std::move(*static_cast<T *>(ops_->get(&storage_)));
+    }
+
+    // 判断保存的是不是T类型的数据
+    template <typename T>
+    bool is() const
+    {
+        return ops_ != nullptr && ops_->type == typeId<T>();
+    }
+
+    bool empty() const
+    {
+        return ops_ == nullptr;
     }
 
 private:
-    // 基类类型
-    class Base
+    // 每个类型对应一个唯一的静态变量，用它的地址作为类型标识
+    typedef const void *TypeId;
+    template <typename T>
+    static TypeId typeId()
     {
-    public:
-        // 如果基类对应的派生类对象是在堆上创建的，delete基类指针，那么派生类的析构函数不会调用
-        // 所以这里需要将基类的析构函数实现为虚函数-----》派生类创建在堆上时，删除基类指针
-        virtual ~Base() = default;
+        static const char id = 0;
+        return &id;
+    }
+
+    typedef typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type Storage;
+
+    // 类型擦除的操作表，代替原来的 Base/Derive 虚函数
+    struct Ops
+    {
+        TypeId type;
+        void *(*get)(void *self);
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *self);
     };
 
-    // 派生类类型
     template <typename T>
-    class Derive : public Base
+    static constexpr bool fitsInline()
+    {
+        return sizeof(T) <= INLINE_SIZE && alignof(T) <= alignof(Storage) && std::is_nothrow_move_constructible<T>::value;
+    }
+
+    // 数据直接保存在storage_里面
+    template <typename T>
+    struct InlineOps
     {
-    public:
-        Derive(T data) : data_(data)
+        static void *get(void *self) { return self; }
+        static void move(void *dst, void *src)
+        {
+            T *from = static_cast<T *>(src);
+            new (dst) T(std::move(*from));
+            from->~T();
+        }
+        static void destroy(void *self) { static_cast<T *>(self)->~T(); }
+        static const Ops *table()
         {
+            static const Ops ops = {typeId<T>(), &InlineOps::get, &InlineOps::move, &InlineOps::destroy};
+            return &ops;
         }
-        T data_; // 保存了所谓的任意的其他类型
     };
 
+    // 数据放在堆上，storage_里面只保存指针
+    template <typename T>
+    struct HeapOps
+    {
+        static void *get(void *self) { return *static_cast<T **>(self); }
+        static void move(void *dst, void *src)
+        {
+            new (dst) T *(*static_cast<T **>(src));
+            *static_cast<T **>(src) = nullptr;
+        }
+        static void destroy(void *self)
+        {
+            T *data = *static_cast<T **>(self);
+            data->~T();
+            slabResource()->deallocate(data, sizeof(T), alignof(T));
+        }
+        static const Ops *table()
+        {
+            static const Ops ops = {typeId<T>(), &HeapOps::get, &HeapOps::move, &HeapOps::destroy};
+            return &ops;
+        }
+    };
+
+    template <typename U, typename T>
+    void init(T &&data, std::true_type)
+    {
+        new (&storage_) U(std::forward<T>(data));
+        ops_ = InlineOps<U>::table();
+    }
+
+    template <typename U, typename T>
+    void init(T &&data, std::false_type)
+    {
+        void *p = slabResource()->allocate(sizeof(U), alignof(U));
+        try
+        {
+            new (&storage_) U *(new (p) U(std::forward<T>(data)));
+        }
+        catch (...)
+        {
+            slabResource()->deallocate(p, sizeof(U), alignof(U));
+            throw;
+        }
+        ops_ = HeapOps<U>::table();
+    }
+
+    void reset()
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
 private:
-    // 定义一个基类的指针
-    std::unique_ptr<Base> base_;
+    Storage storage_;
+    const Ops *ops_;
 };
 
 // 实现一个信号量类
+// 计数和挂起都基于一个原子变量 + futex，没有互斥锁和条件变量，
+// post时只有确实有线程挂起才会进入内核
 class Semaphore
 {
 public:
-    Semaphore() : resLimit_(0)
+    Semaphore() : resLimit_(0), waiters_(0)
     {
     }
     ~Semaphore() = default;
@@ -92,27 +243,72 @@ public:
     // 获取一个信号量资源
     void wait()
     {
-        std::unique_lock<std::mutex> lock(mtx_);
-        // 等待信号量有资源，没有资源的话，会阻塞当前线程
-        cond_.wait(lock, [&]() -> bool
-                   { return resLimit_ > 0; });
-        resLimit_--;
+        for (;;)
+        {
+            uint32_t res = resLimit_.load(std::memory_order_acquire);
+            if (res > 0)
+            {
+                if (resLimit_.compare_exchange_weak(res, res - 1, std::memory_order_acq_rel))
+                    return;
+                continue;
+            }
+            // 等待信号量有资源，没有资源的话，会阻塞当前线程
+            waiters_++;
+            detail::futexWait(&resLimit_, 0);
+            waiters_--;
+        }
     }
 
     // 增加一个信号量资源
     void post()
     {
-        std::unique_lock<std::mutex> lock(mtx_);
-        resLimit_++;
-        //linux下条件变量析构什么也没做，
-        //导致这里状态已经失效，无效阻塞
-        cond_.notify_all(); //通知，notify_all阻塞
+        resLimit_.fetch_add(1);
+        if (waiters_ > 0)
+            detail::futexWake(&resLimit_, 1);
     }
 
 private:
-    int resLimit_;
-    std::mutex mtx_;
-    std::condition_variable cond_;
+    std::atomic<uint32_t> resLimit_;
+    std::atomic_int waiters_;
+};
+
+// 线程池里面执行的任务的公共基类，任务队列里面保存的就是这个类型
+class TaskBase : public detail::CancelState
+{
+public:
+    TaskBase() : enqueueTime_(0)
+    {
+    }
+
+    virtual ~TaskBase() = default;
+
+    // 执行任务，并把返回值交给对应的Result
+    virtual void exec() = 0;
+
+    // 任务放入队列以后又被丢弃（REJECT_DISCARD_OLDEST），让等待返回值的一方不再阻塞
+    virtual void discard()
+    {
+    }
+
+    // 取消任务：还没开始执行时不再执行，Result 变为无效，返回true
+    // 已经开始执行时只是请求停止，run() 里面通过 token() 检查后提前返回，返回false
+    bool cancel()
+    {
+        if (!tryCancel())
+            return false;
+        discard();
+        return true;
+    }
+
+    // 任务执行期间检查自己是否被要求停止（Result::cancel 或者线程池 SHUTDOWN_ABORT）
+    CancellationToken token() const
+    {
+        return CancellationToken(this);
+    }
+
+private:
+    friend class ThreadPool;
+    int64_t enqueueTime_; // 放入任务队列的时间（纳秒），线程池打开统计时用来计算排队时间
 };
 
 // Task类型的前置声明
@@ -137,16 +333,25 @@ public:
     //问题二：get方法，用户调用这个方法获取task的返回值
     Any get();
 
+    // 任务被丢弃，返回值无效，唤醒等待的线程
+    void invalidate();
+
+    // 提交失败或者任务被丢弃时返回值无效，get() 返回空的Any
+    bool isValid() const;
+
+    // 取消对应的任务，见 TaskBase::cancel
+    bool cancel();
+
 private:
     Any any_;                    // 存储返回值
-    Semaphore sem_;              // 线程通信信号量，保证任务执行完毕后再拿取结果
+    Completion done_;            // 任务执行完毕的通知，保证任务执行完毕后再拿取结果
     std::shared_ptr<Task> task_; // 指向对应获取返回值的任务对象
     std::atomic_bool isValid_;   // 返回值是否有效，如果提交任务失败，那么调用Result.get()不用阻塞
 };
 
 // 任务抽象基类
 // 用户可以自定义任意任务类型
-class Task
+class Task : public TaskBase
 {
 public:
     Task();
@@ -160,7 +365,9 @@ public:
      */
     virtual Any run() = 0;
 
-    void exec();
+    void exec() override;
+
+    void discard() override;
 
     void setResult(Result* res);
 
@@ -168,6 +375,117 @@ private:
     Result* result_;    //Result对象的生命周期 》 Task的 ，这里不能使用智能指针（智能指针的循环引用问题）
 };
 
+template <typename T>
+class TypedTask;
+
+// 返回值类型确定的任务对应的Result，返回值直接保存为T，不经过Any装箱
+template <typename T>
+class TypedResult
+{
+public:
+    TypedResult(std::shared_ptr<TypedTask<T>> task, bool isValid = true)
+        : task_(task), isValid_(isValid)
+    {
+        task->setResult(this);
+    }
+
+    TypedResult(const TypedResult &) = delete;
+    TypedResult &operator=(const TypedResult &) = delete;
+    ~TypedResult() = default;
+
+    // 任务执行完，保存返回值
+    void setVal(T val)
+    {
+        value_.set(std::move(val));
+        done_.post();
+    }
+
+    // 获取task的返回值，返回值是移动出来的，只能获取一次
+    // 提交任务失败或者任务被丢弃的话返回 T()
+    T get()
+    {
+        if (!isValid_)
+        {
+            return T();
+        }
+        helpWait(done_); // task任务如果没有执行完，这里会阻塞用户的线程（线程池线程会先帮忙执行其他任务）
+        if (!isValid_)
+        {
+            return T();
+        }
+        return value_.take();
+    }
+
+    // 任务被丢弃，返回值无效，唤醒等待的线程
+    void invalidate()
+    {
+        isValid_ = false;
+        done_.post();
+    }
+
+    bool isValid() const
+    {
+        return isValid_;
+    }
+
+    // 取消对应的任务，见 TaskBase::cancel
+    bool cancel()
+    {
+        return task_->cancel();
+    }
+
+private:
+    detail::ValueStorage<T> value_;      // 存储返回值
+    Completion done_;                    // 任务执行完毕的通知
+    std::shared_ptr<TypedTask<T>> task_; // 指向对应获取返回值的任务对象
+    std::atomic_bool isValid_;           // 返回值是否有效
+};
+
+// 返回值类型确定的任务基类
+// 用户从TypedTask<T>继承，重写 T run()，线程池通过 submitTask 返回 TypedResult<T>
+/*
+example:
+class SumTask : public TypedTask<unsigned long long>
+{
+public:
+    unsigned long long run() override { ... }
+};
+std::shared_ptr<TypedResult<unsigned long long>> res = pool.submitTask(std::make_shared<SumTask>());
+unsigned long long sum = res->get();
+*/
+template <typename T>
+class TypedTask : public TaskBase
+{
+public:
+    using value_type = T;
+
+    TypedTask() : result_(nullptr)
+    {
+    }
+
+    virtual T run() = 0;
+
+    void exec() override
+    {
+        if (result_ != nullptr)
+            result_->setVal(run());
+    }
+
+    void discard() override
+    {
+        if (result_ != nullptr)
+            result_->invalidate();
+    }
+
+    void setResult(TypedResult<T> *res)
+    {
+        result_ = res;
+    }
+
+private:
+    TypedResult<T> *result_;
+};
+
 // 线程支持的模式
 enum class PoolMode
 {
@@ -191,6 +509,9 @@ public:
     // 启动线程
     void start();
 
+    // 等待线程函数返回
+    void join();
+
     //获取线程id
     int getId() const;
 
@@ -198,8 +519,17 @@ private:
     ThreadFunc func_;
     static int generateId_;
     int threadId_;  //保存线程id，方便后续删除线程对象
+    std::thread thread_;
 };
 
+// 创建任务对象，任务对象和 shared_ptr 的控制块一起从 slabResource() 的线程缓存分配
+// pool.submitTask(makeTask<MyTask>(args...)) 在稳定运行时不会调用 malloc
+template <typename T, typename... Args>
+std::shared_ptr<T> makeTask(Args &&...args)
+{
+    return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
+
 /*
 example:
 ThreadPool pool;
@@ -219,14 +549,22 @@ public:
     // 线程池构造
     ThreadPool();
 
-    // 线程池析构
+    // 线程池析构，没有调用过 shutdown 时按 SHUTDOWN_DRAIN 关闭
     ~ThreadPool();
 
+    /*
+    关闭线程池：不再接受线程池外部提交的任务（正在执行的任务提交的子任务仍然接受），然后等待所有线程退出并 join
+    SHUTDOWN_DRAIN 执行完所有排队的任务；SHUTDOWN_CANCEL_PENDING 排队的任务不再执行，Result 变为无效；
+    SHUTDOWN_ABORT 同时让正在执行的任务的 token() 变成已取消
+    最多等待 timeout，超时返回false，可以再次调用（比如换成 SHUTDOWN_ABORT）；不响应取消的任务只能等它执行完
+    */
+    bool shutdown(ShutdownMode mode = ShutdownMode::SHUTDOWN_DRAIN, std::chrono::milliseconds timeout = SHUTDOWN_WAIT_FOREVER);
+
     // 设置线程池的工作模式
     void setMode(PoolMode mode);
 
-    // 开始线程池,默认大小为CPU核心数量
-    void start(int initThreadSize = std::thread::hardware_concurrency());
+    // 开始线程池,默认大小为CPU核心数量，placement 指定工作线程的绑核方式
+    void start(int initThreadSize = std::thread::hardware_concurrency(), const PlacementPolicy &placement = PlacementPolicy());
 
     // 定义任务队列数量上限阈值
     void setTaskQueueMaxThreshHold(int threshHold);
@@ -234,8 +572,96 @@ public:
     // 定义cached模式下线程阈值
     void setThreadSizeThreshhold(int threshHold);
 
-    // 给线程池提交任务
-    std::shared_ptr<Result> submitTask(std::shared_ptr<Task> sp);
+    // 设置队列满时的处理策略，timeout 是 REJECT_TIMEOUT 策略的最长等待时间
+    void setRejectPolicy(RejectPolicy policy, std::chrono::milliseconds timeout = SUBMIT_TIMEOUT_DEFAULT);
+
+    // 定义cached模式下线程数量的调节策略
+    void setSizingPolicy(const SizingPolicy &policy);
+
+    // 设置工作线程空闲时的等待策略（自旋、让出CPU、挂起），默认马上挂起
+    void setIdleStrategy(const IdleStrategy &strategy);
+
+    // 设置每次提交任务时 Result 的内存来源，默认 slabResource()
+    // resource 要比线程池返回的所有 Result 都活得长
+    void setAllocator(MemoryResource *resource);
+
+    // 打开运行统计：每个线程执行的任务数量、忙碌/空闲时间、排队时间和执行时间的直方图等
+    void setStatsEnabled(bool enabled);
+
+    // 运行统计的快照，没有打开统计时只有线程数量、排队任务数量和拒绝数量
+    PoolStats stats();
+
+    // 打开任务时间线：每个线程记录提交、执行、偷取、空闲和等锁的时间，最多 eventsPerThread 个事件（见 traceRecorder.hpp）
+    void setTraceEnabled(bool enabled, std::size_t eventsPerThread = TRACE_EVENTS_PER_THREAD);
+
+    // 到目前为止的时间线，Chrome trace event 格式的 JSON，pool 作为进程名
+    std::string traceJson(const std::string &pool = "threadpool") const;
+
+    // 把时间线写到 path，用 chrome://tracing 或者 ui.perfetto.dev 打开
+    bool writeTrace(const std::string &path, const std::string &pool = "threadpool") const;
+
+    // 设置任务队列的实现方式，无锁模式下队列容量为任务队列上限阈值（向上取整为2的幂）
+    void setQueueMode(QueueMode mode);
+
+    // 给线程池提交任务，高优先级的任务先执行，同一优先级内先进先出
+    // 队列满时按拒绝策略处理，被拒绝的任务返回无效的Result
+    std::shared_ptr<Result> submitTask(std::shared_ptr<Task> sp, TaskPriority priority = TaskPriority::PRIORITY_NORMAL);
+
+    // 不等待地提交任务：队列满时不阻塞，也不在当前线程执行任务（REJECT_DISCARD_OLDEST 策略仍然生效）
+    // result 返回任务对应的Result，被拒绝时是无效的Result；和 submitTask 一样，任务执行完之前要持有它
+    SubmitStatus trySubmit(std::shared_ptr<Task> sp, std::shared_ptr<Result> &result, TaskPriority priority = TaskPriority::PRIORITY_NORMAL);
+
+    // 批量提交任务：整批任务只获取一次锁，并且只唤醒需要的线程数量
+    // 返回的Result和任务一一对应，被拒绝的任务对应无效的Result
+    std::vector<std::shared_ptr<Result>> submitBatch(const std::vector<std::shared_ptr<Task>> &tasks);
+
+    // 批量提交返回值类型确定的任务
+    template <typename TaskT>
+    std::vector<std::shared_ptr<TypedResult<typename TaskT::value_type>>> submitBatch(const std::vector<std::shared_ptr<TaskT>> &tasks)
+    {
+        using T = typename TaskT::value_type;
+        std::vector<std::shared_ptr<TypedResult<T>>> results;
+        std::vector<std::shared_ptr<TaskBase>> batch;
+        results.reserve(tasks.size());
+        batch.reserve(tasks.size());
+        for (const std::shared_ptr<TaskT> &sp : tasks)
+        {
+            results.push_back(makeResult<TypedResult<T>>(sp));
+            batch.push_back(sp);
+        }
+        std::size_t pushed = enqueueBatch(batch);
+        for (std::size_t i = pushed; i < tasks.size(); i++)
+            results[i] = makeResult<TypedResult<T>>(tasks[i], false);
+        return results;
+    }
+
+    // 提交返回值类型确定的任务（TypedTask<T>的派生类），返回值不经过Any
+    template <typename TaskT>
+    std::shared_ptr<TypedResult<typename TaskT::value_type>> submitTask(std::shared_ptr<TaskT> sp, TaskPriority priority = TaskPriority::PRIORITY_NORMAL)
+    {
+        using T = typename TaskT::value_type;
+        std::shared_ptr<TypedTask<T>> task = sp;
+        // 任务入队之后就可能被执行，所以要先创建Result，让task持有Result的指针
+        std::shared_ptr<TypedResult<T>> res = makeResult<TypedResult<T>>(task);
+        if (enqueue(task, priority) == SubmitStatus::SUBMIT_REJECTED)
+        {
+            return makeResult<TypedResult<T>>(task, false);
+        }
+        return res;
+    }
+
+    // 不等待地提交返回值类型确定的任务
+    template <typename TaskT>
+    SubmitStatus trySubmit(std::shared_ptr<TaskT> sp, std::shared_ptr<TypedResult<typename TaskT::value_type>> &result, TaskPriority priority = TaskPriority::PRIORITY_NORMAL)
+    {
+        using T = typename TaskT::value_type;
+        std::shared_ptr<TypedTask<T>> task = sp;
+        result = makeResult<TypedResult<T>>(task);
+        SubmitStatus status = enqueue(task, priority, true);
+        if (status == SubmitStatus::SUBMIT_REJECTED)
+            result = makeResult<TypedResult<T>>(task, false);
+        return status;
+    }
 
     // 禁用拷贝构造函数
     ThreadPool(const ThreadPool &) = delete;
@@ -244,9 +670,111 @@ public:
     ThreadPool &operator=(const ThreadPool &) = delete;
 
 private:
+    // 从 resource_ 分配任务的 Result
+    template <typename R, typename... Args>
+    std::shared_ptr<R> makeResult(Args &&...args)
+    {
+        return std::allocate_shared<R>(PoolAllocator<R>(resource_), std::forward<Args>(args)...);
+    }
+
+    // 工作线程的槽位：线程里面提交的普通优先级任务放入槽位的私有队列，不经过全局的 taskQueueMtx_
+    // 槽位在 start 时按最多的线程数量创建，线程启动时占用一个空闲槽位，回收时归还
+    struct Worker
+    {
+        Worker(ThreadPool *pool, std::size_t index) : pool_(pool), index_(index), node_(-1), used_(false)
+        {
+        }
+
+        ThreadPool *pool_;                                    // 所属的线程池，区分多个线程池的线程
+        std::size_t index_;                                   // 槽位下标
+        int node_;                                            // 槽位上的线程绑定的NUMA节点，不绑核时为 -1
+        std::vector<std::size_t> stealOrder_;                 // 偷取任务时依次尝试的槽位
+        WorkerCounters stats_;                                // 槽位上的线程的统计，线程退出后保留
+        std::atomic_bool used_;                               // 是否有线程占用
+        WorkStealingQueue<std::shared_ptr<TaskBase>> queue_; // 私有任务队列，空闲的线程会过来偷取
+    };
+
+    // 当前线程占用的槽位，非线程池线程为nullptr
+    static Worker *&currentWorker();
+
     // 定义线程函数
     void threadFunc(int threadId);
 
+    // 线程启动时占用一个空闲槽位，没有空闲槽位返回nullptr（任务都走全局队列）
+    Worker *claimWorker();
+
+    // 线程池线程把任务放入自己的私有队列
+    void pushLocal(Worker *self, const std::shared_ptr<TaskBase> &sp);
+
+    // 私有队列超过 LOCAL_QUEUE_MAX 时放入全局队列，全局队列满了不等待，返回false
+    bool spillTask(const std::shared_ptr<TaskBase> &sp);
+
+    // 把任务放入任务队列，队列满时按拒绝策略处理
+    // tryOnly 为true时（trySubmit）不等待，也不在当前线程执行任务
+    SubmitStatus enqueue(std::shared_ptr<TaskBase> sp, TaskPriority priority, bool tryOnly = false);
+
+    // 把一批任务放入任务队列，返回被接受（放入队列或者由当前线程执行）的数量，总是前面的一部分
+    std::size_t enqueueBatch(std::vector<std::shared_ptr<TaskBase>> &tasks);
+
+    // enqueue 和 enqueueBatch 的实现，REJECT_DISCARD_OLDEST 策略下被挤掉的任务放在 evicted 里
+    bool pushTask(const std::shared_ptr<TaskBase> &sp, TaskPriority priority, const SubmitWait &wait, std::shared_ptr<TaskBase> &evicted);
+    std::size_t pushBatch(std::vector<std::shared_ptr<TaskBase>> &tasks, const SubmitWait &wait);
+
+    // 更新提交数量、拒绝数量和排队任务数量的最大值，拒绝数量总是统计
+    void countSubmitted(std::size_t submitted, std::size_t rejected);
+
+    // 打开统计时记录提交时间；打开时间线时提交时间同时是任务的 id，返回它，没有打开时间线返回0
+    int64_t stampTask(TaskBase &task);
+
+    // 获取 taskQueueMtx_，打开时间线时记录等锁的时间
+    std::unique_lock<std::mutex> lockQueue();
+
+    // cached模式下按调节器的采样结果增减线程，调用时已经持有 taskQueueMtx_
+    void growThreads();
+
+    // cached模式下最少保留的线程数量
+    int minThreads() const;
+
+    // 没有任务时挂起，返回false表示线程要退出
+    bool park(int threadId, Completion &slot);
+
+    // cached模式下回收当前线程，线程数量已经降到最少时不回收，返回是否回收
+    bool retire(int threadId);
+
+    // 离开空闲线程栈
+    void leaveIdle(Completion &slot);
+
+    // 线程退出，线程对象留到 join 以后再销毁，调用时已经持有 taskQueueMtx_
+    void exitThread(int threadId);
+
+    // join 已经退出的线程，调用时已经持有 taskQueueMtx_
+    void reapThreads();
+
+    // shutdown 以后拒绝线程池外部提交的任务
+    bool isStopped() const;
+
+    // 不阻塞地取一个任务：私有队列（LIFO） =》 全局队列 =》 从其他线程的队列偷取（FIFO），没有任务返回false
+    bool acquireTask(Worker *self, std::shared_ptr<TaskBase> &task);
+
+    // 从全局任务队列按优先级取一个任务
+    bool popShared(std::shared_ptr<TaskBase> &task);
+
+    // 全局队列里的任务被取走或者被丢弃
+    void taskPopped(TaskPriority priority);
+
+    // 执行一个取到的任务，打开统计时记录执行时间
+    void runTask(const std::shared_ptr<TaskBase> &task, WorkerCounters *stats);
+
+    // cached模式下执行完一个任务以后统计吞吐量，到了采样时间调整线程数量
+    void sampleSizing();
+
+    // 不受任务队列上限限制，把任务放入全局队列，用于线程池线程提交的高、低优先级任务（不能等待）
+    // 无锁模式下环形队列放不下的任务暂存在 taskQueue_ 里，取任务时先取它们
+    void pushUnbounded(const std::shared_ptr<TaskBase> &sp, TaskPriority priority);
+
+    // 无锁模式下放入任务，队列满时按 wait 等待
+    bool pushLockFree(std::shared_ptr<TaskBase> task, TaskPriority priority, const SubmitWait &wait, std::shared_ptr<TaskBase> &evicted);
+
     // 检查pool的运行状态
     bool checkRunningState() const;
 
@@ -254,6 +782,7 @@ private:
     // TODO:下划线加在命名后面，为了避免与linux系统库产生冲突，开源代码的编码习惯
     // std::vector<std::unique_ptr<Thread>> threads_; // 线程列表
     std::unordered_map<int,std::unique_ptr<Thread>> threads_;
+    std::vector<std::unique_ptr<Thread>> exited_;  // 已经退出、还没有 join 的线程
     std::size_t initThreadSize_;                   // 初始的线程数量
     std::size_t maxThreadSize_;                     //线程数量上限阈值
     std::atomic_int curThreadSize_;             //记录当前线程池里面线程的总数量
@@ -264,23 +793,50 @@ private:
     我们需要考虑的是延长任务的生命周期直到run函数完全执行完毕
     使用裸指针是不可以的，所以这里使用智能指针
     */
-    std::queue<std::shared_ptr<Task>> taskQueue_; // 任务队列
+    PriorityTaskQueue<std::shared_ptr<TaskBase>> taskQueue_; // 任务队列，每个优先级一个；无锁模式下只放超额放入的任务
     std::atomic_uint taskCnt_;                    // 任务的数量
     int taskQueueMaxThreshHold_;                  // 任务队列数量上限的阈值
 
+    QueueMode queueMode_;                                             // 任务队列的实现方式
+    std::unique_ptr<LockFreePriorityQueue<std::shared_ptr<TaskBase>>> lockFreeQueue_; // 无锁模式下的任务队列
+    std::atomic_int waitingProducers_;                                // 无锁模式下等待队列不满的提交线程数量
+    std::atomic_uint overflowCnt_;                                    // 无锁模式下超额放入 taskQueue_ 的任务数量
+    std::atomic_uint highCnt_;                                        // 全局任务队列中高优先级任务的数量
+    std::vector<std::unique_ptr<Worker>> workers_;                    // 线程槽位，start 以后不再改变
+
     std::mutex taskQueueMtx_; // 保证任务队列的线程安全
     /*
     condition_variable type
     notFull/notEmpty
     */
     std::condition_variable notFull_;  // 表示任务队列不满
-    std::condition_variable notEmpty_; // 表示任务队列不空
+    IdleStack idleWorkers_;            // 空闲线程栈，有新任务时只唤醒栈顶的一个线程
     std::condition_variable exitCond_; // 等待线程执行完毕
 
     PoolMode poolMode_;                // 线程池的工作模式
 
+    SizingController sizer_;             // cached模式的线程数量调节器
+    IdleStrategy idleStrategy_;          // 工作线程空闲时的等待策略
+
+    bool statsEnabled_;                         // 是否统计排队时间、执行时间等
+    std::atomic<uint64_t> submitted_;           // 成功提交的任务数量
+    std::atomic<uint64_t> rejected_;            // 队列满提交失败的任务数量
+    std::atomic<std::size_t> queueHighWater_;   // 排队任务数量的最大值
+    TraceRecorder trace_;                       // 任务时间线
+
+    RejectPolicy rejectPolicy_;                 // 队列满时的处理策略
+    std::chrono::milliseconds submitTimeout_;   // REJECT_TIMEOUT 策略的最长等待时间
+    MemoryResource *resource_;                  // Result 的内存来源
+
+    PlacementPolicy placement_;          // 工作线程的绑核方式
+    std::atomic_uint placementSlot_;     // 没有占用线程槽位的线程使用的绑核槽位
+
     // 表示当前线程池的启动状态
     std::atomic_bool isRunning_;
+
+    std::atomic_bool stopping_;      // 已经调用 shutdown，不再接受外部提交的任务
+    std::atomic_bool cancelPending_; // 取到的任务不再执行，直接取消
+    std::atomic_bool abort_;         // 正在执行的任务的 token() 变成已取消
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,503 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <taskFunction.hpp>
+#include <taskFuture.hpp>
+#include <public.h>
+
+class TimerWheel;
+
+// 定时任务的句柄，用来取消还没有到期的任务；只能在所属的线程池析构之前使用
+class TimerHandle
+{
+public:
+    TimerHandle() : wheel_(nullptr), index_(0), generation_(0)
+    {
+    }
+
+    // 取消定时任务，任务已经开始执行（单次任务）或者已经取消过返回false
+    // 周期任务取消以后不会再触发，正在执行的那一次不受影响
+    bool cancel();
+
+    bool valid() const
+    {
+        return wheel_ != nullptr;
+    }
+
+private:
+    TimerHandle(TimerWheel *wheel, uint32_t index, uint32_t generation)
+        : wheel_(wheel), index_(index), generation_(generation)
+    {
+    }
+
+    friend class TimerWheel;
+
+    TimerWheel *wheel_;
+    uint32_t index_;      // 定时器节点的编号
+    uint32_t generation_; // 节点每次回收都会加一，旧句柄不会取消掉复用这个节点的新定时器
+};
+
+// 延迟执行的任务：任务的Future，以及取消用的句柄
+// 任务在执行之前被取消，Future会得到 broken_promise 异常
+template <typename T>
+struct ScheduledFuture
+{
+    Future<T> future;
+    TimerHandle timer;
+};
+
+namespace detail
+{
+    // 周期任务：每次到期时提交一次，上一次提交的还没有执行完就跳过这一次，避免任务堆积
+    class PeriodicBase
+    {
+    public:
+        PeriodicBase() : pending_(false)
+        {
+        }
+        virtual ~PeriodicBase() = default;
+
+        // 定时器线程调用，返回是否需要提交这一次
+        bool tryAcquire()
+        {
+            return !pending_.exchange(true, std::memory_order_acq_rel);
+        }
+
+        // 线程池线程调用
+        void run()
+        {
+            try
+            {
+                call();
+            }
+            catch (...)
+            {
+                LOG_WARN("periodic task threw an exception");
+            }
+            pending_.store(false, std::memory_order_release);
+        }
+
+    protected:
+        virtual void call() = 0;
+
+    private:
+        std::atomic_bool pending_;
+    };
+
+    // 函数和参数都保存一份，每次以左值调用
+    template <typename Func, typename... Args>
+    class PeriodicCall : public PeriodicBase
+    {
+    public:
+        template <typename F, typename... A>
+        PeriodicCall(F &&func, A &&...args)
+            : func_(std::forward<F>(func)), args_(std::forward<A>(args)...)
+        {
+        }
+
+    protected:
+        void call() override
+        {
+            invoke(typename MakeIndexSeq<sizeof...(Args)>::type());
+        }
+
+    private:
+        template <std::size_t... I>
+        void invoke(IndexSeq<I...>)
+        {
+            func_(std::get<I>(args_)...);
+        }
+
+        Func func_;
+        std::tuple<Args...> args_;
+    };
+}
+
+/*
+分层时间轮，精度1ms（一个tick）
+  第0层 256个槽位，每个槽位1个tick，覆盖 256ms
+  第1~3层 各64个槽位，每层的一个槽位是下一层转一圈的时间，覆盖到 2^26 tick（约18.6小时）
+  更远的定时器先放在第3层的最后，转到的时候重新计算位置
+每个槽位是一个双向链表：插入、取消都是O(1)，每个tick只处理当前槽位，
+第0层转完一圈时才把上一层的一个槽位重新分散到下面（cascade）
+
+定时器节点按块分配、回收后放入空闲链表复用，任务本身放在节点里的 TaskFunction 中，
+大量的连接超时定时器不会反复申请释放堆内存
+只有一个定时器线程，到期的任务交给 dispatch 回调（放入线程池的任务队列）执行，
+回调在定时器的锁外面调用
+*/
+class TimerWheel
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using Dispatch = std::function<void(TaskFunction)>;
+    using Now = Clock::time_point (*)(); // 当前时间，默认为 Clock::now，测试时可以换成能快进的时钟
+
+    explicit TimerWheel(Dispatch dispatch, Now now = &Clock::now)
+        : dispatch_(std::move(dispatch)), now_(now), startTime_(now()), currentTick_(0), nextWakeTick_(0), freeHead_(NIL), pending_(0), running_(false), stop_(false)
+    {
+        for (int level = 0; level < LEVELS; level++)
+        {
+            for (uint32_t slot = 0; slot < LEVEL0_SLOTS; slot++)
+                slots_[level][slot] = NIL;
+        }
+    }
+
+    // 停止定时器线程，没有到期的定时任务全部丢弃
+    ~TimerWheel()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_ = true;
+        }
+        wakeCond_.notify_one();
+        if (thread_.joinable())
+            thread_.join();
+    }
+
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    // 在 when 时刻把任务交给 dispatch
+    TimerHandle schedule(Clock::time_point when, TaskFunction task)
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        uint32_t index = allocNode();
+        Node &node = nodeAt(index);
+        node.task_ = std::move(task);
+        node.period_ = 0;
+        return insertNew(lock, index, toTick(when));
+    }
+
+    // 从 first 时刻开始，每隔 period 执行一次
+    TimerHandle scheduleEvery(Clock::time_point first, Clock::duration period, std::shared_ptr<detail::PeriodicBase> periodic)
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        uint32_t index = allocNode();
+        Node &node = nodeAt(index);
+        node.periodic_ = std::move(periodic);
+        uint64_t ticks = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(period).count();
+        node.period_ = ticks == 0 ? 1 : ticks;
+        return insertNew(lock, index, toTick(first));
+    }
+
+    // 等待触发的定时器数量
+    std::size_t pending() const
+    {
+        return pending_.load(std::memory_order_relaxed);
+    }
+
+private:
+    static const int LEVELS = 4;
+    static const uint32_t LEVEL0_BITS = 8;
+    static const uint32_t LEVEL_BITS = 6;
+    static const uint32_t LEVEL0_SLOTS = 1u << LEVEL0_BITS;
+    static const uint32_t LEVEL_SLOTS = 1u << LEVEL_BITS;
+    static const uint64_t MAX_DELAY = (uint64_t)1 << (LEVEL0_BITS + 3 * LEVEL_BITS);
+    static const uint32_t CHUNK_SIZE = 1024; // 节点每次分配的数量
+    static const uint32_t NIL = 0xffffffffu;
+
+    struct Node
+    {
+        Node() : expire_(0), period_(0), prev_(NIL), next_(NIL), generation_(0), level_(-1), slot_(0)
+        {
+        }
+        TaskFunction task_;                             // 单次任务
+        std::shared_ptr<detail::PeriodicBase> periodic_; // 周期任务
+        uint64_t expire_;                               // 到期的tick
+        uint64_t period_;                               // 周期（tick），0表示单次任务
+        uint32_t prev_;
+        uint32_t next_; // 空闲时作为空闲链表的指针
+        uint32_t generation_;
+        int level_; // 所在的层，-1表示不在时间轮上
+        uint32_t slot_;
+    };
+
+    friend class TimerHandle;
+
+    Node &nodeAt(uint32_t index)
+    {
+        return chunks_[index / CHUNK_SIZE][index % CHUNK_SIZE];
+    }
+
+    uint32_t allocNode()
+    {
+        if (freeHead_ == NIL)
+        {
+            uint32_t base = (uint32_t)(chunks_.size() * CHUNK_SIZE);
+            chunks_.emplace_back(new Node[CHUNK_SIZE]);
+            for (uint32_t i = CHUNK_SIZE; i > 0; i--)
+            {
+                nodeAt(base + i - 1).next_ = freeHead_;
+                freeHead_ = base + i - 1;
+            }
+        }
+        uint32_t index = freeHead_;
+        freeHead_ = nodeAt(index).next_;
+        return index;
+    }
+
+    // 节点回收时清空任务，句柄随之失效
+    void freeNode(uint32_t index)
+    {
+        Node &node = nodeAt(index);
+        node.task_ = nullptr;
+        node.periodic_.reset();
+        node.generation_++;
+        node.level_ = -1;
+        node.next_ = freeHead_;
+        freeHead_ = index;
+    }
+
+    uint64_t toTick(Clock::time_point when) const
+    {
+        if (when <= startTime_)
+            return 0;
+        // 向上取整，保证不会提前触发
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(when - startTime_).count();
+        return (uint64_t)((us + 999) / 1000);
+    }
+
+    uint64_t nowTick() const
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(now_() - startTime_).count();
+    }
+
+    TimerHandle insertNew(std::unique_lock<std::mutex> &lock, uint32_t index, uint64_t expire)
+    {
+        // 时间轮是空的，中间的tick都不用处理，直接对齐到现在，下面按和现在的差值放入槽位
+        if (pending_.load(std::memory_order_relaxed) == 0)
+            currentTick_ = std::max(currentTick_, nowTick());
+        Node &node = nodeAt(index);
+        node.expire_ = expire < currentTick_ ? currentTick_ : expire;
+        link(index);
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        TimerHandle handle(this, index, node.generation_);
+        if (!running_)
+        {
+            running_ = true;
+            thread_ = std::thread(&TimerWheel::timerFunc, this);
+        }
+        // 比定时器线程正在等待的时间还早，叫醒它重新计算
+        bool earlier = node.expire_ < nextWakeTick_;
+        lock.unlock();
+        if (earlier)
+            wakeCond_.notify_one();
+        return handle;
+    }
+
+    // 按到期时间和当前时间的差值放入对应层的槽位
+    void link(uint32_t index)
+    {
+        Node &node = nodeAt(index);
+        uint64_t expire = node.expire_;
+        uint64_t delta = expire - currentTick_;
+        if (delta >= MAX_DELAY)
+        {
+            // 太远了，先放在最高层离现在最远的槽位，转到时再重新计算
+            expire = currentTick_ + MAX_DELAY - 1;
+            delta = MAX_DELAY - 1;
+        }
+        int level;
+        uint32_t slot;
+        if (delta < LEVEL0_SLOTS)
+        {
+            level = 0;
+            slot = (uint32_t)(expire & (LEVEL0_SLOTS - 1));
+        }
+        else
+        {
+            level = 1;
+            uint32_t shift = LEVEL0_BITS;
+            while (delta >= ((uint64_t)1 << (shift + LEVEL_BITS)))
+            {
+                level++;
+                shift += LEVEL_BITS;
+            }
+            slot = (uint32_t)((expire >> shift) & (LEVEL_SLOTS - 1));
+        }
+        node.level_ = level;
+        node.slot_ = slot;
+        node.prev_ = NIL;
+        node.next_ = slots_[level][slot];
+        if (node.next_ != NIL)
+            nodeAt(node.next_).prev_ = index;
+        slots_[level][slot] = index;
+    }
+
+    void unlink(uint32_t index)
+    {
+        Node &node = nodeAt(index);
+        if (node.prev_ != NIL)
+            nodeAt(node.prev_).next_ = node.next_;
+        else
+            slots_[node.level_][node.slot_] = node.next_;
+        if (node.next_ != NIL)
+            nodeAt(node.next_).prev_ = node.prev_;
+        node.level_ = -1;
+    }
+
+    bool cancel(uint32_t index, uint32_t generation)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (index >= chunks_.size() * CHUNK_SIZE)
+            return false;
+        Node &node = nodeAt(index);
+        if (node.generation_ != generation || node.level_ < 0)
+            return false;
+        unlink(index);
+        freeNode(index);
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 把上层一个槽位里的定时器重新分散到下面的层
+    void cascade(int level, uint32_t slot)
+    {
+        uint32_t index = slots_[level][slot];
+        slots_[level][slot] = NIL;
+        while (index != NIL)
+        {
+            uint32_t next = nodeAt(index).next_;
+            link(index);
+            index = next;
+        }
+    }
+
+    // 处理 currentTick_ 这个tick，到期的任务放入 fired
+    void tick(std::vector<TaskFunction> &fired)
+    {
+        uint64_t t = currentTick_;
+        if ((t & (LEVEL0_SLOTS - 1)) == 0)
+        {
+            uint32_t shift = LEVEL0_BITS;
+            for (int level = 1; level < LEVELS; level++)
+            {
+                uint32_t slot = (uint32_t)((t >> shift) & (LEVEL_SLOTS - 1));
+                cascade(level, slot);
+                // 这一层也转完了一圈，才需要继续处理更上一层
+                if (slot != 0)
+                    break;
+                shift += LEVEL_BITS;
+            }
+        }
+
+        uint32_t slot = (uint32_t)(t & (LEVEL0_SLOTS - 1));
+        uint32_t index = slots_[0][slot];
+        slots_[0][slot] = NIL;
+        while (index != NIL)
+        {
+            Node &node = nodeAt(index);
+            uint32_t next = node.next_;
+            node.level_ = -1;
+            if (node.expire_ > t)
+            {
+                // 超过最大延迟被放在最远槽位的定时器，还没有到期
+                link(index);
+            }
+            else if (node.period_ == 0)
+            {
+                fired.push_back(std::move(node.task_));
+                freeNode(index);
+                pending_.fetch_sub(1, std::memory_order_relaxed);
+            }
+            else
+            {
+                std::shared_ptr<detail::PeriodicBase> periodic = node.periodic_;
+                if (periodic->tryAcquire())
+                    fired.emplace_back([periodic]()
+                                       { periodic->run(); });
+                node.expire_ = t + node.period_;
+                link(index);
+            }
+            index = next;
+        }
+    }
+
+    // 下一个需要处理的tick：第0层最近的非空槽位，或者下一次cascade
+    uint64_t nextTick() const
+    {
+        if (pending_.load(std::memory_order_relaxed) == 0)
+            return UINT64_MAX;
+        uint64_t t = currentTick_;
+        // 第0层转完一圈，这个tick要把上层的槽位分散下来
+        if ((t & (LEVEL0_SLOTS - 1)) == 0)
+            return t;
+        uint64_t boundary = (t | (LEVEL0_SLOTS - 1)) + 1;
+        for (; t < boundary; t++)
+        {
+            if (slots_[0][t & (LEVEL0_SLOTS - 1)] != NIL)
+                return t;
+        }
+        return boundary;
+    }
+
+    void timerFunc()
+    {
+        std::vector<TaskFunction> fired;
+        std::unique_lock<std::mutex> lock(mtx_);
+        while (!stop_)
+        {
+            uint64_t now = nowTick();
+            // 持有锁的时间和经过的空tick数量无关：空的槽位直接跳过
+            while (currentTick_ <= now)
+            {
+                tick(fired);
+                currentTick_++;
+                currentTick_ = std::max(currentTick_, std::min(nextTick(), now + 1));
+            }
+            if (!fired.empty())
+            {
+                lock.unlock();
+                for (TaskFunction &task : fired)
+                    dispatch_(std::move(task));
+                fired.clear();
+                lock.lock();
+                continue;
+            }
+            nextWakeTick_ = nextTick();
+            if (nextWakeTick_ == UINT64_MAX)
+                wakeCond_.wait(lock);
+            else
+                wakeCond_.wait_for(lock, startTime_ + std::chrono::milliseconds(nextWakeTick_) - now_());
+            nextWakeTick_ = 0;
+        }
+    }
+
+private:
+    Dispatch dispatch_;
+    Now now_;
+    Clock::time_point startTime_;
+    uint64_t currentTick_;  // 下一个要处理的tick
+    uint64_t nextWakeTick_; // 定时器线程挂起时等待的tick，0表示没有挂起
+    uint32_t slots_[LEVELS][LEVEL0_SLOTS];
+    std::vector<std::unique_ptr<Node[]>> chunks_;
+    uint32_t freeHead_;
+    std::atomic<std::size_t> pending_;
+
+    std::mutex mtx_;
+    std::condition_variable wakeCond_;
+    std::thread thread_;
+    bool running_; // 定时器线程是否已经启动，第一次添加定时器时才启动
+    bool stop_;
+};
+
+inline bool TimerHandle::cancel()
+{
+    return wheel_ != nullptr && wheel_->cancel(index_, generation_);
+}
+
+#endif
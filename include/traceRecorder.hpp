@@ -0,0 +1,479 @@
+#ifndef TRACE_RECORDER_HPP
+#define TRACE_RECORDER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <poolStats.hpp>
+
+/*
+任务生命周期的时间线，导出为 Chrome trace event 格式的 JSON，用 chrome://tracing 或者 ui.perfetto.dev 打开
+1. submit：提交线程上的一段，从开始提交到任务放入队列，包括等待队列不满、等待 taskQueueMtx_ 的时间
+2. task：执行任务的一段，包括把返回值交给 Result / Promise；和对应的 submit 之间有箭头相连，参数里是排队时间
+3. steal：工作线程从其他线程的队列偷到一个任务
+4. idle：工作线程取不到任务、空闲等待的一段，参数是在哪个阶段等到的（spin/yield/park）
+5. lock wait：等待 taskQueueMtx_ 的一段，只有锁被占用、真的需要等待时才记录，用来看锁的争用
+
+每个线程一个定长的缓冲区，只有这个线程自己写，写满以后新的事件丢弃并计数；
+导出时只读已经写完的部分，不需要停下线程池。时间戳是 steady_clock 的纳秒
+工作线程的缓冲区属于线程槽位，cached模式下槽位上新启动的线程接着使用；
+其他线程（提交任务的线程）退出以后归还缓冲区给后来的线程使用，同时使用的最多 TRACE_EXTERNAL_BUFFERS 个
+
+pool.setTraceEnabled(true);
+pool.start(4);
+...
+pool.writeTrace("/tmp/threadpool.trace.json");
+*/
+
+// 每个线程缓冲区默认能放的事件数量（每个事件32字节）
+const std::size_t TRACE_EVENTS_PER_THREAD = 1 << 16;
+// 线程池以外的线程最多创建的缓冲区数量，都在使用时其他线程的事件丢弃并计数
+const std::size_t TRACE_EXTERNAL_BUFFERS = 64;
+
+enum class TraceEventType : uint8_t
+{
+    TRACE_SUBMIT,       // 提交一个任务，arg 是任务的 id，没有放入队列时为0
+    TRACE_SUBMIT_BATCH, // 批量提交，arg 是任务数量
+    TRACE_QUEUED,       // 批量提交里的一个任务放入了队列，arg 是任务的 id，只导出箭头的起点
+    TRACE_TASK,         // 执行一个任务，arg 是任务的 id，不知道时为0
+    TRACE_STEAL,        // 偷到一个任务，arg 是被偷的槽位
+    TRACE_IDLE,         // 空闲等待，arg 是 WakeSource
+    TRACE_LOCK          // 等待 taskQueueMtx_
+};
+
+struct TraceEvent
+{
+    int64_t ts_;  // 开始的时间（纳秒）
+    int64_t dur_; // 持续的时间，瞬时事件为0
+    int64_t arg_;
+    TraceEventType type_;
+};
+
+// 一个线程的事件缓冲区，只有所属的线程写，任意线程读
+class TraceBuffer
+{
+public:
+    TraceBuffer(const std::string &name, std::size_t capacity)
+        : name_(name), events_(new TraceEvent[capacity]), capacity_(capacity), size_(0), dropped_(0), used_(true)
+    {
+    }
+
+    // 线程池以外的线程借用一个空闲的缓冲区，上一个线程写的事件对这个线程可见
+    bool tryAcquire()
+    {
+        bool used = false;
+        return used_.compare_exchange_strong(used, true, std::memory_order_acquire);
+    }
+
+    // 线程退出或者不再使用时归还
+    void release()
+    {
+        used_.store(false, std::memory_order_release);
+    }
+
+    // 只能由当前使用它的线程调用
+    void record(TraceEventType type, int64_t ts, int64_t dur, int64_t arg)
+    {
+        std::size_t size = size_.load(std::memory_order_relaxed);
+        if (size == capacity_)
+        {
+            detail::bump(dropped_);
+            return;
+        }
+        TraceEvent &event = events_[size];
+        event.ts_ = ts;
+        event.dur_ = dur;
+        event.arg_ = arg;
+        event.type_ = type;
+        // 事件写完再发布，读的一方只读 size 之前的部分
+        size_.store(size + 1, std::memory_order_release);
+    }
+
+    std::size_t size() const
+    {
+        return size_.load(std::memory_order_acquire);
+    }
+
+    const TraceEvent &event(std::size_t i) const
+    {
+        return events_[i];
+    }
+
+    uint64_t dropped() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    std::string name_; // 线程名，由 TraceRecorder 的锁保护
+
+private:
+    std::unique_ptr<TraceEvent[]> events_;
+    std::size_t capacity_;
+    std::atomic<std::size_t> size_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic_bool used_; // 是否有线程在使用
+};
+
+namespace detail
+{
+    inline void appendJsonString(std::string &out, const std::string &text)
+    {
+        out += '"';
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            if ((unsigned char)c < 0x20)
+                continue;
+            out += c;
+        }
+        out += '"';
+    }
+
+    // 纳秒换算成 trace event 使用的微秒
+    inline void appendTraceEvent(std::string &out, const char *name, const char *ph, std::size_t tid, double ts, const char *extra)
+    {
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), ",\n{\"name\":\"%s\",\"cat\":\"threadpool\",\"ph\":\"%s\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f%s}",
+                      name, ph, tid, ts / 1000, extra);
+        out += buf;
+    }
+
+    inline const char *wakeSourceName(int64_t source)
+    {
+        if (source == (int64_t)WakeSource::WAKE_SPIN)
+            return "spin";
+        if (source == (int64_t)WakeSource::WAKE_YIELD)
+            return "yield";
+        return "park";
+    }
+}
+
+// 一个线程池的时间线记录器，工作线程启动时绑定槽位的缓冲区，其他线程第一次记录事件时借用一个缓冲区
+class TraceRecorder
+{
+public:
+    TraceRecorder() : enabled_(false), capacity_(TRACE_EVENTS_PER_THREAD), id_(nextId()), origin_(detail::statsNowNs()), lastStamp_(0), dropped_(0)
+    {
+    }
+
+    // 在线程池 start 之前调用
+    void setEnabled(bool enabled, std::size_t eventsPerThread)
+    {
+        enabled_ = enabled;
+        capacity_ = eventsPerThread > 0 ? eventsPerThread : 1;
+    }
+
+    bool enabled() const
+    {
+        return enabled_;
+    }
+
+    // 工作线程启动时调用：使用槽位 slot 的缓冲区，时间线显示为 "worker slot"
+    // 槽位上先后运行的线程写在同一条时间线上，cached模式下线程反复创建也不会增加缓冲区
+    void bindWorker(std::size_t slot)
+    {
+        std::shared_ptr<TraceBuffer> buffer;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (slot >= workerBuffers_.size())
+                workerBuffers_.resize(slot + 1);
+            if (workerBuffers_[slot] == nullptr)
+            {
+                workerBuffers_[slot] = std::make_shared<TraceBuffer>("worker " + std::to_string(slot), capacity_);
+                buffers_.push_back(workerBuffers_[slot]);
+            }
+            buffer = workerBuffers_[slot];
+        }
+        remember(buffer);
+    }
+
+    // 给当前线程的时间线命名，没有命名的线程显示为 "thread N"
+    void nameThread(const std::string &name)
+    {
+        TraceBuffer *buffer = local();
+        if (buffer == nullptr)
+            return;
+        std::lock_guard<std::mutex> lock(mtx_);
+        buffer->name_ = name;
+    }
+
+    // 提交时间戳，同时作为任务的 id 把 submit 和 task 连起来；保证不重复，不会是0
+    int64_t stamp()
+    {
+        int64_t now = detail::statsNowNs();
+        int64_t last = lastStamp_.load(std::memory_order_relaxed);
+        do
+        {
+            if (now <= last)
+                now = last + 1;
+        } while (!lastStamp_.compare_exchange_weak(last, now, std::memory_order_relaxed));
+        return now;
+    }
+
+    void record(TraceEventType type, int64_t ts, int64_t dur = 0, int64_t arg = 0)
+    {
+        TraceBuffer *buffer = local();
+        if (buffer != nullptr)
+            buffer->record(type, ts, dur, arg);
+    }
+
+    // 记录从 start 到现在的一段
+    void recordSince(TraceEventType type, int64_t start, int64_t arg = 0)
+    {
+        record(type, start, detail::statsNowNs() - start, arg);
+    }
+
+    // 提交完一个任务，start 是 stamp() 得到的提交时间，queued 表示任务放入了队列
+    void recordSubmit(int64_t start, bool queued)
+    {
+        recordSince(TraceEventType::TRACE_SUBMIT, start, queued ? start : 0);
+    }
+
+    // 批量提交完，stamps 是每个任务的提交时间，前 accepted 个被接受
+    void recordBatch(const std::vector<int64_t> &stamps, std::size_t accepted)
+    {
+        if (stamps.empty())
+            return;
+        recordSince(TraceEventType::TRACE_SUBMIT_BATCH, stamps.front(), (int64_t)stamps.size());
+        for (std::size_t i = 0; i < accepted; i++)
+            record(TraceEventType::TRACE_QUEUED, stamps[i], 0, stamps[i]);
+    }
+
+    // 获取 mtx，锁被占用时记录等待的时间；没有打开时间线时就是普通的加锁
+    std::unique_lock<std::mutex> lock(std::mutex &mtx)
+    {
+        if (!enabled_)
+            return std::unique_lock<std::mutex>(mtx);
+        if (mtx.try_lock())
+            return std::unique_lock<std::mutex>(mtx, std::adopt_lock);
+        int64_t start = detail::statsNowNs();
+        mtx.lock();
+        recordSince(TraceEventType::TRACE_LOCK, start);
+        return std::unique_lock<std::mutex>(mtx, std::adopt_lock);
+    }
+
+    // 导出为 Chrome trace event 格式的 JSON，pool 作为进程名
+    std::string toJson(const std::string &pool = "threadpool") const
+    {
+        std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":";
+        detail::appendJsonString(out, pool);
+        out += "}}";
+        uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (std::size_t tid = 0; tid < buffers_.size(); tid++)
+        {
+            const TraceBuffer &buffer = *buffers_[tid];
+            char buf[256];
+            std::snprintf(buf, sizeof(buf), ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":", tid + 1);
+            out += buf;
+            detail::appendJsonString(out, buffer.name_);
+            out += "}}";
+            std::size_t size = buffer.size();
+            for (std::size_t i = 0; i < size; i++)
+                appendEvent(out, tid + 1, buffer.event(i));
+            dropped += buffer.dropped();
+        }
+        char buf[128];
+        std::snprintf(buf, sizeof(buf), "\n],\"otherData\":{\"dropped_events\":\"%llu\"}}\n", (unsigned long long)dropped);
+        out += buf;
+        return out;
+    }
+
+    // 写到 path：先写临时文件再改名，不会留下写了一半的文件
+    bool writeFile(const std::string &path, const std::string &pool = "threadpool") const
+    {
+        std::string text = toJson(pool);
+        std::string tmp = path + ".tmp";
+        FILE *fp = std::fopen(tmp.c_str(), "w");
+        if (fp == nullptr)
+            return false;
+        bool ok = std::fwrite(text.data(), 1, text.size(), fp) == text.size();
+        ok = std::fclose(fp) == 0 && ok;
+        if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            std::remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    TraceRecorder(const TraceRecorder &) = delete;
+    TraceRecorder &operator=(const TraceRecorder &) = delete;
+
+private:
+    // 每个记录器一个不重复的编号，线程缓存里用它代替地址，记录器销毁以后地址被复用也不会找错
+    static uint64_t nextId()
+    {
+        static std::atomic<uint64_t> next(1);
+        return next++;
+    }
+
+    // 线程缓存里的一项：记录器编号和正在使用的缓冲区，线程退出或者被挤出缓存时归还缓冲区
+    // 缓冲区只由记录器持有，记录器销毁时一起释放；记录器还在时 raw_ 一直有效，记录事件不需要 lock()
+    struct Lease
+    {
+        Lease(uint64_t recorder, const std::shared_ptr<TraceBuffer> &buffer) : recorder_(recorder), raw_(buffer.get()), buffer_(buffer)
+        {
+        }
+
+        Lease(Lease &&other) = default;
+
+        Lease &operator=(Lease &&other)
+        {
+            if (this != &other)
+            {
+                reset();
+                recorder_ = other.recorder_;
+                raw_ = other.raw_;
+                buffer_ = std::move(other.buffer_);
+            }
+            return *this;
+        }
+
+        ~Lease()
+        {
+            reset();
+        }
+
+        void reset()
+        {
+            std::shared_ptr<TraceBuffer> buffer = buffer_.lock();
+            if (buffer != nullptr)
+                buffer->release();
+            buffer_.reset();
+        }
+
+        uint64_t recorder_;
+        TraceBuffer *raw_;
+        std::weak_ptr<TraceBuffer> buffer_;
+    };
+
+    static std::vector<Lease> &leases()
+    {
+        static thread_local std::vector<Lease> cache;
+        return cache;
+    }
+
+    // 当前线程的缓冲区，第一次调用时借用一个；缓冲区都在使用时返回nullptr，事件丢弃并计数
+    TraceBuffer *local()
+    {
+        for (const Lease &lease : leases())
+        {
+            if (lease.recorder_ == id_)
+                return lease.raw_;
+        }
+        std::shared_ptr<TraceBuffer> buffer;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            for (const std::shared_ptr<TraceBuffer> &external : externalBuffers_)
+            {
+                if (external->tryAcquire())
+                {
+                    buffer = external;
+                    break;
+                }
+            }
+            if (buffer == nullptr && externalBuffers_.size() < TRACE_EXTERNAL_BUFFERS)
+            {
+                buffer = std::make_shared<TraceBuffer>("thread " + std::to_string(externalBuffers_.size() + 1), capacity_);
+                externalBuffers_.push_back(buffer);
+                buffers_.push_back(buffer);
+            }
+        }
+        if (buffer == nullptr)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed); // 多个线程同时丢弃，不能用 detail::bump
+            return nullptr;
+        }
+        remember(buffer);
+        return buffer.get();
+    }
+
+    // 放入当前线程的缓存，替换这个记录器原来的一项
+    // 一个线程给很多个线程池提交过任务时只保留最近的几个，被挤掉的归还缓冲区，以后再记录时重新借用
+    void remember(const std::shared_ptr<TraceBuffer> &buffer)
+    {
+        std::vector<Lease> &cache = leases();
+        for (Lease &lease : cache)
+        {
+            if (lease.recorder_ == id_)
+            {
+                lease = Lease(id_, buffer);
+                return;
+            }
+        }
+        if (cache.size() >= 8)
+            cache.erase(cache.begin());
+        cache.push_back(Lease(id_, buffer));
+    }
+
+    void appendEvent(std::string &out, std::size_t tid, const TraceEvent &event) const
+    {
+        double ts = (double)(event.ts_ - origin_);
+        char extra[128];
+        switch (event.type_)
+        {
+        case TraceEventType::TRACE_SUBMIT:
+            std::snprintf(extra, sizeof(extra), ",\"dur\":%.3f,\"args\":{\"queued\":%s}", event.dur_ / 1000.0, event.arg_ != 0 ? "true" : "false");
+            detail::appendTraceEvent(out, "submit", "X", tid, ts, extra);
+            appendFlow(out, "s", tid, ts, event.arg_);
+            break;
+        case TraceEventType::TRACE_SUBMIT_BATCH:
+            std::snprintf(extra, sizeof(extra), ",\"dur\":%.3f,\"args\":{\"tasks\":%lld}", event.dur_ / 1000.0, (long long)event.arg_);
+            detail::appendTraceEvent(out, "submit batch", "X", tid, ts, extra);
+            break;
+        case TraceEventType::TRACE_QUEUED:
+            appendFlow(out, "s", tid, ts, event.arg_);
+            break;
+        case TraceEventType::TRACE_TASK:
+            if (event.arg_ != 0)
+                std::snprintf(extra, sizeof(extra), ",\"dur\":%.3f,\"args\":{\"queue_us\":%.3f}", event.dur_ / 1000.0, (event.ts_ - event.arg_) / 1000.0);
+            else
+                std::snprintf(extra, sizeof(extra), ",\"dur\":%.3f", event.dur_ / 1000.0);
+            detail::appendTraceEvent(out, "task", "X", tid, ts, extra);
+            appendFlow(out, "f", tid, ts, event.arg_);
+            break;
+        case TraceEventType::TRACE_STEAL:
+            std::snprintf(extra, sizeof(extra), ",\"s\":\"t\",\"args\":{\"victim\":%lld}", (long long)event.arg_);
+            detail::appendTraceEvent(out, "steal", "i", tid, ts, extra);
+            break;
+        case TraceEventType::TRACE_IDLE:
+            std::snprintf(extra, sizeof(extra), ",\"dur\":%.3f,\"args\":{\"woke\":\"%s\"}", event.dur_ / 1000.0, detail::wakeSourceName(event.arg_));
+            detail::appendTraceEvent(out, "idle", "X", tid, ts, extra);
+            break;
+        case TraceEventType::TRACE_LOCK:
+            std::snprintf(extra, sizeof(extra), ",\"dur\":%.3f,\"args\":{\"mutex\":\"taskQueueMtx_\"}", event.dur_ / 1000.0);
+            detail::appendTraceEvent(out, "lock wait", "X", tid, ts, extra);
+            break;
+        }
+    }
+
+    // submit 到 task 的箭头，起点和终点分别绑定到所在的那一段上
+    void appendFlow(std::string &out, const char *ph, std::size_t tid, double ts, int64_t id) const
+    {
+        if (id == 0)
+            return;
+        char extra[64];
+        std::snprintf(extra, sizeof(extra), ",\"id\":%lld,\"bp\":\"e\"", (long long)(id - origin_));
+        detail::appendTraceEvent(out, "task", ph, tid, ts, extra);
+    }
+
+    bool enabled_;
+    std::size_t capacity_;
+    uint64_t id_;
+    int64_t origin_;                  // 导出时时间戳减去这个值，数字短一些
+    std::atomic<int64_t> lastStamp_;  // 最近一次提交的时间戳
+    std::atomic<uint64_t> dropped_;   // 没有空闲的缓冲区时丢弃的事件数量
+    mutable std::mutex mtx_;          // 保护下面的缓冲区列表和线程名
+    std::vector<std::shared_ptr<TraceBuffer>> buffers_;         // 所有的缓冲区，按创建顺序导出
+    std::vector<std::shared_ptr<TraceBuffer>> workerBuffers_;   // 每个线程槽位一个
+    std::vector<std::shared_ptr<TraceBuffer>> externalBuffers_; // 线程池以外的线程借用的
+};
+
+#endif
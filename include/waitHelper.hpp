@@ -0,0 +1,65 @@
+#ifndef WAIT_HELPER_HPP
+#define WAIT_HELPER_HPP
+
+#include <completion.hpp>
+#include <idleStack.hpp>
+
+/*
+等待时帮忙执行任务
+线程池的工作线程在任务里面等待另一个任务的结果（Future::get、Result::get、并行算法、TaskGroup::wait）时，
+如果直接挂起，线程少、队列小的时候很容易所有线程都在等待，被等待的任务却没有线程执行，造成死锁
+工作线程启动时登记一个 WaitHelper，等待期间先执行排队的任务，没有任务可做时挂起在线程池的空闲栈上，
+等待的结果完成或者线程池有了新任务时被唤醒
+*/
+class WaitHelper
+{
+public:
+    virtual ~WaitHelper() = default;
+
+    // 在当前线程上执行一个排队的任务，没有任务返回false
+    virtual bool runOne() = 0;
+
+    // 没有任务可以帮忙时挂起，done 完成或者线程池有新任务时返回（也可能提前返回）
+    virtual void park(Completion &done) = 0;
+
+    // 当前线程登记的 WaitHelper，不是线程池的工作线程时为nullptr
+    static WaitHelper *&current()
+    {
+        static thread_local WaitHelper *helper = nullptr;
+        return helper;
+    }
+};
+
+/*
+WaitHelper::park 的实现：把 done 作为等待者压入线程池的空闲栈，提交任务时和空闲线程一样被唤醒
+和空闲线程的约定一样，先登记再检查任务数量，提交任务的线程先增加任务数量再唤醒，不会丢失唤醒
+*/
+template <typename Count>
+void parkWaiter(IdleStack &idle, const Count &taskCnt, Completion &done)
+{
+    done.arm();
+    idle.pushWaiter(&done);
+    if (taskCnt == 0 && !done.isDone())
+        done.waitWake();
+    // 被新任务唤醒，但是结果已经完成、不会再去取任务了，把唤醒转给下一个空闲线程
+    if (!idle.remove(&done) && done.isDone() && taskCnt != 0)
+        idle.wakeOne();
+}
+
+// 等待 done 完成，工作线程等待期间帮忙执行任务
+inline void helpWait(Completion &done)
+{
+    WaitHelper *helper = WaitHelper::current();
+    if (helper == nullptr)
+    {
+        done.wait();
+        return;
+    }
+    while (!done.isDone())
+    {
+        if (!helper->runOne())
+            helper->park(done);
+    }
+}
+
+#endif
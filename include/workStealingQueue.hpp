@@ -0,0 +1,98 @@
+#ifndef WORK_STEALING_QUEUE_HPP
+#define WORK_STEALING_QUEUE_HPP
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+
+/*
+每个工作线程私有的任务双端队列
+owner线程：从尾部 push / pop（LIFO，刚提交的任务数据还在cache里）
+其他线程（小偷）：从头部 steal（FIFO，偷走最老、通常也是最大的任务）
+
+锁只在本队列内部使用，owner自己操作时基本不会有竞争，
+不会像全局任务队列的 taskQueueMtx_ 那样被所有线程争抢
+*/
+
+// 私有队列的长度上限：超过以后，全局队列有空余时新任务放入全局队列，让空闲的线程直接取走，
+// 全局队列也满了仍然放入私有队列，线程池自己的线程不会阻塞在提交任务上
+const std::size_t LOCAL_QUEUE_MAX = 256;
+
+template <typename T>
+class WorkStealingQueue
+{
+public:
+    WorkStealingQueue() : size_(0)
+    {
+    }
+
+    WorkStealingQueue(const WorkStealingQueue &) = delete;
+    WorkStealingQueue &operator=(const WorkStealingQueue &) = delete;
+
+    // owner线程放入任务
+    void push(T &&item)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        deque_.emplace_back(std::move(item));
+        size_.store(deque_.size(), std::memory_order_relaxed);
+    }
+
+    // owner线程一次放入一批任务，只加一次锁
+    template <typename Iter>
+    void pushBatch(Iter first, Iter last)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (; first != last; ++first)
+            deque_.emplace_back(*first);
+        size_.store(deque_.size(), std::memory_order_relaxed);
+    }
+
+    // owner线程取出最新放入的任务
+    bool pop(T &item)
+    {
+        // 先无锁判断一下，空队列不需要加锁
+        if (size_.load(std::memory_order_relaxed) == 0)
+            return false;
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (deque_.empty())
+            return false;
+        item = std::move(deque_.back());
+        deque_.pop_back();
+        size_.store(deque_.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    // 其他线程从头部偷取最老的任务
+    bool steal(T &item)
+    {
+        if (size_.load(std::memory_order_relaxed) == 0)
+            return false;
+        // 偷取时不阻塞等待，owner正在操作就去偷别人的
+        std::unique_lock<std::mutex> lock(mtx_, std::try_to_lock);
+        if (!lock.owns_lock() || deque_.empty())
+            return false;
+        item = std::move(deque_.front());
+        deque_.pop_front();
+        size_.store(deque_.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    // 近似大小，只用于调度时的判断
+    std::size_t size() const
+    {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+private:
+    std::deque<T> deque_;
+    std::atomic<std::size_t> size_;
+    std::mutex mtx_;
+};
+
+#endif
@@ -19,7 +19,7 @@ int main()
     pool.setMode(PoolMode::MODE_CACHED);
     pool.start(3);
     std::this_thread::sleep_for(std::chrono::seconds(4));
-    std::future<int> r1 = pool.submitTask(sum1,1,2);
+    Future<int> r1 = pool.submitTask(sum1,1,2);
     std::cout << r1.get() << std::endl;
     //这里Result对象要析构
     /**
@@ -1,25 +1,77 @@
 #include "threadpool.h"
+#include <algorithm>
 #include <iostream>
 
 const int TASK_MAX_THRESHHOLD = 4;
 const int THREAD_MAX_THRESHHOLD = 10;
-const int THREAD_MAX_IDLE_TIME = 10; // 单位：秒
 
 // 线程池构造
 ThreadPool::ThreadPool()
-    : initThreadSize_(0), taskCnt_(0), taskQueueMaxThreshHold_(TASK_MAX_THRESHHOLD), poolMode_(PoolMode::MODE_FIXED), isRunning_(false), idleThreadSize_(0), maxThreadSize_(THREAD_MAX_THRESHHOLD), curThreadSize_(0)
+    : initThreadSize_(0), maxThreadSize_(THREAD_MAX_THRESHHOLD), curThreadSize_(0), idleThreadSize_(0), taskCnt_(0), taskQueueMaxThreshHold_(TASK_MAX_THRESHHOLD), queueMode_(QueueMode::MODE_LOCKED), waitingProducers_(0), overflowCnt_(0), highCnt_(0), poolMode_(PoolMode::MODE_FIXED), statsEnabled_(false), submitted_(0), rejected_(0), queueHighWater_(0), rejectPolicy_(RejectPolicy::REJECT_TIMEOUT), submitTimeout_(SUBMIT_TIMEOUT_DEFAULT), resource_(slabResource()), placementSlot_(0), isRunning_(false), stopping_(false), cancelPending_(false), abort_(false)
 {
 }
 
 // 线程池析构
 ThreadPool::~ThreadPool()
 {
+    // 之前的 shutdown 超时返回时，这里一直等到线程退出
+    shutdown();
+}
+
+// 关闭线程池，标志只会从false变为true，再次调用可以换成更快的方式
+bool ThreadPool::shutdown(ShutdownMode mode, std::chrono::milliseconds timeout)
+{
+    stopping_ = true;
+    if (mode != ShutdownMode::SHUTDOWN_DRAIN)
+        cancelPending_ = true;
+    if (mode == ShutdownMode::SHUTDOWN_ABORT)
+        abort_ = true;
     isRunning_ = false;
     // 等待线程池里面所有的线程返回  有两种状态：阻塞 & 正在执行任务中
-    std::unique_lock<std::mutex> lock(taskQueueMtx_);
-    notEmpty_.notify_all();
-    exitCond_.wait(lock, [&]() -> bool
-                   { return threads_.size() == 0; });
+    idleWorkers_.wakeAll();
+    {
+        std::unique_lock<std::mutex> lock(taskQueueMtx_);
+        auto exited = [&]() -> bool
+        { return threads_.size() == 0; };
+        if (timeout == SHUTDOWN_WAIT_FOREVER)
+            exitCond_.wait(lock, exited);
+        else if (!exitCond_.wait_for(lock, timeout, exited))
+            return false;
+        reapThreads();
+    }
+    // 和关闭同时提交、没有线程来得及执行的任务，在当前线程上处理掉
+    std::shared_ptr<TaskBase> task;
+    while (taskCnt_ > 0 && acquireTask(nullptr, task))
+        runTask(task, nullptr);
+    return true;
+}
+
+// 线程退出，调用时已经持有 taskQueueMtx_
+void ThreadPool::exitThread(int threadId)
+{
+    Worker *self = currentWorker();
+    if (self != nullptr)
+        self->stats_.setActive(false);
+    exited_.push_back(std::move(threads_[threadId]));
+    threads_.erase(threadId);
+    exitCond_.notify_all();
+}
+
+// 退出的线程登记以后不再获取锁，马上就会返回，这里不会等待很久
+void ThreadPool::reapThreads()
+{
+    for (std::unique_ptr<Thread> &thread : exited_)
+        thread->join();
+    exited_.clear();
+}
+
+// 线程池自己的线程提交的子任务仍然接受，正在执行的任务可能要等它们完成
+bool ThreadPool::isStopped() const
+{
+    if (!stopping_)
+        return false;
+    Worker *self = currentWorker();
+    return self == nullptr || self->pool_ != this;
 }
 
 bool ThreadPool::checkRunningState() const
@@ -35,16 +87,49 @@ void ThreadPool::setMode(PoolMode mode)
     poolMode_ = mode;
 }
 
+// 设置任务队列的实现方式
+void ThreadPool::setQueueMode(QueueMode mode)
+{
+    if (checkRunningState())
+        return;
+    queueMode_ = mode;
+}
+
 // 开始线程池
-void ThreadPool::start(int initThreadSize)
+void ThreadPool::start(int initThreadSize, const PlacementPolicy &placement)
 {
     // 修改运行状态
     isRunning_ = true;
+    placement_ = placement;
+    if (queueMode_ == QueueMode::MODE_LOCKFREE)
+        lockFreeQueue_.reset(new LockFreePriorityQueue<std::shared_ptr<TaskBase>>(taskQueueMaxThreshHold_));
     // 记录初始线程个数，默认为4
     initThreadSize_ = initThreadSize;
     curThreadSize_ = initThreadSize;
 
+    // 线程槽位按最多的线程数量创建，之后不再改变，偷取任务时不需要加锁
+    std::size_t slotSize = initThreadSize_;
+    if (poolMode_ == PoolMode::MODE_CACHED && maxThreadSize_ > slotSize)
+        slotSize = maxThreadSize_;
+    workers_.reserve(slotSize);
+    for (std::size_t i = 0; i < slotSize; i++)
+    {
+        workers_.emplace_back(new Worker(this, i));
+        workers_[i]->node_ = placement.nodeFor(i);
+    }
+    // 偷取顺序：从自己的下一个槽位开始依次偷取，避免所有线程都去偷同一个槽位；
+    // 绑核以后同一NUMA节点的槽位排在前面，任务和它的数据尽量留在本节点
+    for (std::size_t i = 0; i < slotSize; i++)
+    {
+        Worker *self = workers_[i].get();
+        for (std::size_t j = 1; j < slotSize; j++)
+            self->stealOrder_.push_back((i + j) % slotSize);
+        std::stable_partition(self->stealOrder_.begin(), self->stealOrder_.end(), [&](std::size_t victim) -> bool
+                              { return workers_[victim]->node_ == self->node_; });
+    }
+
     // 创建线程对象
+    std::vector<int> threadIds;
     threads_.reserve(initThreadSize_);
     for (int i = 0; i < initThreadSize_; i++)
     {
@@ -56,16 +141,18 @@ void ThreadPool::start(int initThreadSize)
 
         // 同时unique_ptr禁止了拷贝构造，所以emplace_back应该传入右值
         threads_.emplace(threadId, std::move(ptr));
+        threadIds.push_back(threadId);
     }
 
     /**
      * 为保证线程创建和启动的公平性，统一创建，统一启动
+     * 线程id是全局递增的，不一定从0开始，所以这里按照记录下来的id启动
      */
 
-    // 启动所有线程     std::vector<Thread *> threads_;
-    for (int i = 0; i < initThreadSize_; i++)
+    // 启动所有线程
+    for (int threadId : threadIds)
     {
-        threads_[i]->start(); // 需要执行一个线程函数
+        threads_[threadId]->start(); // 需要执行一个线程函数
         idleThreadSize_++;
     }
 }
@@ -73,110 +160,402 @@ void ThreadPool::start(int initThreadSize)
 // 定义线程函数     线程池的所有线程从任务队列里面消费任务
 void ThreadPool::threadFunc(int threadId) // 线程函数结束了，对应的线程也就结束了
 {
-    // 操作过程
-#if 0
-    // 获取锁
-    std::unique_lock<std::mutex> lock(taskQueueMtx_);
-    // 判断队列是否为空
-    // while (taskCnt_ == 0)
-    // {
-    //     notEmpty_.wait(lock);
-    // }
-    notEmpty_.wait(lock, [&]() -> bool
-                   { return taskCnt_ > 0; });
-    // 有生产者放入了任务
-    std::shared_ptr<Task> task = taskQueue_.front();
-    task->run();
-    taskQueue_.pop();
-    taskCnt_--;
-    notFull_.notify_all();
-#else
-    auto lastTime = std::chrono::high_resolution_clock().now();
+    Completion parkSlot; // 空闲时挂起在这个槽位上，等待提交任务的线程单独唤醒
+
+    // 占用一个槽位，任务里面再提交的任务放入槽位的私有队列；统计计数器跟着槽位复用
+    Worker *self = claimWorker();
+
+    // 按占用的槽位绑核，和槽位的偷取顺序使用同一个NUMA节点；没有槽位的线程按启动顺序分配
+    std::size_t slot = self != nullptr ? self->index_ : placementSlot_++;
+    if (!detail::pinCurrentThread(placement_.cpusFor(slot)))
+        LOG_WARN("pin worker thread to cpu fail, slot:" << slot);
+    currentWorker() = self;
+    WorkerCounters *stats = statsEnabled_ && self != nullptr ? &self->stats_ : nullptr;
+    if (self != nullptr)
+        self->stats_.setActive(true);
+    bool traced = trace_.enabled();
+    if (traced && self != nullptr)
+        trace_.bindWorker(self->index_);
+
+    // 任务里面等待其他任务的 Result 时，先帮忙执行任务队列里的任务
+    struct Helper : public WaitHelper
+    {
+        Helper(ThreadPool *pool, Worker *self, WorkerCounters *stats) : pool_(pool), self_(self), stats_(stats)
+        {
+        }
+
+        bool runOne() override
+        {
+            std::shared_ptr<TaskBase> task;
+            if (!pool_->acquireTask(self_, task))
+                return false;
+            pool_->runTask(task, stats_);
+            pool_->sampleSizing();
+            return true;
+        }
+
+        void park(Completion &done) override
+        {
+            parkWaiter(pool_->idleWorkers_, pool_->taskCnt_, done);
+        }
+
+        ThreadPool *pool_;
+        Worker *self_;
+        WorkerCounters *stats_;
+    } helper(this, self, stats);
+    WaitHelper::current() = &helper;
 
     // 所有任务必须执行完成，线程池才可以回收所有线程资源
     for (;;)
     {
-        std::shared_ptr<Task> task;
+        std::shared_ptr<TaskBase> task;
+        LOG_TRACE("尝试获取任务...");
+        if (!acquireTask(self, task))
         {
-            // 先获取锁
-            std::unique_lock<std::mutex> lock(taskQueueMtx_);
-            std::cout << "tid:" << std::this_thread::get_id() << "尝试获取任务..." << std::endl;
-
-            // 锁 + 双重判断
-            // 以解决 FIXED模式下，在该循环死锁的问题，notify后while条件仍然为true，然后进行wait（）产生死锁
-            while (taskCnt_ == 0)
+            int64_t parkStart = stats != nullptr || traced ? detail::statsNowNs() : 0;
+            // 先按空闲策略自旋、让出CPU，这期间看到新任务就回去取，不用挂起；线程池结束时去 park 里退出
+            WakeSource source = detail::idleWait(idleStrategy_, [this]() -> bool
+                                                 { return taskCnt_ != 0 || !isRunning_; });
+            // 线程退出以后线程池可能马上被析构，不能再访问计数器
+            if ((source == WakeSource::WAKE_PARK || !isRunning_) && !park(threadId, parkSlot))
+            {
+                WaitHelper::current() = nullptr;
+                currentWorker() = nullptr;
+                return; //线程函数结束，线程结束
+            }
+            if (stats != nullptr)
             {
-                // 线程池要结束，回收线程资源
-                if (!isRunning_)
-                {
-                    threads_.erase(threadId);
-                    exitCond_.notify_all();
-                    std::cout << "threadid:" << std::this_thread::get_id() << "exit!!" << std::endl;
-                    return; //线程函数结束，线程结束
-                }
-                if (poolMode_ == PoolMode::MODE_CACHED)
-                {
-                    // 条件变量超时返回
-                    //  cached模式下，有可能已经创建了很多的线程，但是空闲时间超过60s，
-                    //  应该把多余的线程结束回收掉（超过initThreadSize_数量的线程要进行回收）
-                    // 当前时间 - 上一次线程执行的时间 > 60s
-
-                    //  每一秒钟返回一次     怎么区分，超时返回？还是有任务待执行返回
-                    if (std::cv_status::timeout == notEmpty_.wait_for(lock, std::chrono::seconds(1)))
-                    {
-                        auto now = std::chrono::high_resolution_clock().now();
-                        // 转换为 s
-                        auto dur = std::chrono::duration_cast<std::chrono::seconds>(now - lastTime);
-                        if (dur.count() >= THREAD_MAX_IDLE_TIME && curThreadSize_ > initThreadSize_)
-                        {
-                            // 开始回收当前线程
-                            // 记录线程数量相关的值的修改
-                            // 把线程对象从线程列表容器中删除   没有办法  threadFunc <=> thread 对象
-                            // thread_id ---->线程对象
-                            threads_.erase(threadId);
-                            curThreadSize_--;
-                            idleThreadSize_--;
-                            std::cout << "threadid:" << std::this_thread::get_id() << "exit!!" << std::endl;
-                            return;
-                        }
-                    }
-                }
-                else
-                {
-                    // 等待empty条件
-                    notEmpty_.wait(lock);
-                }
+                stats->idleFor(detail::statsNowNs() - parkStart);
+                stats->wokeFrom(source);
             }
-            idleThreadSize_--;
-            std::cout << "tid:" << std::this_thread::get_id() << "获取任务成功" << std::endl;
-            // 从任务队列中取一个任务出来
-            task = taskQueue_.front();
-            taskQueue_.pop();
+            if (traced)
+                trace_.recordSince(TraceEventType::TRACE_IDLE, parkStart, (int64_t)source);
+            // 被唤醒了，重新去取任务
+            continue;
+        }
+
+        idleThreadSize_--;
+        LOG_TRACE("获取任务成功");
+        runTask(task, stats);
+        idleThreadSize_++;
+        sampleSizing();
+    }
+}
+
+// 执行一个取到的任务，时间线记录在当前线程上
+void ThreadPool::runTask(const std::shared_ptr<TaskBase> &task, WorkerCounters *stats)
+{
+    int64_t start = stats != nullptr || trace_.enabled() ? detail::statsNowNs() : 0;
+    // 当前线程负责执行这个任务
+    if (task != nullptr)
+    {
+        // SHUTDOWN_CANCEL_PENDING 以后取到的任务不再执行，直接取消
+        if (cancelPending_)
+        {
+            task->cancel();
+            return;
+        }
+        // 已经被取消的任务留在队列里，取到时直接跳过
+        if (!task->claim())
+            return;
+        // task->run();    //执行任务；把任务的返回值通过setVal方法给到Result
+        task->exec();
+        if (stats == nullptr && !trace_.enabled())
+            return;
+        int64_t end = detail::statsNowNs();
+        if (stats != nullptr)
+            stats->taskDone(task->enqueueTime_, start, end);
+        if (trace_.enabled())
+            trace_.record(TraceEventType::TRACE_TASK, start, end - start, task->enqueueTime_);
+    }
+}
+
+// cached模式下统计吞吐量；一次提交了很多任务时后面没有提交来触发采样，由工作线程采样
+void ThreadPool::sampleSizing()
+{
+    if (poolMode_ != PoolMode::MODE_CACHED)
+        return;
+    sizer_.taskDone();
+    if (sizer_.due())
+    {
+        std::unique_lock<std::mutex> lock = lockQueue();
+        growThreads();
+    }
+}
+
+// 没有任务时挂起，返回false表示线程要退出
+bool ThreadPool::park(int threadId, Completion &slot)
+{
+    // 先登记为空闲线程，再检查任务数量：提交任务的线程要么看到空闲线程去唤醒，要么这里看到任务数量
+    slot.reset();
+    idleWorkers_.push(&slot);
+    if (taskCnt_ != 0)
+    {
+        leaveIdle(slot);
+        return true;
+    }
+    // 线程池要结束，回收线程资源
+    if (!isRunning_)
+    {
+        leaveIdle(slot);
+        {
+            std::unique_lock<std::mutex> lock = lockQueue();
+            exitThread(threadId);
+        }
+        LOG_DEBUG("thread exit!!");
+        return false;
+    }
+    if (poolMode_ != PoolMode::MODE_CACHED)
+    {
+        // 等待被唤醒
+        slot.wait();
+        return true;
+    }
+
+    // cached模式下，超过最少线程数量的线程只做一次 keepAlive 的定时等待，到期还没有任务就退出
+    if (curThreadSize_ <= minThreads())
+        slot.wait();
+    else if (!slot.waitFor(sizer_.policy().keepAlive_))
+    {
+        if (!idleWorkers_.remove(&slot))
+        {
+            // 超时的同时被唤醒了，继续工作
+            slot.wait();
+            return true;
+        }
+        return !retire(threadId);
+    }
+    // 被唤醒：有新任务，或者调节器在负载持续很低时让空闲线程退出
+    if (taskCnt_ == 0 && isRunning_ && sizer_.takeRetireCredit())
+        return !retire(threadId);
+    return true;
+}
+
+// cached模式下回收当前线程
+bool ThreadPool::retire(int threadId)
+{
+    {
+        std::unique_lock<std::mutex> lock = lockQueue();
+        if (curThreadSize_ <= minThreads())
+            return false;
+        // 记录线程数量相关的值的修改
+        // 把线程对象从线程列表容器中删除   没有办法  threadFunc <=> thread 对象
+        // thread_id ---->线程对象
+        curThreadSize_--;
+        idleThreadSize_--;
+        exitThread(threadId);
+        // 归还槽位：私有队列已经空了（取不到任务才会挂起，私有队列只有自己会放入任务）
+        // 先标记计数器不活跃再归还，新线程占用槽位以后重新标记
+        Worker *self = currentWorker();
+        if (self != nullptr)
+            self->used_ = false;
+    }
+    LOG_DEBUG("thread exit!!");
+    return true;
+}
+
+// 离开空闲栈：如果槽位已经被其他线程弹出，要等它的唤醒完成，槽位才能复用
+void ThreadPool::leaveIdle(Completion &slot)
+{
+    if (!idleWorkers_.remove(&slot))
+        slot.wait();
+}
+
+// 当前线程占用的槽位
+ThreadPool::Worker *&ThreadPool::currentWorker()
+{
+    static thread_local Worker *worker = nullptr;
+    return worker;
+}
+
+// 线程启动时占用一个空闲槽位
+ThreadPool::Worker *ThreadPool::claimWorker()
+{
+    for (const std::unique_ptr<Worker> &worker : workers_)
+    {
+        bool used = false;
+        if (worker->used_.compare_exchange_strong(used, true))
+            return worker.get();
+    }
+    return nullptr;
+}
+
+// 线程池线程把任务放入自己的私有队列，不获取全局的 taskQueueMtx_
+void ThreadPool::pushLocal(Worker *self, const std::shared_ptr<TaskBase> &sp)
+{
+    // 私有队列太长时先尝试放入全局队列
+    if (self->queue_.size() >= LOCAL_QUEUE_MAX && spillTask(sp))
+        return;
+    // 先增加任务计数，再放入队列：准备挂起的线程要么看到任务计数，要么被下面的通知唤醒
+    taskCnt_++;
+    self->queue_.push(std::shared_ptr<TaskBase>(sp));
+    // 有空闲线程才唤醒一个过来偷取
+    idleWorkers_.wakeOne();
+}
+
+// 私有队列超过上限时放入全局队列
+bool ThreadPool::spillTask(const std::shared_ptr<TaskBase> &sp)
+{
+    if (queueMode_ == QueueMode::MODE_LOCKFREE)
+    {
+        taskCnt_++;
+        if (!lockFreeQueue_->tryPush(std::shared_ptr<TaskBase>(sp)))
+        {
             taskCnt_--;
+            return false;
+        }
+    }
+    else
+    {
+        std::unique_lock<std::mutex> lock = lockQueue();
+        if (taskQueue_.size() >= (size_t)taskQueueMaxThreshHold_)
+            return false;
+        taskQueue_.emplace(std::shared_ptr<TaskBase>(sp));
+        taskCnt_++;
+    }
+    idleWorkers_.wakeOne();
+    return true;
+}
+
+// 不阻塞地取一个任务，全局队列里面有高优先级的任务时先取全局队列
+bool ThreadPool::acquireTask(Worker *self, std::shared_ptr<TaskBase> &task)
+{
+    if (highCnt_ > 0 && popShared(task))
+        return true;
+
+    if (self != nullptr && self->queue_.pop(task))
+    {
+        taskCnt_--;
+        return true;
+    }
 
-            // 如果依然有剩余任务，继续通知其他的线程执行任务
-            if (taskCnt_ > 0)
-                notEmpty_.notify_all();
+    if (popShared(task))
+        return true;
 
-            // 取出一个任务，进行通知,通知可以继续提交生产任务
+    // 按槽位的偷取顺序，同一NUMA节点的槽位优先；没有槽位的线程从头开始依次偷取
+    std::size_t victims = self != nullptr ? self->stealOrder_.size() : workers_.size();
+    for (std::size_t i = 0; i < victims; i++)
+    {
+        Worker *victim = workers_[self != nullptr ? self->stealOrder_[i] : i].get();
+        if (victim->queue_.steal(task))
+        {
+            taskCnt_--;
+            if (self != nullptr && statsEnabled_)
+                self->stats_.taskStolen();
+            if (trace_.enabled())
+                trace_.record(TraceEventType::TRACE_STEAL, detail::statsNowNs(), 0, (int64_t)victim->index_);
+            return true;
+        }
+    }
+    return false;
+}
+
+// 全局队列里的任务被取走或者被丢弃
+void ThreadPool::taskPopped(TaskPriority priority)
+{
+    if (priority == TaskPriority::PRIORITY_HIGH)
+        highCnt_--;
+    taskCnt_--;
+}
+
+// 从全局任务队列按优先级取一个任务
+bool ThreadPool::popShared(std::shared_ptr<TaskBase> &task)
+{
+    TaskPriority priority;
+    if (queueMode_ == QueueMode::MODE_LOCKFREE)
+    {
+        // 环形队列满时超额放入的任务放得更早，先取
+        if (overflowCnt_ > 0)
+        {
+            std::unique_lock<std::mutex> lock = lockQueue();
+            if (taskQueue_.pop(task, &priority))
+            {
+                overflowCnt_--;
+                taskPopped(priority);
+                return true;
+            }
+        }
+        if (!lockFreeQueue_->tryPop(task, &priority))
+            return false;
+        taskPopped(priority);
+        // 只有真的有提交线程在等待时才去碰锁和条件变量
+        // 每个优先级的队列单独计算容量，空出的位置不一定是等待的线程需要的，所以全部通知
+        if (waitingProducers_ > 0)
+        {
+            std::unique_lock<std::mutex> lock = lockQueue();
             notFull_.notify_all();
-        } // 就应该把锁释放掉
-        // 当前线程负责执行这个任务
-        if (task != nullptr)
+        }
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock = lockQueue();
+    // 从任务队列中按优先级取一个任务出来
+    if (!taskQueue_.pop(task, &priority))
+        return false;
+    taskPopped(priority);
+
+    // 取出一个任务，空出一个位置，通知一个等待的提交线程
+    notFull_.notify_one();
+    return true;
+}
+
+// 超额放入全局队列
+void ThreadPool::pushUnbounded(const std::shared_ptr<TaskBase> &sp, TaskPriority priority)
+{
+    bool high = priority == TaskPriority::PRIORITY_HIGH;
+    // 先增加任务计数再放入队列，和挂起线程的检查配合避免丢失通知
+    taskCnt_++;
+    if (high)
+        highCnt_++;
+    if (queueMode_ != QueueMode::MODE_LOCKFREE || !lockFreeQueue_->tryPush(std::shared_ptr<TaskBase>(sp), priority))
+    {
+        std::unique_lock<std::mutex> lock = lockQueue();
+        taskQueue_.emplace(std::shared_ptr<TaskBase>(sp), priority);
+        if (queueMode_ == QueueMode::MODE_LOCKFREE)
+            overflowCnt_++;
+        growThreads();
+    }
+    idleWorkers_.wakeOne();
+}
+
+// 无锁模式下放入任务
+bool ThreadPool::pushLockFree(std::shared_ptr<TaskBase> task, TaskPriority priority, const SubmitWait &wait, std::shared_ptr<TaskBase> &evicted)
+{
+    bool high = priority == TaskPriority::PRIORITY_HIGH;
+    for (;;)
+    {
+        // 先增加任务计数再放入队列，和挂起线程的检查配合避免丢失通知
+        taskCnt_++;
+        if (high)
+            highCnt_++;
+        if (lockFreeQueue_->tryPush(std::move(task), priority))
+            break;
+        if (high)
+            highCnt_--;
+        taskCnt_--;
+
+        // REJECT_DISCARD_OLDEST：每一级队列单独计算容量，丢弃同一优先级里最早的任务，只丢弃一个
+        if (rejectPolicy_ == RejectPolicy::REJECT_DISCARD_OLDEST && evicted == nullptr && lockFreeQueue_->tryPopLevel(evicted, priority))
         {
-            // task->run();    //执行任务；把任务的返回值通过setVal方法给到Result
-            task->exec();
+            taskPopped(priority);
+            continue;
         }
+        if (!wait.mayWait())
+            return false;
 
-        idleThreadSize_++;
-        // 更新线程执行完的时间
-        lastTime = std::chrono::high_resolution_clock().now();
+        // 队列满了才使用条件变量等待，等待多久由拒绝策略决定
+        std::unique_lock<std::mutex> lock = lockQueue();
+        waitingProducers_++;
+        bool notFull = wait.wait(notFull_, lock, [&]() -> bool
+                                 { return !lockFreeQueue_->full(priority); });
+        waitingProducers_--;
+        if (!notFull)
+            return false;
     }
-    threads_.erase(threadId);
-    exitCond_.notify_all();
-    std::cout << "threadid:" << std::this_thread::get_id() << "exit!!" << std::endl;
-    return;
-#endif
+
+    // 只有有线程空闲时才需要唤醒，只唤醒一个
+    idleWorkers_.wakeOne();
+    return true;
 }
 
 // 定义任务队列数量上限阈值
@@ -192,15 +571,237 @@ void ThreadPool::setThreadSizeThreshhold(int threshHold)
 {
     if (checkRunningState())
         return;
-    if (poolMode_ == PoolMode::MODE_FIXED)
+    if (poolMode_ == PoolMode::MODE_CACHED)
         maxThreadSize_ = threshHold;
 }
 
+// 设置队列满时的处理策略
+void ThreadPool::setRejectPolicy(RejectPolicy policy, std::chrono::milliseconds timeout)
+{
+    if (checkRunningState())
+        return;
+    rejectPolicy_ = policy;
+    submitTimeout_ = timeout;
+}
+
+// 设置 Result 的内存来源
+void ThreadPool::setAllocator(MemoryResource *resource)
+{
+    if (checkRunningState())
+        return;
+    resource_ = resource;
+}
+
+// 定义cached模式下线程数量的调节策略
+void ThreadPool::setSizingPolicy(const SizingPolicy &policy)
+{
+    if (checkRunningState())
+        return;
+    sizer_.setPolicy(policy);
+}
+
+// 设置工作线程空闲时的等待策略
+void ThreadPool::setIdleStrategy(const IdleStrategy &strategy)
+{
+    if (checkRunningState())
+        return;
+    idleStrategy_ = strategy;
+}
+
 // 给线程池提交任务     用户调用该接口，传入任务对象，生产任务
 // 返回值的问题！！！！！
 // 如果返回值类型直接定义为 Result，那么将会报错显示，拷贝构造函数被删除，为什么不直接调用移动构造函数？？？？
 // C++高版本已解决，11为什么不行？
-std::shared_ptr<Result> ThreadPool::submitTask(std::shared_ptr<Task> sp)
+std::shared_ptr<Result> ThreadPool::submitTask(std::shared_ptr<Task> sp, TaskPriority priority)
+{
+    // 任务入队之后就可能被执行，所以要先创建Result，让task持有Result的指针
+    std::shared_ptr<Result> res = makeResult<Result>(sp);
+    if (enqueue(sp, priority) == SubmitStatus::SUBMIT_REJECTED)
+    {
+        // 返回 Task 还是 Result
+        /**
+         * 两种方式
+         * return task->getResult();    不可以，线程池执行完该任务task，task对象就被析构掉了
+         * return Result(task);
+         */
+        return makeResult<Result>(sp, false);
+    }
+    // 返回任务的 Result 对象
+    return res;
+}
+
+// 不等待地提交任务
+SubmitStatus ThreadPool::trySubmit(std::shared_ptr<Task> sp, std::shared_ptr<Result> &result, TaskPriority priority)
+{
+    result = makeResult<Result>(sp);
+    SubmitStatus status = enqueue(sp, priority, true);
+    if (status == SubmitStatus::SUBMIT_REJECTED)
+        result = makeResult<Result>(sp, false);
+    return status;
+}
+
+// 把任务放入任务队列，打开统计时记录提交时间，队列满时按拒绝策略处理
+SubmitStatus ThreadPool::enqueue(std::shared_ptr<TaskBase> sp, TaskPriority priority, bool tryOnly)
+{
+    if (isStopped())
+    {
+        countSubmitted(0, 1);
+        return SubmitStatus::SUBMIT_REJECTED;
+    }
+    sp->resetCancel(&abort_);
+    int64_t submitStart = stampTask(*sp);
+    std::shared_ptr<TaskBase> evicted;
+    bool ok = pushTask(sp, priority, SubmitWait(rejectPolicy_, submitTimeout_, tryOnly), evicted);
+    // 由当前线程执行的任务不算拒绝，和 enqueueBatch 一样
+    bool callerRuns = !ok && rejectPolicy_ == RejectPolicy::REJECT_CALLER_RUNS && !tryOnly;
+    countSubmitted(ok ? 1 : 0, (ok || callerRuns ? 0 : 1) + (evicted != nullptr ? 1 : 0));
+    if (submitStart != 0)
+        trace_.recordSubmit(submitStart, ok);
+    // 被挤掉的任务在锁外通知它的Result
+    if (evicted != nullptr)
+        evicted->discard();
+    if (ok)
+        return SubmitStatus::SUBMIT_OK;
+    if (callerRuns)
+    {
+        if (sp->claim())
+            sp->exec();
+        return SubmitStatus::SUBMIT_CALLER_RAN;
+    }
+    if (!tryOnly)
+        LOG_WARN("task queue is full,submit task fail.");
+    return SubmitStatus::SUBMIT_REJECTED;
+}
+
+// 把一批任务放入任务队列
+std::size_t ThreadPool::enqueueBatch(std::vector<std::shared_ptr<TaskBase>> &tasks)
+{
+    if (isStopped())
+    {
+        countSubmitted(0, tasks.size());
+        return 0;
+    }
+    for (const std::shared_ptr<TaskBase> &task : tasks)
+        task->resetCancel(&abort_);
+    // 打开时间线时每个任务一个不重复的提交时间，作为任务的 id
+    std::vector<int64_t> stamps;
+    if (trace_.enabled())
+    {
+        stamps.reserve(tasks.size());
+        for (const std::shared_ptr<TaskBase> &task : tasks)
+            stamps.push_back(task->enqueueTime_ = trace_.stamp());
+    }
+    else if (statsEnabled_)
+    {
+        int64_t now = detail::statsNowNs();
+        for (const std::shared_ptr<TaskBase> &task : tasks)
+            task->enqueueTime_ = now;
+    }
+    std::size_t pushed = pushBatch(tasks, SubmitWait(rejectPolicy_, submitTimeout_, false));
+    countSubmitted(pushed, 0);
+    // 放不下的部分按拒绝策略逐个处理，由当前线程执行的任务不算拒绝
+    std::size_t accepted = pushed;
+    while (accepted < tasks.size())
+    {
+        if (rejectPolicy_ == RejectPolicy::REJECT_CALLER_RUNS)
+        {
+            if (tasks[accepted]->claim())
+                tasks[accepted]->exec();
+        }
+        else if (rejectPolicy_ == RejectPolicy::REJECT_DISCARD_OLDEST)
+        {
+            std::shared_ptr<TaskBase> evicted;
+            bool ok = pushTask(tasks[accepted], TaskPriority::PRIORITY_NORMAL, SubmitWait(rejectPolicy_, submitTimeout_, true), evicted);
+            countSubmitted(ok ? 1 : 0, evicted != nullptr ? 1 : 0);
+            if (evicted != nullptr)
+                evicted->discard();
+            if (!ok)
+                break;
+        }
+        else
+        {
+            break;
+        }
+        accepted++;
+    }
+    if (accepted < tasks.size())
+    {
+        LOG_WARN("task queue is full,submit task fail.");
+        countSubmitted(0, tasks.size() - accepted);
+    }
+    trace_.recordBatch(stamps, accepted);
+    return accepted;
+}
+
+int64_t ThreadPool::stampTask(TaskBase &task)
+{
+    if (trace_.enabled())
+        return task.enqueueTime_ = trace_.stamp();
+    if (statsEnabled_)
+        task.enqueueTime_ = detail::statsNowNs();
+    return 0;
+}
+
+std::unique_lock<std::mutex> ThreadPool::lockQueue()
+{
+    return trace_.lock(taskQueueMtx_);
+}
+
+void ThreadPool::countSubmitted(std::size_t submitted, std::size_t rejected)
+{
+    if (rejected > 0)
+        rejected_.fetch_add(rejected, std::memory_order_relaxed);
+    if (statsEnabled_ && submitted > 0)
+    {
+        submitted_.fetch_add(submitted, std::memory_order_relaxed);
+        updateHighWater(queueHighWater_, taskCnt_.load(std::memory_order_relaxed));
+    }
+}
+
+// 打开运行统计
+void ThreadPool::setStatsEnabled(bool enabled)
+{
+    if (checkRunningState())
+        return;
+    statsEnabled_ = enabled;
+}
+
+// 运行统计的快照
+PoolStats ThreadPool::stats()
+{
+    PoolStats stats;
+    // 槽位在 start 时创建，以后不再变化；槽位上的线程退出时计数器保留，再启动的线程接着累加
+    for (const std::unique_ptr<Worker> &worker : workers_)
+        stats.workers_.push_back(worker->stats_.collect(worker->index_, stats));
+    stats.submitted_ = submitted_.load(std::memory_order_relaxed);
+    stats.rejected_ = rejected_.load(std::memory_order_relaxed);
+    stats.queueDepth_ = taskCnt_.load(std::memory_order_relaxed);
+    stats.queueHighWater_ = queueHighWater_.load(std::memory_order_relaxed);
+    stats.threads_ = curThreadSize_;
+    stats.idleThreads_ = idleThreadSize_;
+    return stats;
+}
+
+// 打开任务时间线
+void ThreadPool::setTraceEnabled(bool enabled, std::size_t eventsPerThread)
+{
+    if (checkRunningState())
+        return;
+    trace_.setEnabled(enabled, eventsPerThread);
+}
+
+std::string ThreadPool::traceJson(const std::string &pool) const
+{
+    return trace_.toJson(pool);
+}
+
+bool ThreadPool::writeTrace(const std::string &path, const std::string &pool) const
+{
+    return trace_.writeFile(path, pool);
+}
+
+// enqueue 的实现
+bool ThreadPool::pushTask(const std::shared_ptr<TaskBase> &sp, TaskPriority priority, const SubmitWait &wait, std::shared_ptr<TaskBase> &evicted)
 {
 #if 0
     //获取锁
@@ -214,8 +815,37 @@ std::shared_ptr<Result> ThreadPool::submitTask(std::shared_ptr<Task> sp)
     //因为新放了任务，任务队列肯定不空了，在notEmpty_上进行通知
     notEmpty_.notify_all();
 #else
+    // 线程池里面的线程提交的普通优先级任务（任务里面再提交任务），直接放入该线程自己的任务队列
+    // 其他优先级的任务要放入全局的多级队列，才能按优先级调度；线程池线程不能等待队列腾出位置
+    // （所有线程都在等待时会死锁），队列满了也超额放入
+    Worker *self = currentWorker();
+    if (self != nullptr && self->pool_ == this)
+    {
+        if (priority == TaskPriority::PRIORITY_NORMAL)
+            pushLocal(self, sp);
+        else
+            pushUnbounded(sp, priority);
+        return true;
+    }
+
+    if (queueMode_ == QueueMode::MODE_LOCKFREE)
+    {
+        if (!pushLockFree(sp, priority, wait, evicted))
+        {
+            return false;
+        }
+
+        // cached模式下到了采样时间才获取锁
+        if (poolMode_ == PoolMode::MODE_CACHED && sizer_.due())
+        {
+            std::unique_lock<std::mutex> lock = lockQueue();
+            growThreads();
+        }
+        return true;
+    }
+
     // 获取锁
-    std::unique_lock<std::mutex> lock(taskQueueMtx_);
+    std::unique_lock<std::mutex> lock = lockQueue();
     // 线程的通信    等待任务队列有空余
     //  while(taskCnt_==taskQueueMaxThreshHold_){
     //      notFull_.wait(lock);
@@ -228,33 +858,133 @@ std::shared_ptr<Result> ThreadPool::submitTask(std::shared_ptr<Task> sp)
     // wait:一直等待，直到条件满足，再进行后续操作
     // wait_for:等待有时长限制，比如3s，1s，时间一到，不再等待
     // wait_until:设置等待时间的截止点
-    //  用户提交任务最长不能阻塞超过1s，否则判断题脚任务失败
-    if (!notFull_.wait_for(lock, std::chrono::seconds(1), [&]() -> bool
-                           { return taskQueue_.size() < (size_t)taskQueueMaxThreshHold_; }))
+    //  等待多久由拒绝策略决定，默认最长不能阻塞超过1s，否则判断提交任务失败
+    if (!wait.wait(notFull_, lock, [&]() -> bool
+                   { return taskQueue_.size() < (size_t)taskQueueMaxThreshHold_; }))
     {
-        // 返回false，表示notFull_等待1s，条件依然没有满足
-        std::cerr << "task queue is full,submit task fail." << std::endl;
-        LOG("task queue is full,submit task fail.");
-        // 返回 Task 还是 Result
-        /**
-         * 两种方式
-         * return task->getResult();    不可以，线程池执行完该任务task，task对象就被析构掉了
-         * return Result(task);
-         */
-
-        return std::make_shared<Result>(sp, false);
+        // 返回false，表示等待结束，条件依然没有满足
+        // REJECT_DISCARD_OLDEST：丢弃一个不比新任务重要的最早的任务，给新任务腾出位置
+        TaskPriority evictedPriority;
+        if (rejectPolicy_ != RejectPolicy::REJECT_DISCARD_OLDEST || !taskQueue_.popOldest(evicted, priority, &evictedPriority))
+            return false;
+        taskPopped(evictedPriority);
     }
     // 如果有空余，把任务放入任务队列中
-    taskQueue_.emplace(sp);
+    taskQueue_.emplace(std::shared_ptr<TaskBase>(sp), priority);
+    if (priority == TaskPriority::PRIORITY_HIGH)
+        highCnt_++;
     taskCnt_++;
-    // 因为新放了任务，任务队列肯定不空了，在notEmpty_上进行通知
-    notEmpty_.notify_all();
 
     // cached模式，任务处理比较紧急 场景：小而快的任务，
-    // 需要根据任务数量和空闲线程的数量，判断是否需要创建新的线程出来？
-    if (poolMode_ == PoolMode::MODE_CACHED && taskCnt_ > idleThreadSize_ && curThreadSize_ < maxThreadSize_)
+    // 需要根据排队时间和吞吐量，判断是否需要创建新的线程出来？
+    growThreads();
+    lock.unlock();
+
+    // 因为新放了任务，任务队列肯定不空了，只唤醒一个最近空闲的线程
+    idleWorkers_.wakeOne();
+    return true;
+#endif
+}
+
+// 批量提交任务
+std::vector<std::shared_ptr<Result>> ThreadPool::submitBatch(const std::vector<std::shared_ptr<Task>> &tasks)
+{
+    std::vector<std::shared_ptr<Result>> results;
+    std::vector<std::shared_ptr<TaskBase>> batch;
+    results.reserve(tasks.size());
+    batch.reserve(tasks.size());
+    for (const std::shared_ptr<Task> &sp : tasks)
+    {
+        // 任务入队之后就可能被执行，先创建Result
+        results.push_back(makeResult<Result>(sp));
+        batch.push_back(sp);
+    }
+    std::size_t pushed = enqueueBatch(batch);
+    for (std::size_t i = pushed; i < tasks.size(); i++)
+        results[i] = makeResult<Result>(tasks[i], false);
+    return results;
+}
+
+// enqueueBatch 的实现，放不下时按 wait 等待，返回放入的数量
+std::size_t ThreadPool::pushBatch(std::vector<std::shared_ptr<TaskBase>> &tasks, const SubmitWait &wait)
+{
+    // 线程池里面的线程提交的，整批放入自己的私有队列，超出上限的部分尽量放入全局队列
+    Worker *self = currentWorker();
+    if (self != nullptr && self->pool_ == this)
+    {
+        for (const std::shared_ptr<TaskBase> &sp : tasks)
+            pushLocal(self, sp);
+        return tasks.size();
+    }
+
+    std::size_t pushed = 0;
+    std::size_t woken = 0;
+    if (queueMode_ == QueueMode::MODE_LOCKFREE)
     {
-        LOG("Create new Thread!!!");
+        while (pushed < tasks.size())
+        {
+            taskCnt_++;
+            if (lockFreeQueue_->tryPush(std::move(tasks[pushed])))
+            {
+                pushed++;
+                continue;
+            }
+            taskCnt_--;
+
+            // 队列满了，先唤醒线程去执行已经放入的任务，再等待队列腾出空间
+            idleWorkers_.wake(pushed - woken);
+            woken = pushed;
+            if (!wait.mayWait())
+                break;
+            std::unique_lock<std::mutex> lock = lockQueue();
+            waitingProducers_++;
+            bool notFull = wait.wait(notFull_, lock, [&]() -> bool
+                                     { return !lockFreeQueue_->full(TaskPriority::PRIORITY_NORMAL); });
+            waitingProducers_--;
+            if (!notFull)
+                break;
+        }
+        idleWorkers_.wake(pushed - woken);
+        std::unique_lock<std::mutex> lock = lockQueue();
+        growThreads();
+    }
+    else
+    {
+        // 整批任务只获取一次锁
+        std::unique_lock<std::mutex> lock = lockQueue();
+        while (pushed < tasks.size())
+        {
+            if (!wait.wait(notFull_, lock, [&]() -> bool
+                           { return taskQueue_.size() < (size_t)taskQueueMaxThreshHold_; }))
+                break;
+            while (pushed < tasks.size() && taskQueue_.size() < (size_t)taskQueueMaxThreshHold_)
+            {
+                taskQueue_.emplace(std::move(tasks[pushed++]));
+                taskCnt_++;
+            }
+            // 唤醒线程去执行已经放入的任务，队列满的时候这样才能腾出空间
+            idleWorkers_.wake(pushed - woken);
+            woken = pushed;
+        }
+        // 队列还有空余，把通知传给下一个等待的提交线程
+        if (taskQueue_.size() < (size_t)taskQueueMaxThreshHold_)
+            notFull_.notify_one();
+        growThreads();
+    }
+    return pushed;
+}
+
+// cached模式下按调节器的采样结果增减线程
+void ThreadPool::growThreads()
+{
+    if (poolMode_ != PoolMode::MODE_CACHED)
+        return;
+    reapThreads();
+    int retire = 0;
+    int grow = sizer_.sample(taskCnt_, idleThreadSize_, curThreadSize_, minThreads(), (int)maxThreadSize_, &retire);
+    for (int i = 0; i < grow; i++)
+    {
+        LOG_DEBUG("Create new Thread!!!");
         // 创建新线程
         std::unique_ptr<Thread> ptr(new Thread(std::bind(&ThreadPool::threadFunc, this, std::placeholders::_1)));
         int threadId = ptr->getId();
@@ -265,10 +995,16 @@ std::shared_ptr<Result> ThreadPool::submitTask(std::shared_ptr<Task> sp)
         idleThreadSize_++;
         curThreadSize_++;
     }
+    // 唤醒空闲线程去领取退出名额
+    if (retire > 0)
+        idleWorkers_.wake(retire);
+}
 
-    // 返回任务的 Result 对象
-    return std::make_shared<Result>(sp);
-#endif
+// cached模式下最少保留的线程数量
+int ThreadPool::minThreads() const
+{
+    int minThreads = sizer_.policy().minThreads_;
+    return minThreads > 0 ? minThreads : (int)initThreadSize_;
 }
 
 /////////////// 线程方法实现
@@ -280,17 +1016,18 @@ Thread::Thread(ThreadFunc func)
 {
 }
 
-// 线程析构
+// 线程析构，没有 join 的线程（线程池没有正常关闭）只能分离
 Thread::~Thread()
 {
+    if (thread_.joinable())
+        thread_.detach();
 }
 
 // 启动线程
 void Thread::start()
 {
-    // 创建一个线程来执行一个线程函数
-    std::thread t(func_, threadId_); // C++11来说，线程对象t 和线程函数func_
-    t.detach();                      // 设置分离线程  pthread_detach  pthread_t设置成分离线程
+    // 创建一个线程来执行一个线程函数，线程池关闭时 join
+    thread_ = std::thread(func_, threadId_);
     /**
      * 这里为什么要绑定 ThreadPool中的 threadFunc
      * 因为线程池创建线程，线程执行线程函数理应由线程池提供线程所需要执行的函数
@@ -298,6 +1035,12 @@ void Thread::start()
      */
 }
 
+void Thread::join()
+{
+    if (thread_.joinable())
+        thread_.join();
+}
+
 int Thread::getId() const
 {
     return threadId_;
@@ -315,6 +1058,12 @@ void Task::exec()
         result_->setVal(run()); // 这里发生多态调用
 }
 
+void Task::discard()
+{
+    if (result_ != nullptr)
+        result_->invalidate();
+}
+
 void Task::setResult(Result *res)
 {
     result_ = res;
@@ -322,14 +1071,14 @@ void Task::setResult(Result *res)
 
 /////////////////   Result方法的实现
 Result::Result(std::shared_ptr<Task> task, bool isValid)
-    : isValid_(isValid), task_(task), any_(nullptr)
+    : any_(nullptr), task_(task), isValid_(isValid)
 {
     task->setResult(this);
 }
 
 Result::~Result()
 {
-    LOG("result destroyed!!!");
+    LOG_TRACE("result destroyed!!!");
 }
 
 Any Result::get()
@@ -338,14 +1087,34 @@ Any Result::get()
     {
         return nullptr;
     }
-    sem_.wait(); // task任务如果没有执行完，这里会阻塞用户的线程
+    helpWait(done_); // task任务如果没有执行完，这里会阻塞用户的线程（线程池线程会先帮忙执行其他任务）
+    if (!isValid_)
+    {
+        return nullptr;
+    }
     return std::move(any_);
 }
 
+void Result::invalidate()
+{
+    isValid_ = false;
+    done_.post();
+}
+
+bool Result::isValid() const
+{
+    return isValid_;
+}
+
+bool Result::cancel()
+{
+    return task_->cancel();
+}
+
 void Result::setVal(Any any)
 {
     // 存储task的返回值
     this->any_ = std::move(any);
-    // 已经获取任务的返回值，增加信号量的资源
-    this->sem_.post();
+    // 已经获取任务的返回值，通知等待的线程
+    this->done_.post();
 }
@@ -0,0 +1,133 @@
+// 无锁队列 MpmcQueue / LockFreePriorityQueue 的回归测试
+#include <mpmcQueue.hpp>
+#include <priorityQueue.hpp>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "testing.hpp"
+
+namespace
+{
+    using testing::check;
+
+    // 单线程把环形队列放满：满了以后放入失败且不移走元素，取出一个后又能放入，取出顺序与放入顺序一致
+    void fullRing()
+    {
+        MpmcQueue<std::unique_ptr<int>> queue(5);
+        check(queue.capacity() == 8, "full ring: capacity is rounded up to a power of two");
+        for (int i = 0; i < (int)queue.capacity(); i++)
+            check(queue.tryPush(std::unique_ptr<int>(new int(i))), "full ring: push below capacity succeeds");
+        check(queue.size() == queue.capacity(), "full ring: size equals capacity");
+
+        std::unique_ptr<int> extra(new int(100));
+        check(!queue.tryPush(std::move(extra)), "full ring: push into a full ring fails");
+        check(extra != nullptr && *extra == 100, "full ring: a failed push keeps the item");
+
+        std::unique_ptr<int> item;
+        check(queue.tryPop(item) && *item == 0, "full ring: pop returns the oldest item");
+        check(queue.tryPush(std::move(extra)), "full ring: push succeeds after a pop");
+        for (int i = 1; i < (int)queue.capacity(); i++)
+            check(queue.tryPop(item) && *item == i, "full ring: items come out in push order");
+        check(queue.tryPop(item) && *item == 100, "full ring: the late item comes out last");
+        check(!queue.tryPop(item) && queue.empty(), "full ring: pop from an empty ring fails");
+    }
+
+    // 队列析构时释放还没有取出的元素
+    void destroyNonEmpty()
+    {
+        std::shared_ptr<int> shared = std::make_shared<int>(0);
+        {
+            MpmcQueue<std::shared_ptr<int>> queue(4);
+            for (int i = 0; i < 3; i++)
+                queue.tryPush(std::shared_ptr<int>(shared));
+            check(shared.use_count() == 4, "destroy: queued copies are alive");
+        }
+        check(shared.use_count() == 1, "destroy: queued items are released with the queue");
+    }
+
+    // 多生产者多消费者：环形队列很小，生产者经常遇到队列满，每个元素必须恰好被取出一次
+    void stress()
+    {
+        const int PRODUCERS = 4;
+        const int CONSUMERS = 4;
+        const int PER_PRODUCER = 50000;
+        const int TOTAL = PRODUCERS * PER_PRODUCER;
+
+        MpmcQueue<int> queue(16);
+        std::vector<std::atomic_int> seen(TOTAL);
+        for (std::atomic_int &count : seen)
+            count.store(0);
+        std::atomic_int popped(0);
+        std::atomic_int fullHits(0);
+
+        std::vector<std::thread> threads;
+        for (int p = 0; p < PRODUCERS; p++)
+            threads.emplace_back([&, p]()
+                                 {
+                for (int i = 0; i < PER_PRODUCER; i++)
+                {
+                    int value = p * PER_PRODUCER + i;
+                    while (!queue.tryPush(std::move(value)))
+                    {
+                        fullHits.fetch_add(1, std::memory_order_relaxed);
+                        std::this_thread::yield();
+                    }
+                } });
+        for (int c = 0; c < CONSUMERS; c++)
+            threads.emplace_back([&]()
+                                 {
+                int value;
+                while (popped.load() < TOTAL)
+                {
+                    if (queue.tryPop(value))
+                    {
+                        if (value >= 0 && value < TOTAL)
+                            seen[value]++;
+                        popped++;
+                    }
+                    else
+                        std::this_thread::yield();
+                } });
+        for (std::thread &t : threads)
+            t.join();
+
+        bool exactlyOnce = true;
+        for (std::atomic_int &count : seen)
+            exactlyOnce = exactlyOnce && count.load() == 1;
+        check(popped == TOTAL, "stress: every pushed item is popped");
+        check(exactlyOnce, "stress: every item is seen exactly once");
+        check(fullHits > 0, "stress: producers ran into a full ring");
+        check(queue.empty(), "stress: the ring is empty at the end");
+    }
+
+    // 多级队列：每一级单独计算容量，同一级内先进先出
+    void priorityLevels()
+    {
+        LockFreePriorityQueue<int> queue(2);
+        check(queue.tryPush(1, TaskPriority::PRIORITY_LOW), "priority: push low");
+        check(queue.tryPush(2, TaskPriority::PRIORITY_LOW), "priority: push low");
+        check(queue.full(TaskPriority::PRIORITY_LOW), "priority: the low level is full");
+        check(!queue.tryPush(3, TaskPriority::PRIORITY_LOW), "priority: push into a full level fails");
+        check(!queue.full(TaskPriority::PRIORITY_HIGH), "priority: other levels are not full");
+        check(queue.tryPush(10, TaskPriority::PRIORITY_HIGH), "priority: push high");
+
+        int item = 0;
+        TaskPriority priority = TaskPriority::PRIORITY_NORMAL;
+        check(queue.tryPop(item, &priority) && item == 10 && priority == TaskPriority::PRIORITY_HIGH,
+              "priority: high priority comes first");
+        check(queue.tryPop(item, &priority) && item == 1 && priority == TaskPriority::PRIORITY_LOW,
+              "priority: low level is first in first out");
+        check(queue.tryPopLevel(item, TaskPriority::PRIORITY_LOW) && item == 2, "priority: pop a given level");
+        check(!queue.tryPop(item) && queue.size() == 0, "priority: queue is empty");
+    }
+}
+
+int main()
+{
+    fullRing();
+    destroyNonEmpty();
+    stress();
+    priorityLevels();
+    return testing::result();
+}
@@ -0,0 +1,69 @@
+// 运行统计导出（Prometheus 文本格式）的回归测试
+#include <poolStats.hpp>
+#include <string>
+#include "testing.hpp"
+
+namespace
+{
+    using testing::check;
+
+    bool contains(const std::string &text, const std::string &part)
+    {
+        return text.find(part) != std::string::npos;
+    }
+
+    // 线程池名和租户名里的反斜杠、双引号和换行按 Prometheus 的规则转义，每个样本仍然只占一行
+    void escapesLabelValues()
+    {
+        PoolStats stats;
+        TenantStats tenant;
+        tenant.name_ = "say \"hi\"\\\nbye";
+        tenant.weight_ = 1;
+        tenant.queued_ = 3;
+        tenant.executed_ = 5;
+        tenant.busyNs_ = 0;
+        stats.tenants_.push_back(tenant);
+        std::string text = formatPrometheus(stats, "io\"pool\\\n");
+
+        check(contains(text, "threadpool_tasks_submitted_total{pool=\"io\\\"pool\\\\\\n\"} 0\n"),
+              "escape: the pool label is escaped");
+        check(contains(text, "threadpool_queue_wait_seconds_count{pool=\"io\\\"pool\\\\\\n\"} 0\n"),
+              "escape: the pool label is escaped in summaries");
+        check(contains(text, "threadpool_tenant_queue_depth{pool=\"io\\\"pool\\\\\\n\",tenant=\"say \\\"hi\\\"\\\\\\nbye\"} 3\n"),
+              "escape: the tenant label is escaped");
+
+        bool samplesOnOneLine = true;
+        std::size_t begin = 0;
+        while (begin < text.size())
+        {
+            std::size_t end = text.find('\n', begin);
+            std::string line = text.substr(begin, end - begin);
+            if (!line.empty() && line[0] != '#' && line.compare(0, 11, "threadpool_") != 0)
+                samplesOnOneLine = false;
+            begin = end + 1;
+        }
+        check(samplesOnOneLine, "escape: every sample stays on one line");
+    }
+
+    // 很长的租户名不会被截断
+    void longTenantName()
+    {
+        PoolStats stats;
+        TenantStats tenant;
+        tenant.name_ = std::string(1000, 't');
+        tenant.weight_ = 1;
+        tenant.queued_ = 7;
+        tenant.executed_ = 0;
+        tenant.busyNs_ = 0;
+        stats.tenants_.push_back(tenant);
+        std::string text = formatPrometheus(stats);
+        check(contains(text, "tenant=\"" + tenant.name_ + "\"} 7\n"), "long tenant: the name is not truncated");
+    }
+}
+
+int main()
+{
+    escapesLabelValues();
+    longTenantName();
+    return testing::result();
+}
@@ -0,0 +1,392 @@
+// ThreadPool 的回归测试，每个用例在有锁和无锁两种任务队列下各运行一次
+#include <threadpool.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "testing.hpp"
+
+namespace
+{
+    using testing::check;
+
+    // 返回构造时给定的值
+    class ValueTask : public TypedTask<int>
+    {
+    public:
+        ValueTask(int value, std::atomic_int &ran) : value_(value), ran_(ran)
+        {
+        }
+
+        int run() override
+        {
+            ran_++;
+            return value_;
+        }
+
+    private:
+        int value_;
+        std::atomic_int &ran_;
+    };
+
+    // 在工作线程里面提交一批高、低优先级和普通优先级的任务，然后等待它们执行完
+    class SpawnTask : public TypedTask<int>
+    {
+    public:
+        SpawnTask(ThreadPool &pool, int count, std::atomic_int &ran) : pool_(pool), count_(count), ran_(ran)
+        {
+        }
+
+        int run() override
+        {
+            static const TaskPriority PRIORITIES[] = {TaskPriority::PRIORITY_HIGH, TaskPriority::PRIORITY_NORMAL, TaskPriority::PRIORITY_LOW};
+            std::vector<std::shared_ptr<TypedResult<int>>> inner;
+            for (int k = 0; k < count_; k++)
+                inner.push_back(pool_.submitTask(std::make_shared<ValueTask>(k, ran_), PRIORITIES[k % 3]));
+            int sum = 0;
+            for (std::shared_ptr<TypedResult<int>> &result : inner)
+                sum += result->get();
+            return sum;
+        }
+
+    private:
+        ThreadPool &pool_;
+        int count_;
+        std::atomic_int &ran_;
+    };
+
+    // 把任务放入自己的私有队列，然后不帮忙执行，等其他线程偷走全部任务
+    class StealMeTask : public TypedTask<int>
+    {
+    public:
+        StealMeTask(ThreadPool &pool, int count, std::atomic_int &ran) : pool_(pool), count_(count), ran_(ran)
+        {
+        }
+
+        int run() override
+        {
+            std::vector<std::shared_ptr<TypedResult<int>>> inner;
+            for (int k = 0; k < count_; k++)
+                inner.push_back(pool_.submitTask(std::make_shared<ValueTask>(1, ran_)));
+            while (ran_ < count_)
+                std::this_thread::yield();
+            return ran_;
+        }
+
+    private:
+        ThreadPool &pool_;
+        int count_;
+        std::atomic_int &ran_;
+    };
+
+    // 占住线程，直到 release 被设置
+    class GateTask : public TypedTask<int>
+    {
+    public:
+        GateTask(std::atomic_bool &started, std::atomic_bool &release) : started_(started), release_(release)
+        {
+        }
+
+        int run() override
+        {
+            started_ = true;
+            while (!release_)
+                std::this_thread::yield();
+            return 0;
+        }
+
+    private:
+        std::atomic_bool &started_;
+        std::atomic_bool &release_;
+    };
+
+    // 记录是不是在提交任务的线程里执行
+    class OnCallerTask : public TypedTask<int>
+    {
+    public:
+        OnCallerTask(std::thread::id caller, std::atomic_int &callerRan) : caller_(caller), callerRan_(callerRan)
+        {
+        }
+
+        int run() override
+        {
+            if (std::this_thread::get_id() == caller_)
+                callerRan_++;
+            return 1;
+        }
+
+    private:
+        std::thread::id caller_;
+        std::atomic_int &callerRan_;
+    };
+
+    // 一直执行到 token() 变成已取消，最多5s；返回是否被取消
+    class UntilCancelledTask : public TypedTask<int>
+    {
+    public:
+        explicit UntilCancelledTask(std::atomic_bool &started) : started_(started)
+        {
+        }
+
+        int run() override
+        {
+            started_ = true;
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (!token().isCancelled() && std::chrono::steady_clock::now() < deadline)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return token().isCancelled() ? 1 : 0;
+        }
+
+    private:
+        std::atomic_bool &started_;
+    };
+
+    int64_t elapsedMs(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // 多个外部线程同时向很小的队列提交三种优先级的任务，队列满时等待，每个任务恰好执行一次
+    void externalProducers(QueueMode mode)
+    {
+        const int PRODUCERS = 4;
+        const int PER_PRODUCER = 500;
+        std::atomic_int ran(0);
+        ThreadPool pool;
+        pool.setQueueMode(mode);
+        pool.setTaskQueueMaxThreshHold(4);
+        pool.setRejectPolicy(RejectPolicy::REJECT_BLOCK);
+        pool.setStatsEnabled(true);
+        pool.start(3);
+
+        std::vector<std::vector<std::shared_ptr<TypedResult<int>>>> results(PRODUCERS);
+        std::vector<std::thread> producers;
+        for (int p = 0; p < PRODUCERS; p++)
+            producers.emplace_back([&, p]()
+                                   {
+                for (int i = 0; i < PER_PRODUCER; i++)
+                    results[p].push_back(pool.submitTask(std::make_shared<ValueTask>(1, ran), (TaskPriority)(i % TASK_PRIORITY_LEVELS))); });
+        for (std::thread &t : producers)
+            t.join();
+
+        int sum = 0;
+        bool valid = true;
+        for (std::vector<std::shared_ptr<TypedResult<int>>> &list : results)
+            for (std::shared_ptr<TypedResult<int>> &result : list)
+            {
+                valid = valid && result->isValid();
+                sum += result->get();
+            }
+        check(valid, "external producers: no task is rejected");
+        check(sum == PRODUCERS * PER_PRODUCER, "external producers: every result is delivered");
+        check(ran == PRODUCERS * PER_PRODUCER, "external producers: every task runs exactly once");
+        check(pool.stats().rejected_ == 0, "external producers: nothing is counted as rejected");
+    }
+
+    // 工作线程提交的任务在队列满时超额放入或者放入私有队列，等待结果的工作线程帮忙执行，不能死锁
+    void workerSubmitIntoFullQueue(QueueMode mode)
+    {
+        const int OUTER = 4;
+        const int INNER = 60;
+        std::atomic_int ran(0);
+        ThreadPool pool;
+        pool.setQueueMode(mode);
+        pool.setTaskQueueMaxThreshHold(2);
+        pool.setRejectPolicy(RejectPolicy::REJECT_BLOCK);
+        pool.setStatsEnabled(true);
+        pool.start(2);
+
+        std::vector<std::shared_ptr<TypedResult<int>>> results;
+        for (int i = 0; i < OUTER; i++)
+            results.push_back(pool.submitTask(std::make_shared<SpawnTask>(pool, INNER, ran)));
+        for (std::shared_ptr<TypedResult<int>> &result : results)
+            check(result->get() == INNER * (INNER - 1) / 2, "worker submit: every inner task runs");
+        check(ran == OUTER * INNER, "worker submit: inner tasks run exactly once");
+        check(pool.stats().rejected_ == 0, "worker submit: nothing is rejected");
+    }
+
+    // 批量提交：队列放得下的一批任务全部执行
+    void batchSubmit(QueueMode mode)
+    {
+        const int TASKS = 64;
+        std::atomic_int ran(0);
+        std::vector<std::shared_ptr<ValueTask>> tasks;
+        for (int i = 0; i < TASKS; i++)
+            tasks.push_back(std::make_shared<ValueTask>(1, ran));
+        int accepted = 0;
+        {
+            ThreadPool pool;
+            pool.setQueueMode(mode);
+            pool.setTaskQueueMaxThreshHold(1024);
+            pool.start(2);
+            std::vector<std::shared_ptr<TypedResult<int>>> results = pool.submitBatch(tasks);
+            check(results.size() == TASKS, "batch: one result per task");
+            for (std::shared_ptr<TypedResult<int>> &result : results)
+                if (result->isValid())
+                    accepted += result->get();
+        }
+        check(accepted == TASKS && ran == TASKS, "batch: every task in a batch that fits runs");
+    }
+
+    // 忙碌线程私有队列里的任务被其他线程偷走，按NUMA节点绑核时同样能偷到
+    void stealFromBusyWorker(QueueMode mode, const PlacementPolicy &placement)
+    {
+        const int INNER = 200;
+        std::atomic_int ran(0);
+        ThreadPool pool;
+        pool.setQueueMode(mode);
+        pool.setStatsEnabled(true);
+        pool.start(3, placement);
+        std::shared_ptr<TypedResult<int>> result = pool.submitTask(std::make_shared<StealMeTask>(pool, INNER, ran));
+        check(result->get() == INNER, "steal: every task in a busy worker's queue runs");
+        uint64_t stolen = 0;
+        for (const WorkerStats &worker : pool.stats().workers_)
+            stolen += worker.stolen_;
+        check(stolen == INNER, "steal: the tasks are stolen by other workers");
+    }
+
+    // REJECT_CALLER_RUNS：单个提交和批量提交时由提交线程执行的任务都不算拒绝
+    void callerRunsIsNotRejected()
+    {
+        std::atomic_bool started(false);
+        std::atomic_bool release(false);
+        std::atomic_int ran(0);
+        std::atomic_int callerRan(0);
+        std::thread::id caller = std::this_thread::get_id();
+        ThreadPool pool;
+        pool.setTaskQueueMaxThreshHold(1);
+        pool.setRejectPolicy(RejectPolicy::REJECT_CALLER_RUNS);
+        pool.setStatsEnabled(true);
+        pool.start(1);
+        // 唯一的线程被占住，再放入一个任务把队列放满
+        std::shared_ptr<TypedResult<int>> gate = pool.submitTask(std::make_shared<GateTask>(started, release));
+        while (!started)
+            std::this_thread::yield();
+        std::shared_ptr<TypedResult<int>> queued = pool.submitTask(std::make_shared<ValueTask>(0, ran));
+
+        int sum = pool.submitTask(std::make_shared<OnCallerTask>(caller, callerRan))->get();
+        std::vector<std::shared_ptr<OnCallerTask>> batch;
+        for (int i = 0; i < 3; i++)
+            batch.push_back(std::make_shared<OnCallerTask>(caller, callerRan));
+        for (std::shared_ptr<TypedResult<int>> &result : pool.submitBatch(batch))
+            sum += result->get();
+        release = true;
+        gate->get();
+        queued->get();
+        check(sum == 4 && callerRan == 4, "caller runs: tasks over the limit run on the caller");
+        PoolStats stats = pool.stats();
+        check(stats.rejected_ == 0, "caller runs: tasks run by the caller are not counted as rejected");
+        check(stats.submitted_ == 2, "caller runs: only queued tasks are counted as submitted");
+    }
+
+    // 取消排队的任务：Result 变为无效，任务不执行
+    void cancelQueuedTask()
+    {
+        std::atomic_bool started(false);
+        std::atomic_bool release(false);
+        std::atomic_int ran(0);
+        ThreadPool pool;
+        pool.start(1);
+        std::shared_ptr<TypedResult<int>> gate = pool.submitTask(std::make_shared<GateTask>(started, release));
+        while (!started)
+            std::this_thread::yield();
+        std::shared_ptr<TypedResult<int>> queued = pool.submitTask(std::make_shared<ValueTask>(1, ran));
+        check(queued->cancel(), "cancel: cancelling a queued task succeeds");
+        check(!queued->isValid(), "cancel: a cancelled task's result is invalid");
+        release = true;
+        gate->get();
+        pool.shutdown();
+        check(queued->get() == 0 && ran == 0, "cancel: a cancelled task never runs");
+    }
+
+    // SHUTDOWN_CANCEL_PENDING：很深的队列不用执行完，shutdown 很快返回，排队的任务全部取消
+    void shutdownCancelsDeepQueue(QueueMode mode)
+    {
+        const int QUEUED = 20000;
+        std::atomic_bool started(false);
+        std::atomic_bool release(false);
+        std::atomic_int ran(0);
+        ThreadPool pool;
+        pool.setQueueMode(mode);
+        pool.setTaskQueueMaxThreshHold(QUEUED);
+        pool.start(1);
+        std::shared_ptr<TypedResult<int>> gate = pool.submitTask(std::make_shared<GateTask>(started, release));
+        while (!started)
+            std::this_thread::yield();
+        std::vector<std::shared_ptr<TypedResult<int>>> queued;
+        for (int i = 0; i < QUEUED; i++)
+            queued.push_back(pool.submitTask(std::make_shared<ValueTask>(1, ran)));
+        std::thread releaser([&release]()
+                             {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            release = true; });
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool done = pool.shutdown(ShutdownMode::SHUTDOWN_CANCEL_PENDING, std::chrono::milliseconds(5000));
+        int64_t elapsed = elapsedMs(start);
+        releaser.join();
+        check(done, "cancel pending: shutdown finishes");
+        check(elapsed < 1000, "cancel pending: shutdown does not run the queued tasks");
+        int cancelled = 0;
+        for (std::shared_ptr<TypedResult<int>> &result : queued)
+            cancelled += result->isValid() ? 0 : 1;
+        check(cancelled == QUEUED && ran == 0, "cancel pending: every queued task is cancelled");
+    }
+
+    // shutdown 超时返回false，再次调用换成 SHUTDOWN_ABORT：正在执行的任务的 token() 变成已取消
+    void shutdownTimeoutThenAbort()
+    {
+        std::atomic_bool started(false);
+        std::atomic_int ran(0);
+        ThreadPool pool;
+        pool.start(1);
+        std::shared_ptr<TypedResult<int>> running = pool.submitTask(std::make_shared<UntilCancelledTask>(started));
+        while (!started)
+            std::this_thread::yield();
+        std::shared_ptr<TypedResult<int>> queued = pool.submitTask(std::make_shared<ValueTask>(1, ran));
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        check(!pool.shutdown(ShutdownMode::SHUTDOWN_DRAIN, std::chrono::milliseconds(50)), "escalate: shutdown times out while a task runs");
+        check(elapsedMs(start) >= 50, "escalate: shutdown waits for the timeout");
+        check(pool.shutdown(ShutdownMode::SHUTDOWN_ABORT, std::chrono::milliseconds(3000)), "escalate: a second shutdown with abort finishes");
+        check(elapsedMs(start) < 1000, "escalate: the running task stops early");
+        check(running->get() == 1, "escalate: abort cancels the running task's token");
+        check(!queued->isValid() && ran == 0, "escalate: abort cancels the queued task");
+    }
+
+    // shutdown 以后拒绝外部提交的任务
+    void submitAfterShutdown()
+    {
+        std::atomic_int ran(0);
+        ThreadPool pool;
+        pool.setStatsEnabled(true);
+        pool.start(1);
+        pool.shutdown();
+        std::shared_ptr<TypedResult<int>> single = pool.submitTask(std::make_shared<ValueTask>(1, ran));
+        std::vector<std::shared_ptr<ValueTask>> batch;
+        for (int i = 0; i < 2; i++)
+            batch.push_back(std::make_shared<ValueTask>(1, ran));
+        std::vector<std::shared_ptr<TypedResult<int>>> batched = pool.submitBatch(batch);
+        check(!single->isValid() && !batched[0]->isValid() && !batched[1]->isValid(), "after shutdown: submits from outside the pool are rejected");
+        check(ran == 0, "after shutdown: rejected tasks never run");
+        check(pool.stats().rejected_ == 3, "after shutdown: rejected submits are counted");
+    }
+}
+
+int main()
+{
+    externalProducers(QueueMode::MODE_LOCKED);
+    externalProducers(QueueMode::MODE_LOCKFREE);
+    workerSubmitIntoFullQueue(QueueMode::MODE_LOCKED);
+    workerSubmitIntoFullQueue(QueueMode::MODE_LOCKFREE);
+    batchSubmit(QueueMode::MODE_LOCKED);
+    batchSubmit(QueueMode::MODE_LOCKFREE);
+    stealFromBusyWorker(QueueMode::MODE_LOCKED, PlacementPolicy());
+    stealFromBusyWorker(QueueMode::MODE_LOCKFREE, PlacementPolicy::numaNode());
+    callerRunsIsNotRejected();
+    cancelQueuedTask();
+    shutdownCancelsDeepQueue(QueueMode::MODE_LOCKED);
+    shutdownCancelsDeepQueue(QueueMode::MODE_LOCKFREE);
+    shutdownTimeoutThenAbort();
+    submitAfterShutdown();
+    return testing::result();
+}
@@ -0,0 +1,341 @@
+// ThreadPool2 的回归测试
+#include <threadPool.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "testing.hpp"
+
+namespace
+{
+    using testing::check;
+
+    // 同时到期的定时任务远多于任务队列上限，全部都要执行，不能丢失
+    void timerBurstOverQueueLimit(QueueMode mode)
+    {
+        const int TIMERS = 100;
+        std::atomic_int ran(0);
+        ThreadPool2 pool;
+        pool.setQueueMode(mode);
+        pool.setTaskQueueMaxThreshHold(4);
+        pool.start(2);
+        std::vector<ScheduledFuture<int>> results;
+        for (int i = 0; i < TIMERS; i++)
+            results.push_back(pool.submitAfter(std::chrono::milliseconds(20), [&ran, i]() -> int
+                                               {
+                ran++;
+                return i; }));
+        int sum = 0;
+        bool broken = false;
+        for (ScheduledFuture<int> &result : results)
+        {
+            try
+            {
+                sum += result.future.get();
+            }
+            catch (...)
+            {
+                broken = true;
+            }
+        }
+        check(!broken, "timer burst: a due timer task was not executed");
+        check(ran == TIMERS, "timer burst: every due timer task runs once");
+        check(sum == TIMERS * (TIMERS - 1) / 2, "timer burst: results are delivered");
+    }
+
+    // 工作线程提交的高、低优先级任务在队列满时超额放入，不能等待队列腾出位置（REJECT_BLOCK 下会死锁）
+    void workerSubmitIntoFullQueue(QueueMode mode)
+    {
+        const int INNER = 50;
+        ThreadPool2 pool;
+        pool.setQueueMode(mode);
+        pool.setTaskQueueMaxThreshHold(2);
+        pool.setRejectPolicy(RejectPolicy::REJECT_BLOCK);
+        pool.start(2);
+        std::vector<Future<int>> results;
+        for (int i = 0; i < 4; i++)
+            results.push_back(pool.submitTask([&pool]() -> int
+                                              {
+                std::vector<Future<int>> inner;
+                for (int k = 0; k < INNER; k++)
+                    inner.push_back(pool.submitTask(k % 2 == 0 ? TaskPriority::PRIORITY_HIGH : TaskPriority::PRIORITY_LOW, [k]() -> int
+                                                    { return k; }));
+                int sum = 0;
+                for (Future<int> &result : inner)
+                    sum += result.get();
+                return sum; }));
+        for (Future<int> &result : results)
+            check(result.get() == INNER * (INNER - 1) / 2, "worker submit: every inner task runs");
+        check(pool.stats().rejected_ == 0, "worker submit: nothing is rejected");
+    }
+
+    // 不存在的租户总是被拒绝：不按 REJECT_CALLER_RUNS 在当前线程执行，也不算作队列满的拒绝
+    void unknownTenantIsRejected()
+    {
+        ThreadPool2 pool;
+        pool.setRejectPolicy(RejectPolicy::REJECT_CALLER_RUNS);
+        pool.start(1);
+        pool.addTenant("known");
+        bool ran = false;
+        Future<int> result = pool.submitTo(12345, [&ran]() -> int
+                                           {
+            ran = true;
+            return 7; });
+        bool rejected = false;
+        try
+        {
+            result.get();
+        }
+        catch (const TaskRejected &)
+        {
+            rejected = true;
+        }
+        check(rejected && !ran, "unknown tenant: rejected without running the task");
+        check(pool.stats().rejected_ == 0, "unknown tenant: not counted as a backpressure rejection");
+    }
+
+    // REJECT_CALLER_RUNS：单个提交和批量提交时由提交线程执行的任务都不算拒绝
+    void callerRunsIsNotRejected()
+    {
+        std::atomic_bool started(false);
+        std::atomic_bool release(false);
+        std::atomic_int callerRan(0);
+        std::thread::id caller = std::this_thread::get_id();
+        ThreadPool2 pool;
+        pool.setTaskQueueMaxThreshHold(1);
+        pool.setRejectPolicy(RejectPolicy::REJECT_CALLER_RUNS);
+        pool.setStatsEnabled(true);
+        pool.start(1);
+        // 唯一的线程被占住，再放入一个任务把队列放满
+        Future<int> gate = pool.submitTask([&]() -> int
+                                           {
+            started = true;
+            while (!release)
+                std::this_thread::yield();
+            return 0; });
+        while (!started)
+            std::this_thread::yield();
+        Future<int> queued = pool.submitTask([]() -> int
+                                             { return 0; });
+
+        auto onCaller = [&]() -> int
+        {
+            if (std::this_thread::get_id() == caller)
+                callerRan++;
+            return 1;
+        };
+        int sum = pool.submitTask(onCaller).get();
+        std::vector<std::function<int()>> batch(3, onCaller);
+        for (Future<int> &result : pool.submitBatch(batch.begin(), batch.end()))
+            sum += result.get();
+        release = true;
+        gate.get();
+        queued.get();
+        check(sum == 4 && callerRan == 4, "caller runs: tasks over the limit run on the caller");
+        PoolStats stats = pool.stats();
+        check(stats.rejected_ == 0, "caller runs: tasks run by the caller are not counted as rejected");
+        check(stats.submitted_ == 2, "caller runs: only queued tasks are counted as submitted");
+    }
+
+    // 任务开始执行以后一直占住线程，直到 release 被设置
+    std::function<int()> gateTask(std::atomic_bool &started, std::atomic_bool &release)
+    {
+        return [&started, &release]() -> int
+        {
+            started = true;
+            while (!release)
+                std::this_thread::yield();
+            return 0;
+        };
+    }
+
+    // 一直执行到 CancellationToken 变成已取消，最多5s；返回是否被取消
+    bool runUntilCancelled(CancellationToken token, std::atomic_bool &started)
+    {
+        started = true;
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!token.isCancelled() && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return token.isCancelled();
+    }
+
+    template <typename T>
+    bool getCancelled(Future<T> &future)
+    {
+        try
+        {
+            future.get();
+        }
+        catch (const TaskCancelled &)
+        {
+            return true;
+        }
+        return false;
+    }
+
+    int64_t elapsedMs(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // 取消排队的任务：get() 抛出 TaskCancelled，任务不执行
+    void cancelQueuedTask()
+    {
+        std::atomic_bool started(false);
+        std::atomic_bool release(false);
+        std::atomic_bool ran(false);
+        ThreadPool2 pool;
+        pool.start(1);
+        Future<int> gate = pool.submitTask(gateTask(started, release));
+        while (!started)
+            std::this_thread::yield();
+        Future<int> queued = pool.submitTask([&ran]() -> int
+                                             {
+            ran = true;
+            return 1; });
+        check(queued.cancel(), "cancel: cancelling a queued task succeeds");
+        release = true;
+        gate.get();
+        check(getCancelled(queued), "cancel: get() on a cancelled task throws TaskCancelled");
+        pool.shutdown();
+        check(!ran, "cancel: a cancelled task never runs");
+    }
+
+    // SHUTDOWN_CANCEL_PENDING：很深的队列不用执行完，shutdown 很快返回，排队的任务全部取消
+    void shutdownCancelsDeepQueue()
+    {
+        const int QUEUED = 20000;
+        std::atomic_bool started(false);
+        std::atomic_bool release(false);
+        std::atomic_int ran(0);
+        ThreadPool2 pool;
+        pool.setTaskQueueMaxThreshHold(QUEUED);
+        pool.start(1);
+        Future<int> gate = pool.submitTask(gateTask(started, release));
+        while (!started)
+            std::this_thread::yield();
+        // 每个任务1ms，全部执行要20s
+        std::vector<Future<int>> queued;
+        for (int i = 0; i < QUEUED; i++)
+            queued.push_back(pool.submitTask([&ran]() -> int
+                                             {
+                ran++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                return 1; }));
+        std::thread releaser([&release]()
+                             {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            release = true; });
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool done = pool.shutdown(ShutdownMode::SHUTDOWN_CANCEL_PENDING, std::chrono::milliseconds(5000));
+        int64_t elapsed = elapsedMs(start);
+        releaser.join();
+        check(done, "cancel pending: shutdown finishes");
+        check(elapsed < 1000, "cancel pending: shutdown does not run the queued tasks");
+        check(gate.get() == 0, "cancel pending: the running task completes");
+        int cancelled = 0;
+        for (Future<int> &future : queued)
+            cancelled += getCancelled(future) ? 1 : 0;
+        check(cancelled == QUEUED && ran == 0, "cancel pending: every queued task is cancelled");
+    }
+
+    // SHUTDOWN_ABORT：正在执行的任务的 CancellationToken 变成已取消
+    void abortCancelsRunningToken()
+    {
+        std::atomic_bool started(false);
+        ThreadPool2 pool;
+        pool.start(1);
+        Future<bool> running = pool.submitTask([&started](CancellationToken token) -> bool
+                                               { return runUntilCancelled(token, started); });
+        while (!started)
+            std::this_thread::yield();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        check(pool.shutdown(ShutdownMode::SHUTDOWN_ABORT, std::chrono::milliseconds(3000)), "abort: shutdown finishes");
+        check(elapsedMs(start) < 1000, "abort: the running task stops early");
+        check(running.get(), "abort: the running task sees its token cancelled");
+    }
+
+    // shutdown 超时返回false，再次调用换成更快的方式
+    void shutdownTimeoutThenEscalate()
+    {
+        std::atomic_bool started(false);
+        std::atomic_bool ran(false);
+        ThreadPool2 pool;
+        pool.start(1);
+        Future<bool> running = pool.submitTask([&started](CancellationToken token) -> bool
+                                               { return runUntilCancelled(token, started); });
+        while (!started)
+            std::this_thread::yield();
+        Future<int> queued = pool.submitTask([&ran]() -> int
+                                             {
+            ran = true;
+            return 1; });
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        check(!pool.shutdown(ShutdownMode::SHUTDOWN_DRAIN, std::chrono::milliseconds(50)), "escalate: shutdown times out while a task runs");
+        check(elapsedMs(start) >= 50, "escalate: shutdown waits for the timeout");
+        check(pool.shutdown(ShutdownMode::SHUTDOWN_ABORT, std::chrono::milliseconds(3000)), "escalate: a second shutdown with abort finishes");
+        check(running.get(), "escalate: abort cancels the running task's token");
+        check(getCancelled(queued) && !ran, "escalate: abort cancels the queued task");
+    }
+
+    // shutdown 以后拒绝外部提交的任务，正在执行的任务提交的子任务仍然接受
+    void submitAfterShutdown()
+    {
+        std::atomic_bool started(false);
+        std::atomic_bool release(false);
+        ThreadPool2 pool;
+        pool.start(2);
+        Future<int> outer = pool.submitTask([&]() -> int
+                                            {
+            started = true;
+            while (!release)
+                std::this_thread::yield();
+            return pool.submitTask([]() -> int
+                                   { return 42; })
+                .get(); });
+        while (!started)
+            std::this_thread::yield();
+        std::thread closer([&pool]()
+                           { pool.shutdown(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        release = true;
+        closer.join();
+        check(outer.get() == 42, "after shutdown: a running task can still submit subtasks");
+
+        Future<int> single = pool.submitTask([]() -> int
+                                             { return 1; });
+        std::vector<std::function<int()>> batch(2, []() -> int
+                                                { return 1; });
+        std::vector<Future<int>> batched = pool.submitBatch(batch.begin(), batch.end());
+        int rejected = 0;
+        for (Future<int> *future : {&single, &batched[0], &batched[1]})
+        {
+            try
+            {
+                future->get();
+            }
+            catch (const TaskRejected &)
+            {
+                rejected++;
+            }
+        }
+        check(rejected == 3, "after shutdown: submits from outside the pool are rejected");
+    }
+}
+
+int main()
+{
+    timerBurstOverQueueLimit(QueueMode::MODE_LOCKED);
+    timerBurstOverQueueLimit(QueueMode::MODE_LOCKFREE);
+    workerSubmitIntoFullQueue(QueueMode::MODE_LOCKED);
+    workerSubmitIntoFullQueue(QueueMode::MODE_LOCKFREE);
+    unknownTenantIsRejected();
+    callerRunsIsNotRejected();
+    cancelQueuedTask();
+    shutdownCancelsDeepQueue();
+    abortCancelsRunningToken();
+    shutdownTimeoutThenEscalate();
+    submitAfterShutdown();
+    return testing::result();
+}
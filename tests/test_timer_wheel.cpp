@@ -0,0 +1,227 @@
+// 时间轮 TimerWheel 和 ThreadPool2 定时任务的回归测试
+#include <threadPool.hpp>
+#include <timerWheel.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <thread>
+#include "testing.hpp"
+
+namespace
+{
+    using testing::check;
+    using Clock = TimerWheel::Clock;
+    using std::chrono::milliseconds;
+
+    // 第1~3层和超过最大延迟的定时器要几十秒到十几个小时才到期，用可以快进的时钟测试
+    std::atomic<int64_t> &clockOffset()
+    {
+        static std::atomic<int64_t> offset(0);
+        return offset;
+    }
+
+    Clock::time_point fakeNow()
+    {
+        return Clock::now() + milliseconds(clockOffset().load());
+    }
+
+    // 快进时钟，再放入一个马上到期的空定时器叫醒定时器线程，让它处理中间经过的tick
+    void advance(TimerWheel &wheel, int64_t ms)
+    {
+        clockOffset() += ms;
+        wheel.schedule(fakeNow(), []() {});
+    }
+
+    // 每隔1ms检查一次，直到 cond 成立或者超时
+    template <typename Cond>
+    bool waitUntil(Cond cond, milliseconds timeout)
+    {
+        Clock::time_point deadline = Clock::now() + timeout;
+        while (!cond())
+        {
+            if (Clock::now() >= deadline)
+                return false;
+            std::this_thread::sleep_for(milliseconds(1));
+        }
+        return true;
+    }
+
+    // 按到期时间先后触发，不能提前；超过256ms的定时器从第1层分散到第0层
+    void cascadeFromLevel1()
+    {
+        const int64_t DELAYS[] = {300, 40, 600, 256};
+        const int TIMERS = sizeof(DELAYS) / sizeof(DELAYS[0]);
+        std::atomic<int64_t> firedAt[TIMERS];
+        for (std::atomic<int64_t> &at : firedAt)
+            at.store(-1);
+        TimerWheel wheel([](TaskFunction task)
+                         { task(); });
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < TIMERS; i++)
+            wheel.schedule(start + milliseconds(DELAYS[i]), [&firedAt, start, i]()
+                           { firedAt[i] = std::chrono::duration_cast<milliseconds>(Clock::now() - start).count(); });
+        bool fired = waitUntil([&firedAt]() -> bool
+                               {
+            for (std::atomic<int64_t> &at : firedAt)
+                if (at < 0)
+                    return false;
+            return true; },
+                               milliseconds(3000));
+        check(fired, "cascade: every timer fires");
+        for (int i = 0; i < TIMERS; i++)
+        {
+            check(firedAt[i] >= DELAYS[i], "cascade: a timer never fires early");
+            check(firedAt[i] < DELAYS[i] + 200, "cascade: a timer fires close to its deadline");
+        }
+        check(wheel.pending() == 0, "cascade: nothing is pending after all timers fire");
+    }
+
+    // 快进到离到期还有 100ms，这时还不能触发，再等真实的时间触发
+    void fireAfterAdvance(int64_t delay, const char *early, const char *lost)
+    {
+        std::atomic_bool fired(false);
+        TimerWheel wheel([](TaskFunction task)
+                         { task(); },
+                         &fakeNow);
+        wheel.schedule(fakeNow() + milliseconds(delay), [&fired]()
+                       { fired = true; });
+        advance(wheel, delay - 100);
+        std::this_thread::sleep_for(milliseconds(30));
+        check(!fired, early);
+        check(waitUntil([&fired]() -> bool
+                        { return fired; },
+                        milliseconds(2000)),
+              lost);
+    }
+
+    // 第2、3层的定时器逐层分散到第0层
+    void cascadeFromUpperLevels()
+    {
+        fireAfterAdvance((1 << 14) + 300, "level 2: a timer never fires early", "level 2: a timer fires after cascading");
+        fireAfterAdvance((1 << 20) + 300, "level 3: a timer never fires early", "level 3: a timer fires after cascading");
+    }
+
+    // 超过最大延迟（2^26 tick）的定时器先放在最远的槽位，转到时重新放入，不能在那时提前触发
+    void beyondMaxDelay()
+    {
+        const int64_t MAX_DELAY = (int64_t)1 << 26;
+        const int64_t DELAY = MAX_DELAY + (1 << 21) + 300;
+        std::atomic_bool fired(false);
+        TimerWheel wheel([](TaskFunction task)
+                         { task(); },
+                         &fakeNow);
+        wheel.schedule(fakeNow() + milliseconds(DELAY), [&fired]()
+                       { fired = true; });
+        // 经过最远的槽位，定时器被重新放入时间轮
+        advance(wheel, MAX_DELAY + 1000);
+        check(waitUntil([&wheel]() -> bool
+                        { return wheel.pending() == 1; },
+                        milliseconds(2000)),
+              "max delay: the relinked timer is still pending");
+        check(!fired, "max delay: a far timer is relinked instead of firing");
+        advance(wheel, DELAY - MAX_DELAY - 1000 - 100);
+        std::this_thread::sleep_for(milliseconds(30));
+        check(!fired, "max delay: a relinked timer never fires early");
+        check(waitUntil([&fired]() -> bool
+                        { return fired; },
+                        milliseconds(2000)),
+              "max delay: a relinked timer fires");
+    }
+
+    // 取消：到期之前取消成功且任务不执行；已经触发、已经取消或者句柄过期（节点已被复用）时取消失败
+    void cancelTimers()
+    {
+        std::atomic_int ran(0);
+        TimerWheel wheel([](TaskFunction task)
+                         { task(); });
+        TimerHandle before = wheel.schedule(Clock::now() + milliseconds(50), [&ran]()
+                                            { ran += 1; });
+        check(before.cancel(), "cancel: cancelling a pending timer succeeds");
+        check(!before.cancel(), "cancel: cancelling twice fails");
+        check(wheel.pending() == 0, "cancel: a cancelled timer is not pending");
+
+        TimerHandle after = wheel.schedule(Clock::now() + milliseconds(10), [&ran]()
+                                           { ran += 10; });
+        check(waitUntil([&ran]() -> bool
+                        { return ran == 10; },
+                        milliseconds(2000)),
+              "cancel: an uncancelled timer fires");
+        check(!after.cancel(), "cancel: cancelling a fired timer fails");
+
+        // 回收的节点放在空闲链表的头部，下一个定时器复用同一个节点，旧句柄的 generation 已经过期
+        TimerHandle reused = wheel.schedule(Clock::now() + milliseconds(30), [&ran]()
+                                            { ran += 100; });
+        check(!after.cancel(), "cancel: a stale handle does not cancel the timer reusing its node");
+        check(wheel.pending() == 1, "cancel: the reusing timer is still pending");
+        check(waitUntil([&ran]() -> bool
+                        { return ran == 110; },
+                        milliseconds(2000)),
+              "cancel: the reusing timer fires");
+        std::this_thread::sleep_for(milliseconds(80));
+        check(ran == 110, "cancel: a cancelled timer never runs");
+        check(!reused.cancel(), "cancel: cancelling after firing fails");
+    }
+
+    // 取消线程池的延迟任务：Future 得到 broken_promise，任务不执行
+    void cancelScheduledFuture()
+    {
+        std::atomic_bool ran(false);
+        ThreadPool2 pool;
+        pool.start(1);
+        ScheduledFuture<int> result = pool.submitAfter(milliseconds(50), [&ran]() -> int
+                                                       {
+            ran = true;
+            return 1; });
+        check(result.timer.cancel(), "scheduled future: cancel before the deadline succeeds");
+        bool broken = false;
+        try
+        {
+            result.future.get();
+        }
+        catch (const std::future_error &e)
+        {
+            broken = e.code() == std::future_errc::broken_promise;
+        }
+        check(broken, "scheduled future: a cancelled task gives broken_promise");
+        std::this_thread::sleep_for(milliseconds(100));
+        check(!ran, "scheduled future: a cancelled task never runs");
+    }
+
+    // 周期任务上一次还没有执行完时跳过这一次：不会并发执行，也不会堆积
+    void periodicSkipsWhilePending()
+    {
+        std::atomic_int runs(0);
+        std::atomic_int running(0);
+        std::atomic_bool overlapped(false);
+        ThreadPool2 pool;
+        pool.start(4);
+        TimerHandle timer = pool.submitEvery(milliseconds(5), [&]()
+                                             {
+            if (running.fetch_add(1) != 0)
+                overlapped = true;
+            std::this_thread::sleep_for(milliseconds(50));
+            running--;
+            runs++; });
+        std::this_thread::sleep_for(milliseconds(300));
+        check(timer.cancel(), "periodic: cancelling a periodic timer succeeds");
+        int stopped = runs;
+        std::this_thread::sleep_for(milliseconds(150));
+        check(!overlapped, "periodic: runs never overlap");
+        check(stopped >= 2, "periodic: the task keeps running");
+        check(stopped <= 8, "periodic: ticks while a run is pending are skipped");
+        check(runs <= stopped + 1, "periodic: no runs pile up after cancel");
+        check(!timer.cancel(), "periodic: cancelling twice fails");
+    }
+}
+
+int main()
+{
+    cascadeFromLevel1();
+    cascadeFromUpperLevels();
+    beyondMaxDelay();
+    cancelTimers();
+    cancelScheduledFuture();
+    periodicSkipsWhilePending();
+    return testing::result();
+}
@@ -0,0 +1,37 @@
+#ifndef TESTING_HPP
+#define TESTING_HPP
+
+#include <cstdio>
+
+/*
+回归测试共用的检查函数
+ThreadPool 和 ThreadPool2 都定义了 Thread、PoolMode，不能放在同一个编译单元里，
+所以 tests/ 下每个 .cpp 是一个单独的测试程序，失败时输出原因并返回非0，由 ctest 运行
+*/
+namespace testing
+{
+    inline int &failures()
+    {
+        static int count = 0;
+        return count;
+    }
+
+    inline void check(bool cond, const char *what)
+    {
+        if (!cond)
+        {
+            std::fprintf(stderr, "FAIL: %s\n", what);
+            failures()++;
+        }
+    }
+
+    // main 的返回值
+    inline int result()
+    {
+        if (failures() == 0)
+            std::printf("all tests passed\n");
+        return failures() == 0 ? 0 : 1;
+    }
+}
+
+#endif